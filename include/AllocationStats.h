@@ -0,0 +1,17 @@
+#pragma once
+
+#include <cstdint>
+
+// Heap allocations are counted per thread by replacing global operator
+// new, at the cost of one thread local increment per allocation. Used to
+// follow how many allocations a task makes; only in builds made with
+// --allocation-stats (MOSSE_ALLOCATION_STATS), otherwise counts are zero
+// and nothing is reported.
+
+// Allocations made by calling thread so far
+uint64_t ThreadAllocations();
+
+// Collect allocations of one task, and log the average and largest number
+// at the end of the run
+void AddTaskAllocations(uint64_t count);
+void ReportAllocations();
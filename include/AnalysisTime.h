@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+// Analysis time as hours since 1970-01-01 00 UTC, with calendar fields and
+// the "yyyy-mm-dd hh:mm:ss" form computed once. Made from a string once in
+// main; shifting and calendar lookups after that do not parse anything.
+
+class AnalysisTime
+{
+public:
+	AnalysisTime() = default;
+
+	// "yyyy-mm-dd hh:mm:ss" or "yyyy-mm-dd hh:mm"; minutes and seconds must be
+	// zero
+	static AnalysisTime Parse(const std::string& time);
+	static AnalysisTime FromHours(int64_t hours);
+
+	bool Empty() const { return itsText.empty(); }
+
+	int64_t Hours() const { return itsHours; }
+	AnalysisTime Shifted(int hours) const { return FromHours(itsHours + hours); }
+
+	int Year() const { return itsYear; }
+	int Month() const { return itsMonth; }  // 1 ... 12
+	int Day() const { return itsDay; }      // 1 ... 31
+	int Hour() const { return itsHour; }
+	int DayOfYear() const { return itsDayOfYear; }  // 0 = January 1st
+
+	// "yyyy-mm-dd hh:mm:ss"
+	const std::string& ToString() const { return itsText; }
+
+	bool operator==(const AnalysisTime& other) const { return itsHours == other.itsHours; }
+	bool operator!=(const AnalysisTime& other) const { return itsHours != other.itsHours; }
+	bool operator<(const AnalysisTime& other) const { return itsHours < other.itsHours; }
+
+private:
+	int64_t itsHours = 0;
+	int itsYear = 0;
+	int itsMonth = 0;
+	int itsDay = 0;
+	int itsHour = 0;
+	int itsDayOfYear = 0;
+	std::string itsText;
+};
+
+inline std::ostream& operator<<(std::ostream& os, const AnalysisTime& time)
+{
+	return os << time.ToString();
+}
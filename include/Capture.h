@@ -0,0 +1,80 @@
+#pragma once
+
+#include "MosInfo.h"
+#include "SourceCatalog.h"
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+class WeightTable;
+
+// Everything a run reads from outside, recorded with --capture <dir> so
+// that the run can be repeated offline with --replay <dir>:
+//
+// catalog.csv      source catalog (see --source-catalog) of every message
+//                  that a catalog lookup found
+// messages.grib    those messages, copied from source files
+// files/N.grib     source files that are read whole
+// weights_N.csv    weights of N'th mos label in weights file format
+// params.conf      copy of --param-config
+// replay.args      options of the run, one argument per line
+//
+// Messages are copied whole; they are not cropped to the stations, since
+// that would need re-encoding them.
+//
+// Replay reads source data locations and weights from the bundle, so it
+// needs neither radon nor the mos database, and gives the same output.
+
+class Capture
+{
+public:
+	static Capture* Instance();
+
+	// Start recording; must be called before workers are started
+	void Open(const std::string& dir, const std::vector<MosInfo>& mosInfos);
+
+	bool Enabled() const { return !itsDir.empty(); }
+
+	// Answer of a catalog lookup; messages are copied to bundle
+	void RecordMessages(const SourceParam& src, const std::vector<SourceMessage>& messages, bool members);
+
+	// Weights used by a task
+	void RecordWeights(const MosInfo& mosInfo, int step, const WeightTable& table);
+
+	// Write options of the run; other threads must not record anything
+	// while this is running
+	void Finish();
+
+	// Captured options, one argument per line
+	static std::vector<std::string> ReplayArguments(const std::string& dir);
+
+	// Source catalog, weights files and parameter config of bundle
+	static void SetReplayOptions(const std::string& dir);
+
+private:
+	Capture() = default;
+	Capture(const Capture&) = delete;
+	Capture& operator=(const Capture&) = delete;
+
+	SourceMessage CopyMessage(const SourceMessage& message);
+
+	std::string itsDir;
+	std::vector<MosInfo> itsMosInfos;
+
+	std::mutex itsMutex;
+
+	std::ofstream itsCatalog;
+	std::ofstream itsMessages;
+	uint64_t itsMessagesSize = 0;
+	size_t itsFileCount = 0;
+
+	std::map<std::string, SourceMessage> itsCopies;  // source location -> location in bundle
+	std::set<std::string> itsCatalogLines;
+
+	std::map<std::string, std::unique_ptr<std::ofstream>> itsWeights;  // label -> weights file
+	std::set<std::string> itsRecordedWeights;
+};
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <NFmiFastQueryInfo.h>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Grid values of a cached source field as 16-bit integers, with scale and
+// offset of the field: value = offset + scale * code. Takes half the memory
+// of query data; values are decoded when stations are interpolated.
+//
+// Most predictors are smooth and were packed with 12-16 bits in grib anyway,
+// so the error is usually far below what matters to mos.
+
+class CompactGrid
+{
+public:
+	// Returns null if values cannot be stored with at most maxError absolute
+	// error (negative = no limit)
+	static std::shared_ptr<const CompactGrid> Encode(const NFmiHPlaceDescriptor& hplace,
+	                                                 const std::vector<float>& values, double maxError);
+
+	const NFmiHPlaceDescriptor& HPlace() const { return itsHPlace; }
+	size_t Size() const { return itsCodes.size(); }
+
+	float Value(size_t index) const
+	{
+		const uint16_t code = itsCodes[index];
+		return (code == kMissingCode) ? kFloatMissing : static_cast<float>(itsOffset + itsScale * code);
+	}
+
+	std::vector<float> Values() const;
+
+	// Largest difference to the encoded values
+	double MaxError() const { return itsMaxError; }
+
+	// Log number of fields encoded and memory saved so far
+	static void Report();
+
+private:
+	CompactGrid() = default;
+
+	static const uint16_t kMissingCode = 0xffff;
+
+	NFmiHPlaceDescriptor itsHPlace;
+	std::vector<uint16_t> itsCodes;
+	double itsOffset = 0;
+	double itsScale = 0;
+	double itsMaxError = 0;
+};
+
+// Grid values of query data in location order
+
+std::vector<float> GridValues(NFmiFastQueryInfo& info);
@@ -0,0 +1,67 @@
+#pragma once
+
+#include "Factor.h"
+#include "MosInfo.h"
+#include "MosInterpolator.h"
+#include <functional>
+#include <map>
+
+// Everything needed to evaluate one predictor for all stations of a task
+
+struct PredictorContext
+{
+	const MosInfo& mosInfo;
+	const std::vector<Station>& stations;
+	const ParamLevel& pl;
+	int step;
+	bool ensemble;   // evaluate all ensemble members
+	size_t members;  // values per station, 1 for deterministic forecast
+	MosInterpolator& interpolator;
+};
+
+// A transform returns one value per station and member, members of one
+// station consecutive
+
+typedef std::function<std::vector<double>(const PredictorContext&)> PredictorTransform;
+
+class DerivedPredictors
+{
+public:
+	DerivedPredictors(MosInterpolator& interpolator);
+
+	// Start a new task. Evaluated predictors are kept as long as step and
+	// station set stay the same.
+	void Begin(const std::vector<Station>& stations, int step);
+
+	// Read source fields of given predictors at once, before evaluating them
+	void Prefetch(const MosInfo& mosInfo, const std::vector<ParamLevel>& params);
+
+	// Source fields that evaluating given predictors at step reads, previous
+	// steps of cumulative parameters included. Predictors with a registered
+	// transform read nothing.
+	static std::vector<FieldRequest> FieldRequests(const MosInfo& mosInfo, const std::vector<ParamLevel>& params,
+	                                               int step);
+
+	const std::vector<double>& Evaluate(const MosInfo& mosInfo, const ParamLevel& pl);
+
+	// Values of an already evaluated predictor; safe to call from several
+	// threads as long as nothing is evaluated at the same time
+	const std::vector<double>& Evaluated(const MosInfo& mosInfo, const ParamLevel& pl) const;
+
+	// Predictors that are not read from source data. Parameters without a
+	// registered transform are interpolated from source data, and
+	// de-accumulated if they are cumulative in parameter registry.
+	static void Register(const std::string& paramName, PredictorTransform transform);
+
+private:
+	const std::vector<double>& Evaluate(const MosInfo& mosInfo, const ParamLevel& pl, bool ensemble);
+	std::string SampleKey(const MosInfo& mosInfo, const ParamLevel& pl, bool ensemble, std::string& originTime);
+
+	MosInterpolator& itsInterpolator;
+
+	std::vector<Station> itsStations;
+	size_t itsStationsHash;
+	int itsStep;
+
+	std::map<std::string, std::vector<double>> itsValues;
+};
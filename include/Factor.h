@@ -2,10 +2,13 @@
 #include <vector>
 #include <map>
 #include <boost/algorithm/string.hpp>
+#include <boost/functional/hash.hpp>
 #include <boost/lexical_cast.hpp>
-#include <boost/numeric/ublas/vector.hpp>
+#include <boost/container/small_vector.hpp>
 #include "boost/date_time/posix_time/posix_time.hpp"
 #include <fmt/format.h>
+#include "AnalysisTime.h"
+#include "ParamRegistry.h"
 
 inline
 std::string ToSQLTime(const boost::posix_time::ptime& ts)
@@ -27,8 +30,15 @@ struct ParamLevel
 	int stepAdjustment;
 	int originTimeAdjustment;
 
+	const ParamInfo* info;  // resolved from paramName once
+
 	ParamLevel()
-	    : paramName("TEST"), levelName("TEST"), levelValue(32700.), stepAdjustment(0), originTimeAdjustment(0){};
+	    : paramName("TEST"),
+	      levelName("TEST"),
+	      levelValue(32700.),
+	      stepAdjustment(0),
+	      originTimeAdjustment(0),
+	      info(&ParamRegistry::Get(paramName)){};
 
 	ParamLevel(const std::string& str)
 	{
@@ -36,6 +46,7 @@ struct ParamLevel
 		boost::split(split, str, boost::is_any_of("/"));
 
 		paramName = split[0];
+		info = &ParamRegistry::Get(paramName);
 		levelName = split[1];
 		levelValue = std::stod(split[2]);
 		stepAdjustment = 0;
@@ -70,18 +81,25 @@ inline std::ostream& operator<<(std::ostream& file, const ParamLevel& ob)
 	return file;
 }
 
+// Predictors are interned when weights are read (see InternPredictor), and
+// per station data refers to them by id
+typedef uint32_t PredictorId;
+
+// Models are limited to a few tens of predictors (production ones to 14),
+// so weights of a station are stored inline up to this many
+const size_t kInlinePredictors = 16;
+
 struct Weight
 {
-	std::vector<ParamLevel> params;
-	boost::numeric::ublas::vector<double> weights;
-	boost::numeric::ublas::vector<double> values;
+	typedef boost::container::small_vector<PredictorId, kInlinePredictors> Predictors;
+	typedef boost::container::small_vector<double, kInlinePredictors> Values;
+
+	Predictors params;
+	Values weights;
+	Values values;
 
 	int periodId;
 	int step;
-
-	std::string startDate;
-	std::string stopDate;
-	std::string mosLabel;
 };
 
 struct Station
@@ -97,23 +115,27 @@ struct Station
 	bool operator<(const Station& other) const { return wmoId < other.wmoId; }
 };
 
-typedef std::map<Station, Weight> Weights;
-
-inline std::string Key(const ParamLevel& pl, int step, const std::string& originTime)
+// Identifies a set of stations, for example in cache keys
+inline size_t Hash(const std::vector<Station>& stations)
 {
-	using namespace boost::posix_time;
+	size_t seed = stations.size();
+
+	for (const auto& s : stations)
+	{
+		boost::hash_combine(seed, s.wmoId);
+		boost::hash_combine(seed, s.latitude);
+		boost::hash_combine(seed, s.longitude);
+	}
 
-	auto realOrigin = originTime;
+	return seed;
+}
 
+inline std::string Key(const ParamLevel& pl, int step, const AnalysisTime& originTime)
+{
 	step = (step < 150) ? step + pl.stepAdjustment * 3 : step + pl.stepAdjustment * 6;
 
-	if (pl.originTimeAdjustment == -1)
-	{
-		ptime time(time_from_string(originTime));
-		time = time - hours(12);
-
-		realOrigin = ToSQLTime(time);
-	}
+	const std::string realOrigin =
+	    (pl.originTimeAdjustment == -1) ? originTime.Shifted(-12).ToString() : originTime.ToString();
 
 	return pl.paramName + "/" + pl.levelName + "/" + std::to_string(pl.levelValue) + "@" + std::to_string(step) +
 	       " from " + realOrigin;
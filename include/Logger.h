@@ -0,0 +1,99 @@
+#pragma once
+
+#include <sstream>
+#include <string>
+
+enum LogLevel
+{
+	kLogDebug = 0,
+	kLogInfo,
+	kLogWarning,
+	kLogError
+};
+
+// One log line. Text is collected with operator<< and handed to logger when
+// the message goes out of scope. Messages below log level, or over the rate
+// limit of their category, are not formatted at all.
+
+class LogMessage
+{
+public:
+	LogMessage(LogLevel level, const std::string& category);
+	LogMessage(const LogMessage&) = delete;
+	LogMessage& operator=(const LogMessage&) = delete;
+	~LogMessage();
+
+	template <typename T>
+	LogMessage& operator<<(const T& value)
+	{
+		if (itsStream)
+		{
+			*itsStream << value;
+		}
+
+		return *this;
+	}
+
+private:
+	LogLevel itsLevel;
+	std::string itsCategory;
+	bool itsEnabled;
+	bool itsSuppressed;
+	std::ostringstream* itsStream;  // null if message is not formatted
+};
+
+// Messages are written to thread local buffers without locking, and a
+// background thread writes them out in order. Messages with the same
+// category are rate limited: after the limit is reached within one second,
+// they are only counted, and a summary line is written instead.
+
+class Logger
+{
+public:
+	static Logger* Instance();
+
+	// Start the background thread. Messages logged before this are kept and
+	// written once started.
+	void Start(LogLevel level, int rateLimit);
+
+	// Write out everything logged so far and stop the background thread
+	void Stop();
+
+	bool Enabled(LogLevel level) const;
+
+	static LogLevel ParseLevel(const std::string& level);
+
+private:
+	friend class LogMessage;
+
+	Logger() = default;
+	Logger(const Logger&) = delete;
+	Logger& operator=(const Logger&) = delete;
+
+	bool Admit(const std::string& category);
+	void Push(LogLevel level, const std::string& category, std::string text, bool suppressed);
+};
+
+// Stops logger when it goes out of scope, writing out everything logged
+// so far
+
+class LogScope
+{
+public:
+	LogScope() = default;
+	LogScope(const LogScope&) = delete;
+	LogScope& operator=(const LogScope&) = delete;
+	~LogScope() { Logger::Instance()->Stop(); }
+};
+
+// Usage: Log(kLogInfo) << "Read " << n << " lines";
+//
+// Messages that may repeat for many stations should have a category, which
+// is then used for rate limiting and in the summary, for example
+//
+// Log(kLogWarning, "Missing value for " + key) << "Missing value for station " << id << " " << key;
+
+inline LogMessage Log(LogLevel level, const std::string& category = std::string())
+{
+	return LogMessage(level, category);
+}
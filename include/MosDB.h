@@ -2,9 +2,12 @@
 
 #include <NFmiPostgreSQL.h>
 #include "MosInfo.h"
+#include "PreparedStatements.h"
 #include <mutex>
 #include "Factor.h"
 #include "Result.h"
+#include "WeightTable.h"
+#include <memory>
 
 class MosDB : public NFmiPostgreSQL
 {
@@ -15,9 +18,11 @@ public:
 
 	MosInfo GetMosInfo(const std::string& mosLabel);
 	//Weights GetWeights(const MosInfo& mosInfo, int step, double relativity = 0.5);
-	Weights GetWeights(const MosInfo& mosInfo, int step);
+	std::shared_ptr<const WeightTable> GetWeights(const MosInfo& mosInfo, int step);
 	void WriteTrace(const MosInfo& mosInfo, const Results& results, const std::string& run_time);
 
+private:
+	PreparedStatements itsStatements;
 };
 
 class MosDBPool
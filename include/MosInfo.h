@@ -1,12 +1,14 @@
 #pragma once
+#include "AnalysisTime.h"
 #include <string>
+#include <vector>
 
 struct MosInfo
 {
 	std::string label;
 	std::string paramName;  // target parameter
 	std::string levelName;
-	std::string originTime;  // forecast analysis time
+	AnalysisTime originTime;  // forecast analysis time
 
 	int networkId;
 	int stationId;
@@ -14,4 +16,14 @@ struct MosInfo
 	int producerId;
 
 	bool traceOutput;
+	std::string outputTag;  // added to output file names, if not empty
+
+	int ensembleSize;  // number of members, 0 = deterministic forecast
+	int ensembleProducerId;
+	std::vector<double> quantiles;  // in range 0..1
+
+	// With --shard, stations of a task can be split to groups processed by
+	// different shards; group is 0 ... stationGroups-1
+	int stationGroup = 0;
+	int stationGroups = 1;
 };
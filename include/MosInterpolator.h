@@ -3,26 +3,114 @@
 #include "MosInfo.h"
 #include "Factor.h"
 #include "Result.h"
+#include "CompactGrid.h"
 #include <NFmiFastQueryInfo.h>
-#include "NFmiRadonDB.h"
+#include "SourceCatalog.h"
+#include "Stencil.h"
 
 #include <map>
+#include <memory>
 
 typedef std::pair<std::shared_ptr<NFmiQueryData>, NFmiFastQueryInfo> datas;
 
+// Cached source field: query data, or with compact cache only the geometry
+// and 16-bit values
+
+struct Field
+{
+	datas data;
+	std::shared_ptr<const CompactGrid> compact;
+
+	const NFmiHPlaceDescriptor& HPlace() const
+	{
+		return compact ? compact->HPlace() : data.second.HPlaceDescriptor();
+	}
+};
+
+// Faster ways to calculate station values. Everything off is the reference
+// path: source data is interpolated to 0.125 degree grid, and from there to
+// stations with NFmiFastQueryInfo::InterpolatedValue.
+
+struct ExecutionPath
+{
+	bool stencil = false;     // interpolate with stencils cached per geometry, to 0.125 degree grid and stations
+	bool nativeGrid = false;  // interpolate to stations from source grid, without 0.125 degree grid
+	bool compact = false;     // cache fields as 16-bit values (see CompactGrid), interpolated with stencils
+
+	bool IsReference() const { return !stencil && !nativeGrid && !compact; }
+	std::string Name() const;
+
+	// Comma separated list, for example "stencil,native-grid,compact"
+	static ExecutionPath Parse(const std::string& names);
+};
+
+// Source field needed by a task
+
+struct FieldRequest
+{
+	ParamLevel pl;
+	int step;
+	bool members;
+};
+
 class MosInterpolator
 {
 public:
-	MosInterpolator();
+	MosInterpolator(const ExecutionPath& path = ExecutionPath());
 	~MosInterpolator();
 	
-	double GetValue(const MosInfo& mosInfo, const Station& station, const ParamLevel& pl, int step);
+	// Source field of a predictor: for deterministic forecast the geometries in
+	// order of preference, for ensemble one field per member in member order
+	const std::vector<Field>& GetField(const MosInfo& mosInfo, const ParamLevel& pl, int step, bool members);
+
+	// Read given fields to cache in file and offset order, merging reads of
+	// neighbouring messages
+	void Prefetch(const MosInfo& mosInfo, const std::vector<FieldRequest>& requests);
+
+	// Field of step minus field of prevStep, divided by divisor. Returns null if
+	// fields cannot be subtracted grid point by grid point.
+	const std::vector<Field>* GetDeaccumulatedField(const MosInfo& mosInfo, const ParamLevel& pl, int step, int prevStep,
+	                                                double divisor, bool members);
+
+	// Key of station values of a predictor in sample cache, without station
+	// set; originTime is set to source analysis time
+	std::string SampleKey(const MosInfo& mosInfo, const ParamLevel& pl, int step, bool members,
+	                      std::string& originTime);
+
+	// Geometry a source field is read from; empty if the field is not found
+	std::string Geometry(const MosInfo& mosInfo, const ParamLevel& pl, int step, bool members);
+
+	// Field values at stations; with members, values of one station are consecutive
+	std::vector<double> Interpolate(const std::vector<Field>& field, const std::vector<Station>& stations, bool members);
+
+	// Catalog locations of a source field, one message per member for
+	// ensemble; sets error if the field is not found
+	bool FindMessages(const MosInfo& mosInfo, const ParamLevel& pl, int step, bool members, SourceParam& src,
+	                  std::vector<SourceMessage>& messages, std::string& error);
+
+	// Fields are interpolated to 0.125 degree grid before caching
+	bool Regrid() const;
 
 private:
-	std::vector<datas> GetData(const MosInfo& mosInfo, const ParamLevel& pl, int step);	
+	std::vector<Field> GetData(const MosInfo& mosInfo, const ParamLevel& pl, int step, bool members);
+	Field MakeField(datas data) const;
+	const std::vector<Stencil>& GetStencils(const NFmiHPlaceDescriptor& hplace, const std::vector<Station>& stations,
+	                                        size_t stationsHash);
+
+	struct StencilCache
+	{
+		NFmiHPlaceDescriptor hplace;
+		size_t stationsHash;
+		std::vector<Stencil> stencils;
+	};
+
+	ExecutionPath itsPath;
+	std::unique_ptr<SourceCatalog> itsCatalog;
 
-	std::map<std::string, std::vector<datas>> itsDatas;
-	std::unique_ptr<NFmiRadonDB> itsRadonDB;
+	std::map<std::string, std::vector<Field>> itsDatas;
+	std::map<std::string, std::vector<Field>> itsMemberDatas;  // one field per ensemble member
+	std::map<std::string, std::vector<Field>> itsDeaccumulatedDatas;
+	std::vector<StencilCache> itsStencils;
 
 };
 
@@ -3,7 +3,16 @@
 #include "MosDB.h"
 #include <memory>
 #include "Result.h"
+#include "TaskArena.h"
 #include "MosInterpolator.h"
+#include "DerivedPredictors.h"
+
+// Weights of a task from weights file, or if none was read, from database;
+// null if there are none
+std::shared_ptr<const WeightTable> TaskWeights(const MosInfo& mosInfo, int step, MosDB* db);
+
+// Predictors that have non-zero weight at some station, per predictor set
+std::vector<std::vector<bool>> NeededPredictors(const MosInfo& mosInfo, const WeightTable& table);
 
 class MosWorker
 {
@@ -12,9 +21,22 @@ public:
 	~MosWorker();
 	bool Mosh(const MosInfo& mosInfo, int step);
 private:
-	void Write(const MosInfo& mosInfo, const Results& result);
+	void Write(const MosInfo& mosInfo, int step, const Results& result);
+	TaskValues Apply(const MosInfo& mosInfo, int step, const WeightTable& table, DerivedPredictors& derivedPredictors);
+	void GatherMemberValues(const MosInfo& mosInfo, const Station& station, int step, const ParamLevel& pl,
+	                        const double* source, size_t members, double& weight, double* memberValues, double& value);
 
 	MosInterpolator itsMosInterpolator;
+	DerivedPredictors itsDerivedPredictors;
 	std::unique_ptr<MosDB> itsMosDB;
 
+	// Reference path when verifying a faster path
+	std::unique_ptr<MosInterpolator> itsReferenceInterpolator;
+	std::unique_ptr<DerivedPredictors> itsReferencePredictors;
+	bool itsReferenceFirst = false;
+
+	// Transient data of one task (results, task values); released when task
+	// ends. Only used by worker thread itself, not by station threads.
+	TaskArena itsArena;
+
 };
@@ -3,37 +3,75 @@
 struct Options
 {
 	int threadCount;
+	int stationThreads;
 	int startStep;
 	int endStep;
 	int stepLength;
 	int stationId;
 	int networkId;
 	int producerId;
+	int ensembleSize;
+	int ensembleProducerId;
+	int logRateLimit;
+	int shardIndex;  // 1 ... shardCount
+	int shardCount;  // 0 = no sharding
+	double verifyTolerance;
+	double compactMaxError;  // absolute error of --fast-path compact, negative = no limit
 
 	std::string mosLabel;
 	std::string paramName;
 	std::string analysisTime;
 	std::string weightsFile;
 	std::string sourceGeom;
+	std::string quantiles;
+	std::string paramConfig;
+	std::string logLevel;
+	std::string fastPath;
+	std::string sourceCatalog;
+	std::string sampleCache;
+	std::string traceEvents;
+	std::string capture;
+	std::string replay;
 
 	bool trace;
 	bool disable0125;
+	bool verify;
+	bool plan;
 
 	Options()
 	    : threadCount(1),
+	      stationThreads(1),
 	      startStep(-1),
 	      endStep(-1),
 	      stepLength(1),
 	      stationId(-1),
 	      networkId(1),
 	      producerId(131),
+	      ensembleSize(0),
+	      ensembleProducerId(242),
+	      logRateLimit(20),
+	      shardIndex(0),
+	      shardCount(0),
+	      verifyTolerance(-1),
+	      compactMaxError(0.1),
 	      mosLabel(""),
 	      paramName(""),
 	      analysisTime(""),
 	      weightsFile(""),
 	      sourceGeom("ECGLO0100"),
+	      quantiles(""),
+	      paramConfig(""),
+	      logLevel("info"),
+	      fastPath(""),
+	      sourceCatalog(""),
+	      sampleCache(""),
+	      traceEvents(""),
+	      capture(""),
+	      replay(""),
 	      trace(false),
-	      disable0125(false)
+	      disable0125(false),
+	      verify(false),
+	      plan(false)
 	{
 	}
 };
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <string>
+
+enum ParamFlags : unsigned
+{
+	kParamCumulative = 1 << 0,          // accumulated since analysis time, de-accumulated to one step
+	kParamCumulativeRadiation = 1 << 1, // accumulated energy, de-accumulated and used as power (W/m2)
+	kParamMemberIndependent = 1 << 2,   // same value for all ensemble members
+	kParamNearestPoint = 1 << 3,        // nearest point interpolation instead of bilinear
+	kParamThreeHourly = 1 << 4,         // source data exists only for 3 hour steps
+	kParamFillMissing = 1 << 5          // missing source value is replaced with fillValue
+};
+
+// Everything mosse knows about a parameter, either as a predictor or as a
+// target parameter
+
+struct ParamInfo
+{
+	const char* name;
+	const char* sourceName;      // parameter name in radon, null = same as name
+	const char* sourceLevel;     // level name in radon, null = same as predictor
+	const char* levelCondition;  // source level is changed only for this level, null = any level
+	int producerId;              // source producer, -1 = producer of mos version
+	double scale;
+	int maxStep;        // value is missing after this step, -1 = no limit
+	int outputParamId;  // id used when writing results, -1 = not a target parameter
+	double fillValue;
+	unsigned flags;
+};
+
+class ParamRegistry
+{
+public:
+	// Parameters not in registry get default behaviour
+	static const ParamInfo& Get(const std::string& name);
+
+	// Add or override parameters from a file, before any threads are started
+	static void Load(const std::string& fileName);
+};
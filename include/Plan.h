@@ -0,0 +1,68 @@
+#pragma once
+
+#include "MosInfo.h"
+#include "SourceCatalog.h"
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Work of this process: steps, and with sharding the station group of each
+struct Task
+{
+	int step;
+	int stationGroup;
+};
+
+// Dry run of the tasks of this process (--plan). Weights, predictors and
+// catalog locations of source fields are resolved with the same functions
+// the run uses. Of source data only the first message of each geometry is
+// read, for the size of its grid. The plan is a graph of grid loads and the
+// (label, param, step) tasks that need them.
+//
+// The plan is only reported; the run does not use it. Workers take units
+// in order from the same task list and each one has its own field cache,
+// so a load needed by units of two workers is read twice.
+
+struct PlanLoad
+{
+	std::string key;  // field and member/deterministic, as in the field cache
+	SourceParam src;
+	size_t messages;
+	uint64_t bytes;          // bytes read; messages without known length count as zero
+	uint64_t points;         // grid points decoded, all messages
+	uint64_t residentBytes;  // size in field cache, after regrid and compaction
+	std::string error;       // why the field was not found
+	std::vector<size_t> tasks;
+};
+
+struct PlanTask
+{
+	std::string label;
+	std::string paramName;
+	int step;
+	int stationGroup;
+	size_t stations;
+	size_t predictors;
+	size_t skippedPredictors;  // zero weight at all stations
+	bool weights;              // false if no weights were found
+	size_t unit;               // index of Task; a worker takes all plan tasks of a Task
+	std::vector<size_t> loads;
+};
+
+class Plan
+{
+public:
+	static Plan Build(const std::vector<MosInfo>& mosInfos, const std::vector<std::string>& params,
+	                  const std::vector<Task>& tasks, int stationGroups);
+
+	// Report of loads, tasks and estimates; returns false if weights or
+	// source data of some task is missing
+	bool Report(std::ostream& out, int threadCount) const;
+
+private:
+	std::vector<PlanLoad> itsLoads;
+	std::vector<PlanTask> itsTasks;
+	size_t itsUnits = 0;
+	int itsStationGroups = 1;
+};
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <NFmiPostgreSQL.h>
+#include <map>
+#include <string>
+#include <vector>
+
+// Server side prepared statements of one database connection. Statements
+// are written with $1, $2 ... placeholders; each distinct statement is
+// prepared (PREPARE) on first use and run with EXECUTE after that, so the
+// server parses and plans it only once per connection. Parameters are
+// written into the EXECUTE statement as escaped string literals (see
+// QuoteLiteral); they are never part of the prepared statement itself.
+//
+// Types of parameters are inferred by the server; use casts like $1::int
+// where they cannot be.
+
+class PreparedStatements
+{
+public:
+	explicit PreparedStatements(NFmiPostgreSQL& connection) : itsConnection(connection) {}
+
+	// Results are read with FetchRow() of connection
+	void Query(const std::string& sql, const std::vector<std::string>& params);
+	void Execute(const std::string& sql, const std::vector<std::string>& params);
+
+	// Forget statements, for example after reconnecting
+	void Clear() { itsNames.clear(); }
+
+	// Remove statements from server too, before connection is given to
+	// someone else
+	void Deallocate();
+
+private:
+	std::string Statement(const std::string& sql, const std::vector<std::string>& params);
+
+	NFmiPostgreSQL& itsConnection;
+	std::map<std::string, std::string> itsNames;  // sql -> statement name
+};
+
+// Value as an sql escape string literal, E'...' with quotes and backslashes
+// doubled; means the same whether standard_conforming_strings is on or off
+std::string QuoteLiteral(const std::string& value);
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <NFmiFastQueryInfo.h>
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Source grid points and weights of every point of a regular target grid
+// that covers the source area (the 0.125 degree grid). The projection maths
+// is done once per source geometry and resolution; every field on the same
+// geometry is regridded with the same table.
+//
+// Each target point has four source points (bilinear), or one with weight
+// one (nearest point); unused points have zero weight. Points are stored
+// corner by corner so that the kernel can load eight target points at once.
+
+class RegridTable
+{
+public:
+	// Cached table of source geometry, shared by all threads
+	static std::shared_ptr<const RegridTable> Get(const NFmiFastQueryInfo& sourceInfo, double resolution);
+
+	const NFmiHPlaceDescriptor& Target() const { return itsTarget; }
+	size_t Size() const { return itsWeight[0].size(); }
+
+	// Size() target values from source values in location order, split to
+	// threads of the pool. Missing source points are left out and the
+	// remaining weights renormalized; if all points are missing, the value
+	// is missing.
+	void Apply(const float* source, float* target) const;
+
+private:
+	RegridTable(const NFmiHPlaceDescriptor& source, const NFmiHPlaceDescriptor& target, double resolution,
+	            FmiInterpolationMethod method);
+
+	void ApplyScalar(const float* source, float* target, size_t begin, size_t end) const;
+	void ApplyAvx2(const float* source, float* target, size_t begin, size_t end) const;
+
+	NFmiHPlaceDescriptor itsSource;
+	NFmiHPlaceDescriptor itsTarget;
+	double itsResolution;
+	FmiInterpolationMethod itsMethod;
+
+	std::array<std::vector<int32_t>, 4> itsIndex;
+	std::array<std::vector<float>, 4> itsWeight;
+};
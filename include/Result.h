@@ -1,12 +1,39 @@
 #pragma once
+#include <boost/container/pmr/map.hpp>
+#include <boost/container/pmr/vector.hpp>
 #include <vector>
 
 struct Result
 {
 	int step;
-	double value;
-	
+	double value;  // ensemble mean for ensemble runs
+
+	std::vector<double> memberValues;
+	std::vector<double> quantileValues;  // in the order of MosInfo::quantiles
+
 	Weight weights;
 };
 
-typedef std::map<Station, Result> Results;
+// Results and task values are allocated from the arena of the task (see
+// MosWorker::Mosh) and must not outlive it
+
+typedef boost::container::pmr::map<Station, Result> Results;
+
+// Everything calculated for one task. Weights, values and member values
+// have the layout of the task's WeightTable; member values of one predictor
+// are consecutive.
+
+struct TaskValues
+{
+	explicit TaskValues(boost::container::pmr::memory_resource* resource =
+	                        boost::container::pmr::get_default_resource())
+	    : weights(resource), values(resource), memberValues(resource), results(resource)
+	{
+	}
+
+	boost::container::pmr::vector<double> weights;
+	boost::container::pmr::vector<double> values;
+	boost::container::pmr::vector<double> memberValues;
+
+	Results results;
+};
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Station values of predictors stored on disk, so that reruns, other mos
+// labels and the lagged predictors of the next analysis time do not need
+// to read and interpolate the same source data again.
+//
+// There is one file per source analysis time. The file is a sequence of
+// records, each one a header, a key padded to 8 bytes, the values as
+// doubles and a trailer with the length of the record. Records are only
+// appended, with a single write, so several processes can share the files;
+// a record cut short by a failed write is recognized from its trailer and
+// skipped. At first use a file is mmap'd and its records indexed; values
+// are copied from the mapping.
+//
+// Appends are atomic only on a local file system. On NFS, O_APPEND is
+// emulated by the client, and records written at the same time from
+// different hosts can overwrite each other; a shared cache directory on NFS
+// should have one writing host at a time.
+
+class SampleCache
+{
+public:
+	static SampleCache* Instance();
+	~SampleCache();
+
+	// Directory of cache files; cache is disabled until this is called
+	void Open(const std::string& directory);
+	bool Enabled() const;
+
+	bool Contains(const std::string& originTime, const std::string& key);
+	bool Find(const std::string& originTime, const std::string& key, std::vector<double>& values);
+	void Store(const std::string& originTime, const std::string& key, const std::vector<double>& values);
+
+private:
+	SampleCache() = default;
+
+	struct File
+	{
+		int fd = -1;
+		void* mapping = nullptr;
+		size_t mappingSize = 0;
+
+		// Records of the mapping, and ones stored after mapping
+		std::map<std::string, std::pair<const char*, size_t>> mapped;
+		std::map<std::string, std::vector<double>> stored;
+	};
+
+	File& Get(const std::string& originTime);
+
+	std::string itsDirectory;
+	std::mutex itsMutex;
+	std::map<std::string, std::unique_ptr<File>> itsFiles;
+
+	static SampleCache* itsInstance;
+};
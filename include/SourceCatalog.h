@@ -0,0 +1,49 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+// Source data of a predictor, after parameter transformations
+
+struct SourceParam
+{
+	int producerId;
+	std::string paramName;
+	std::string levelName;
+	double levelValue;
+	std::string originTime;
+	int step;
+};
+
+// Location of one grib message; empty offset and length mean the first
+// message of file
+
+struct SourceMessage
+{
+	int member;  // ensemble member, 0 = control; 0 for deterministic forecast
+	std::string fileLocation;
+	std::string byteOffset;
+	std::string byteLength;
+	std::string geometry;  // name of grid geometry, for example ECGLO0100
+};
+
+// Where source data files are found: radon, or a local catalog file that
+// makes it possible to run without database
+
+class SourceCatalog
+{
+public:
+	virtual ~SourceCatalog() = default;
+
+	// Deterministic field from the first geometry (in order of preference)
+	// that has it
+	virtual bool Find(const SourceParam& src, SourceMessage& message) = 0;
+
+	// Members 0 ... members-1 from the first geometry that has any; ordered
+	// by file and offset so that files can be read sequentially
+	virtual std::vector<SourceMessage> FindMembers(const SourceParam& src, size_t members) = 0;
+
+	// Local catalog if one is given in options, otherwise radon
+	static std::unique_ptr<SourceCatalog> Create();
+};
@@ -0,0 +1,28 @@
+#pragma once
+
+#include "SourceCatalog.h"
+#include <functional>
+#include <vector>
+
+class NFmiGrib;
+
+// Messages closer than this to each other are read with one read
+const size_t kMaxReadGap = 1 << 20;
+
+// Largest single read
+const size_t kMaxReadSize = 64 << 20;
+
+// Reads many grib messages with few large sequential reads. Byte ranges are
+// sorted by file and offset and neighbouring ranges merged; the kernel is
+// told beforehand about all ranges, so that they are streamed from network
+// storage instead of read at random.
+
+class SourceReader
+{
+public:
+	// Called for each message with its index in messages; not in the order
+	// of messages but in file and offset order
+	typedef std::function<void(size_t index, NFmiGrib& reader)> MessageHandler;
+
+	static void Read(const std::vector<SourceMessage>& messages, const MessageHandler& handler);
+};
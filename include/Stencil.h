@@ -0,0 +1,169 @@
+#pragma once
+
+#include "CompactGrid.h"
+#include <NFmiFastQueryInfo.h>
+#include <NFmiGrid.h>
+#include <array>
+#include <cmath>
+
+// Interpolation stencil of one station in one grid geometry: the grid points
+// that contribute to the interpolated value and their weights. A stencil is
+// computed once and can be applied to every field that shares the geometry,
+// for example to all members of an ensemble.
+
+struct Stencil
+{
+	std::array<unsigned long, 4> index;
+	std::array<double, 4> weight;
+	int size;  // 0 = outside grid, 1 = nearest point, 4 = bilinear
+
+	Stencil() : index{{0, 0, 0, 0}}, weight{{0, 0, 0, 0}}, size(0) {}
+};
+
+// Points on the edge of grid can land a rounding error outside it after
+// conversion to lat/lon and back, like the last row and column of a regrid
+// target; they are moved onto the edge
+
+inline double ClampToGrid(double v, double max)
+{
+	const double eps = 1e-9;
+
+	if (v < 0 && v >= -eps)
+	{
+		return 0;
+	}
+
+	if (v > max && v <= max + eps)
+	{
+		return max;
+	}
+
+	return v;
+}
+
+inline Stencil MakeStencil(const NFmiGrid* grid, const NFmiPoint& latlon)
+{
+	Stencil s;
+
+	if (!grid)
+	{
+		return s;
+	}
+
+	const long ni = static_cast<long>(grid->XNumber());
+	const long nj = static_cast<long>(grid->YNumber());
+
+	const NFmiPoint gp = grid->LatLonToGrid(latlon);
+
+	const double x = ClampToGrid(gp.X(), static_cast<double>(ni - 1));
+	const double y = ClampToGrid(gp.Y(), static_cast<double>(nj - 1));
+
+	if (x < 0 || y < 0 || x > static_cast<double>(ni - 1) || y > static_cast<double>(nj - 1))
+	{
+		return s;
+	}
+
+	if (grid->InterpolationMethod() == kNearestPoint)
+	{
+		const long xi = std::lround(x);
+		const long yi = std::lround(y);
+
+		s.index[0] = static_cast<unsigned long>(yi * ni + xi);
+		s.weight[0] = 1;
+		s.size = 1;
+
+		return s;
+	}
+
+	const long x0 = static_cast<long>(std::floor(x));
+	const long y0 = static_cast<long>(std::floor(y));
+	const long x1 = std::min(x0 + 1, ni - 1);
+	const long y1 = std::min(y0 + 1, nj - 1);
+
+	const double dx = x - static_cast<double>(x0);
+	const double dy = y - static_cast<double>(y0);
+
+	// Grid is stored bottom left first, row by row
+
+	s.index[0] = static_cast<unsigned long>(y0 * ni + x0);
+	s.index[1] = static_cast<unsigned long>(y0 * ni + x1);
+	s.index[2] = static_cast<unsigned long>(y1 * ni + x0);
+	s.index[3] = static_cast<unsigned long>(y1 * ni + x1);
+
+	s.weight[0] = (1 - dx) * (1 - dy);
+	s.weight[1] = dx * (1 - dy);
+	s.weight[2] = (1 - dx) * dy;
+	s.weight[3] = dx * dy;
+	s.size = 4;
+
+	return s;
+}
+
+inline Stencil MakeStencil(const NFmiFastQueryInfo& info, const NFmiPoint& latlon)
+{
+	return MakeStencil(info.Grid(), latlon);
+}
+
+// Missing grid points are left out and the remaining weights renormalized;
+// if all points are missing, the result is missing.
+
+inline double ApplyStencil(NFmiFastQueryInfo& info, const Stencil& s)
+{
+	double sum = 0, wsum = 0;
+
+	for (int i = 0; i < s.size; i++)
+	{
+		if (s.weight[i] == 0)
+		{
+			continue;
+		}
+
+		info.LocationIndex(s.index[i]);
+		const float v = info.FloatValue();
+
+		if (v == kFloatMissing)
+		{
+			continue;
+		}
+
+		sum += s.weight[i] * v;
+		wsum += s.weight[i];
+	}
+
+	if (wsum == 0)
+	{
+		return kFloatMissing;
+	}
+
+	return sum / wsum;
+}
+
+inline double ApplyStencil(const CompactGrid& grid, const Stencil& s)
+{
+	double sum = 0, wsum = 0;
+
+	for (int i = 0; i < s.size; i++)
+	{
+		if (s.weight[i] == 0)
+		{
+			continue;
+		}
+
+		const float v = grid.Value(s.index[i]);
+
+		if (v == kFloatMissing)
+		{
+			continue;
+		}
+
+		sum += s.weight[i] * v;
+		wsum += s.weight[i];
+	}
+
+	if (wsum == 0)
+	{
+		return kFloatMissing;
+	}
+
+	return sum / wsum;
+}
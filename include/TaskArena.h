@@ -0,0 +1,52 @@
+#pragma once
+
+#include <boost/container/pmr/monotonic_buffer_resource.hpp>
+#include <functional>
+#include <memory>
+
+// Memory of one task. Allocations are taken from a buffer that is kept from
+// one task to the next, so that a task does not go to heap at all. A task
+// that does not fit gets the rest from heap, and the buffer is then grown for
+// the tasks after it.
+//
+// boost::container::pmr is used instead of std::pmr, which is missing from
+// libstdc++ of gcc 8.
+
+class TaskArena
+{
+public:
+	explicit TaskArena(size_t size = 1 << 20) { Reset(size); }
+	TaskArena(const TaskArena&) = delete;
+	TaskArena& operator=(const TaskArena&) = delete;
+
+	boost::container::pmr::memory_resource* Resource() { return itsResource.get(); }
+
+	// Free everything allocated by the task
+	void Release()
+	{
+		const char* current = static_cast<const char*>(itsResource->current_buffer());
+		const std::less<const char*> less;
+
+		if (less(current, itsBuffer.get()) || !less(current, itsBuffer.get() + itsSize))
+		{
+			Reset(2 * itsSize);
+		}
+		else
+		{
+			itsResource->release();
+		}
+	}
+
+private:
+	void Reset(size_t size)
+	{
+		itsResource.reset();
+		itsBuffer.reset(new char[size]);
+		itsSize = size;
+		itsResource.reset(new boost::container::pmr::monotonic_buffer_resource(itsBuffer.get(), itsSize));
+	}
+
+	std::unique_ptr<char[]> itsBuffer;
+	size_t itsSize;
+	std::unique_ptr<boost::container::pmr::monotonic_buffer_resource> itsResource;
+};
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Smallest number of stations worth giving to one thread
+const size_t kMinStationChunk = 256;
+
+// Pool of threads shared by all workers. Used to split the stations of one
+// task to several cores.
+
+class ThreadPool
+{
+public:
+	static ThreadPool* Instance();
+	~ThreadPool();
+
+	// Start pool threads; without any, ParallelFor runs in calling thread
+	void Start(size_t threadCount);
+	size_t Size() const;
+
+	// Call func(begin, end) for consecutive chunks of [0, count). Chunks
+	// are at least minChunkSize long. Calling thread works on chunks too, and
+	// returns when all chunks are done. First exception thrown by func is
+	// rethrown in calling thread.
+	void ParallelFor(size_t count, size_t minChunkSize, const std::function<void(size_t, size_t)>& func);
+
+private:
+	ThreadPool() = default;
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	void Run();
+
+	std::vector<std::thread> itsThreads;
+	std::deque<std::function<void()>> itsQueue;
+	std::mutex itsMutex;
+	std::condition_variable itsCondition;
+	bool itsStopped = false;
+
+	static ThreadPool* itsInstance;
+};
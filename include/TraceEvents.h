@@ -0,0 +1,90 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+// Timeline of what each thread is doing, written with --trace-events as
+// Chrome trace-event JSON, which opens in Perfetto (ui.perfetto.dev) or
+// chrome://tracing.
+//
+// Spans are recorded to a ring buffer of the recording thread without
+// locking. If a thread records more spans than fit to its buffer, the oldest
+// ones are overwritten, so the end of the run is always there. When tracing
+// is not enabled, a span costs one check of a flag.
+
+class TraceEvents
+{
+public:
+	static TraceEvents* Instance();
+
+	// Start recording; spans are written to file with Write(). Must be called
+	// before any other threads are started.
+	void Open(const std::string& fileName);
+
+	static bool Enabled() { return itsEnabled; }
+
+	// Name shown for the calling thread
+	void NameThread(const std::string& name);
+
+	// Id of a span argument; spans keep ids instead of copies of strings.
+	// Empty string is 0.
+	static uint32_t Intern(const std::string& str);
+
+	void Record(const char* name, std::chrono::steady_clock::time_point begin,
+	            std::chrono::steady_clock::time_point end, int step, uint32_t param, uint32_t key);
+
+	// Write all spans recorded so far. Other threads must not record spans
+	// while this is running.
+	void Write();
+
+private:
+	TraceEvents() = default;
+	TraceEvents(const TraceEvents&) = delete;
+	TraceEvents& operator=(const TraceEvents&) = delete;
+
+	std::string itsFileName;
+	std::chrono::steady_clock::time_point itsStart;
+
+	static bool itsEnabled;
+};
+
+// Records the time from construction to destruction. Name should be a string
+// literal; step (-1 = none), param and key are shown as arguments of span.
+//
+// TraceSpan span("read", step, pl.paramName);
+
+class TraceSpan
+{
+public:
+	explicit TraceSpan(const char* name, int step = -1, const std::string& param = std::string(),
+	                   const std::string& key = std::string())
+	    : itsName(TraceEvents::Enabled() ? name : nullptr), itsStep(step), itsParam(0), itsKey(0)
+	{
+		if (itsName)
+		{
+			itsParam = TraceEvents::Intern(param);
+			itsKey = TraceEvents::Intern(key);
+			itsBegin = std::chrono::steady_clock::now();
+		}
+	}
+
+	~TraceSpan()
+	{
+		if (itsName)
+		{
+			TraceEvents::Instance()->Record(itsName, itsBegin, std::chrono::steady_clock::now(), itsStep, itsParam,
+			                                itsKey);
+		}
+	}
+
+	TraceSpan(const TraceSpan&) = delete;
+	TraceSpan& operator=(const TraceSpan&) = delete;
+
+private:
+	const char* itsName;  // null if not recording
+	int itsStep;
+	uint32_t itsParam;
+	uint32_t itsKey;
+	std::chrono::steady_clock::time_point itsBegin;
+};
@@ -0,0 +1,68 @@
+#pragma once
+
+#include "MosInfo.h"
+#include "WeightTable.h"
+#include "Result.h"
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Compares results of a fast execution path to the reference path, task by
+// task. Differences of each task are written to a csv file, and a summary
+// of all tasks is logged at the end.
+
+class Verification
+{
+public:
+	static Verification* Instance();
+
+	void Compare(const MosInfo& mosInfo, int step, const WeightTable& table, const TaskValues& reference,
+	             const TaskValues& candidate, double referenceSeconds, double candidateSeconds);
+
+	// Log summary; returns false if some output differs more than tolerance,
+	// or is missing in only one path (negative tolerance = no limit)
+	bool Report(const std::string& pathName, double tolerance);
+
+private:
+	Verification() = default;
+
+	struct Stats
+	{
+		size_t count = 0;
+		size_t missingMismatches = 0;
+		double maxAbsolute = 0;
+		double maxRelative = 0;
+		double sumAbsolute = 0;
+	};
+
+	struct Offender
+	{
+		double absolute;
+		double relative;
+		double reference;
+		double candidate;
+		std::string what;
+	};
+
+	// Returns true if values differ; description is only made for differences
+	bool Add(Stats& stats, std::vector<Offender>& worst, double reference, double candidate,
+	         const std::function<std::string()>& what);
+	static void KeepWorst(std::vector<Offender>& worst, Offender offender);
+
+	std::mutex itsMutex;
+
+	size_t itsTasks = 0;
+	double itsReferenceSeconds = 0;
+	double itsCandidateSeconds = 0;
+
+	Stats itsOutputStats;
+	std::map<std::string, Stats> itsPredictorStats;
+
+	// Largest differences, largest first
+	std::vector<Offender> itsWorstOutputs;
+	std::vector<Offender> itsWorstPredictors;
+
+	static Verification* itsInstance;
+};
@@ -0,0 +1,139 @@
+#pragma once
+
+#include "Factor.h"
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Read-only weights of one mos label, step and target parameter for all
+// stations. Stations that have the same predictors share one predictor list,
+// and weights of all stations are in one contiguous array.
+//
+// Tables are shared by all threads; per-task state (values, zeroed weights)
+// is kept by the user.
+
+class WeightTable
+{
+public:
+	size_t Size() const { return itsStations.size(); }
+	bool Empty() const { return itsStations.empty(); }
+
+	int PeriodId() const { return itsPeriodId; }
+	int Step() const { return itsStep; }
+
+	// Stations in wmo id order
+	const std::vector<Station>& Stations() const { return itsStations; }
+
+	// Distinct predictor lists
+	const std::vector<std::vector<ParamLevel>>& PredictorSets() const { return itsPredictorSets; }
+
+	// Index to PredictorSets() for a station
+	size_t PredictorSet(size_t station) const { return itsStationSets[station]; }
+	const std::vector<ParamLevel>& Params(size_t station) const { return itsPredictorSets[itsStationSets[station]]; }
+	const std::vector<PredictorId>& PredictorIds(size_t station) const
+	{
+		return itsPredictorIdSets[itsStationSets[station]];
+	}
+
+	// Weights of station are at [Offset(station), Offset(station) + Params(station).size())
+	size_t Offset(size_t station) const { return itsOffsets[station]; }
+	const std::vector<double>& Weights() const { return itsWeights; }
+
+	// Full copy of the weights of one station, with given (task specific)
+	// weights and values that have the layout of Weights()
+	Weight ToWeight(size_t station, const double* weights, const double* values) const;
+
+	// Table of stations [begin, end); only predictor lists of those stations
+	// are kept
+	std::shared_ptr<const WeightTable> Slice(size_t begin, size_t end) const;
+
+private:
+	friend class WeightTableBuilder;
+
+	int itsPeriodId = -1;
+	int itsStep = -1;
+
+	std::vector<Station> itsStations;
+	std::vector<size_t> itsStationSets;
+	std::vector<size_t> itsOffsets;
+
+	std::vector<std::vector<ParamLevel>> itsPredictorSets;
+	std::vector<std::vector<PredictorId>> itsPredictorIdSets;
+	std::vector<double> itsWeights;
+};
+
+// Collects weights one station at a time. Predictor keys are parsed only
+// once per distinct predictor list.
+
+class WeightTableBuilder
+{
+public:
+	void Add(const Station& station, const std::vector<std::string>& paramKeys, const std::vector<double>& weights);
+	bool Empty() const { return itsEntries.empty(); }
+
+	// If a station was added several times, the last one is used
+	std::shared_ptr<const WeightTable> Build(int periodId, int step);
+
+private:
+	struct Entry
+	{
+		Station station;
+		size_t set;
+		size_t offset;  // in itsWeights
+	};
+
+	std::vector<Entry> itsEntries;
+	std::vector<double> itsWeights;
+	std::vector<std::vector<ParamLevel>> itsPredictorSets;
+	std::vector<std::vector<PredictorId>> itsPredictorIdSets;
+	std::map<std::vector<std::string>, size_t> itsSetIndex;
+};
+
+// Same key always gets the same id; ids are valid for the whole run
+PredictorId InternPredictor(const std::string& key, const ParamLevel& pl);
+const ParamLevel& Predictor(PredictorId id);
+
+// Sum of values times weights of one station. Versions unrolled for each
+// predictor count were no faster with 8-16 predictors: the additions form
+// one dependency chain whatever the count, and reordering them would change
+// results.
+
+inline double ApplyWeights(const double* values, const double* weights, size_t count)
+{
+	double sum = 0;
+
+	for (size_t i = 0; i < count; i++)
+	{
+		sum += values[i] * weights[i];
+	}
+
+	return sum;
+}
+
+// One line of a weights file:
+//
+// period_id,analysis_hour,station_id,longitude,latitude,step,target_param,key1,weight1,key2,weight2,...
+
+struct WeightsFileLine
+{
+	int periodId;
+	int analysisHour;
+	Station station;
+	int step;
+	std::string targetParam;
+
+	std::vector<std::string> columns;  // all columns of line
+};
+
+// Period of weights files for analysis time: 1 = Dec-Feb, 2 = Mar-May,
+// 3 = Jun-Aug, 4 = Sep-Nov
+int PeriodIdFromDate(const AnalysisTime& date);
+
+// Returns false for empty lines and comments. Weights are parsed separately
+// with ParseWeights, only for the lines that are used.
+bool ParseWeightsLine(const std::string& line, WeightsFileLine& out);
+void ParseWeights(const WeightsFileLine& line, std::vector<std::string>& keys, std::vector<double>& weights);
+
+// label -> step -> target parameter
+typedef std::map<std::string, std::map<int, std::map<std::string, std::shared_ptr<const WeightTable>>>> WeightStore;
@@ -8,6 +8,8 @@ import argparse
 import fnmatch
 import time
 import glob
+import io
+import multiprocessing
 
 parameters = {
     # "CSV_PARAMETER_NAME : DATABASE_PARAMETER_NAME/DATABASE_LEVEL_NAME/LEVEL_VALUE/TIME_STEP_ADJUSTMENT"
@@ -109,6 +111,18 @@ def ParseCommandLine(argv):
         action="store_true",
         help="delete weights specified by the other arguments from database",
     )
+    parser.add_argument(
+        "--bulk",
+        action="store_true",
+        help="load a directory of station files with parallel parsing and COPY (much faster)",
+    )
+    parser.add_argument(
+        "-j",
+        "--processes",
+        type=int,
+        default=multiprocessing.cpu_count(),
+        help="number of processes parsing files in bulk mode (default: number of cpus)",
+    )
     parser.add_argument("file", nargs="*", help="Input file (csv)")
 
     args = parser.parse_args()
@@ -318,6 +332,187 @@ WHERE
     print("Inserted {} rows in {:.2f} sec".format(count, (time.process_time() - start)))
 
 
+# Bulk mode: files are parsed in parallel, rows are written with COPY to a
+# staging table and moved to mos_weight with one UPDATE and one INSERT
+
+BULK_BATCH_FILES = 1000
+
+
+def ParseFile(args):
+    filename, opts = args
+
+    nameInfo = meta_from_name(os.path.basename(filename), opts)
+
+    try:
+        values = Read(filename)
+    except SystemExit:
+        raise RuntimeError("Unable to read file %s" % (filename))
+
+    rows = []
+
+    for forecast_period, weightlist in list(values.items()):
+        if set(weightlist.values()) == set(["0"]):
+            # all weights zero: step is not supported
+            continue
+
+        rows.append((forecast_period, weightlist))
+
+    return (nameInfo, rows)
+
+
+def HstoreText(weightlist):
+    return ",".join(
+        '"{}"=>"{}"'.format(k.replace('"', '\\"'), v.replace('"', '\\"'))
+        for k, v in list(weightlist.items())
+    )
+
+
+def CopyEscape(text):
+    return text.replace("\\", "\\\\").replace("\t", "\\t").replace("\n", "\\n")
+
+
+def BulkLoad(conn, cur, opts):
+    start = time.time()
+
+    files = sorted(glob.glob("{}/station*.csv".format(opts.file[0])))
+
+    mos_version_id = GetMosVersionId(cur, opts.mos_label)
+    param_ids = {}
+
+    cur.execute(
+        """
+CREATE TEMPORARY TABLE mos_weight_staging (
+  seq serial,
+  mos_period_id int,
+  analysis_hour int,
+  station_id int,
+  forecast_period int,
+  target_param_id int,
+  weights hstore
+) ON COMMIT DROP"""
+    )
+
+    staged = 0
+
+    with multiprocessing.Pool(max(1, opts.processes)) as pool:
+        for b in range(0, len(files), BULK_BATCH_FILES):
+            batch = files[b : b + BULK_BATCH_FILES]
+            buff = io.StringIO()
+
+            for nameInfo, rows in pool.imap(
+                ParseFile, [(f, opts) for f in batch], chunksize=16
+            ):
+                try:
+                    db_station_id = GetStationId(
+                        cur, nameInfo["network_id"], nameInfo["station_id"]
+                    )
+                except KeyError as e:
+                    print("Unrecognized station {}".format(nameInfo["station_id"]))
+                    continue
+
+                target_param_name = nameInfo["target_param_name"]
+
+                if target_param_name not in param_ids:
+                    dbparam = parameters[target_param_name].split("/")[0]
+                    cur.execute("SELECT id FROM param WHERE name = %s", [dbparam])
+                    row = cur.fetchone()
+
+                    if row == None:
+                        print("Parameter id not found for name %s" % (target_param_name))
+                        sys.exit(1)
+
+                    param_ids[target_param_name] = int(row[0])
+
+                for forecast_period, weightlist in rows:
+                    buff.write(
+                        "\t".join(
+                            [
+                                str(nameInfo["season_id"]),
+                                str(nameInfo["ahour"]),
+                                str(db_station_id),
+                                str(forecast_period),
+                                str(param_ids[target_param_name]),
+                                CopyEscape(HstoreText(weightlist)),
+                            ]
+                        )
+                        + "\n"
+                    )
+                    staged = staged + 1
+
+            buff.seek(0)
+            cur.copy_expert(
+                "COPY mos_weight_staging (mos_period_id, analysis_hour, station_id, forecast_period, target_param_id, weights) FROM STDIN",
+                buff,
+            )
+
+            print(
+                "Staged {} rows from {}/{} files in {:.1f} sec".format(
+                    staged,
+                    min(b + BULK_BATCH_FILES, len(files)),
+                    len(files),
+                    time.time() - start,
+                )
+            )
+
+    # Rows are matched the same way as in the per-row update of Load(), and
+    # also by period, since one directory has files of all seasons. If a row
+    # is given several times, the last one wins. Existing rows are updated
+    # and the rest inserted.
+
+    cur.execute(
+        """
+CREATE TEMPORARY TABLE mos_weight_latest ON COMMIT DROP AS
+SELECT DISTINCT ON (mos_period_id, analysis_hour, station_id, forecast_period, target_param_id)
+  mos_period_id, analysis_hour, station_id, forecast_period * interval '1 hour' AS forecast_period, target_param_id, weights
+FROM mos_weight_staging
+ORDER BY mos_period_id, analysis_hour, station_id, forecast_period, target_param_id, seq DESC"""
+    )
+
+    cur.execute(
+        """
+UPDATE mos_weight w
+SET weights = s.weights
+FROM mos_weight_latest s
+WHERE
+    w.mos_version_id = %s AND
+    w.mos_period_id = s.mos_period_id AND
+    w.analysis_hour = s.analysis_hour AND
+    w.station_id = s.station_id AND
+    w.forecast_period = s.forecast_period AND
+    w.target_param_id = s.target_param_id AND
+    w.target_level_id = 1 AND
+    w.target_level_value = 0""",
+        [mos_version_id],
+    )
+
+    updated = cur.rowcount
+
+    cur.execute(
+        """
+INSERT INTO mos_weight (mos_version_id, mos_period_id, analysis_hour, station_id, forecast_period, target_param_id, target_level_id, target_level_value, weights)
+SELECT %s, s.mos_period_id, s.analysis_hour, s.station_id, s.forecast_period, s.target_param_id, 1, 0, s.weights
+FROM mos_weight_latest s
+WHERE NOT EXISTS (
+  SELECT 1 FROM mos_weight w
+  WHERE
+    w.mos_version_id = %s AND
+    w.mos_period_id = s.mos_period_id AND
+    w.analysis_hour = s.analysis_hour AND
+    w.station_id = s.station_id AND
+    w.forecast_period = s.forecast_period AND
+    w.target_param_id = s.target_param_id AND
+    w.target_level_id = 1 AND
+    w.target_level_value = 0)""",
+        [mos_version_id, mos_version_id],
+    )
+
+    print(
+        "Updated {} and inserted {} rows from {} files in {:.1f} sec".format(
+            updated, cur.rowcount, len(files), time.time() - start
+        )
+    )
+
+
 def meta_from_name(filename, opts):
     # Filename example:
     # station_8579_12_season1_TA_lm_MOS_constant_maxvars14.csv
@@ -412,6 +607,17 @@ def main():
 
     psycopg2.extras.register_hstore(conn)
 
+    if opts.bulk:
+        if not os.path.isdir(opts.file[0]):
+            print("bulk mode needs a directory of station files")
+            sys.exit(1)
+
+        # staging table and upsert in one transaction
+        conn.autocommit = 0
+        BulkLoad(conn, cur, opts)
+        conn.commit()
+        return
+
     if os.path.isdir(opts.file[0]):
         count = 0
         files = glob.glob("{}/station*.csv".format(opts.file[0]))
@@ -6,155 +6,184 @@ import psycopg2
 import argparse
 import math
 import io
+import threading
+import time
+from concurrent.futures import ThreadPoolExecutor
 
 PARTITIONS = []
+COLUMNS = ['station_id', 'analysis_time', 'forecast_period', 'parameter_id', 'level_id', 'level_value', 'value']
+KEY = ['station_id', 'analysis_time', 'forecast_period', 'parameter_id', 'level_id', 'level_value']
+
+local = threading.local()
+
+# Connections of all loader threads, closed when loading is done
+connections = []
+connections_lock = threading.Lock()
 
 def ParseCommandLine(argv):
     parser = argparse.ArgumentParser()
+    parser.add_argument('-j', '--connections', type=int, default=4, help='Number of partitions loaded in parallel (default 4)')
+    parser.add_argument('--on-duplicate', choices=['skip', 'update'], default='skip', help='Keep existing rows (default) or replace them')
     parser.add_argument('file', nargs='+', help='Input file (csv)')
 
     args = parser.parse_args()
 
     return args
 
+def Connect():
+    dsn = "user=%s password=%s host=%s dbname=%s port=%s" % ("mos_rw",  os.environ["MOS_MOSRW_PASSWORD"], os.environ["MOS_HOSTNAME"], "mos", 5432)
+
+    return psycopg2.connect(dsn)
+
 def ReadPartitions(cur):
     global PARTITIONS
     sql = "SELECT tablename FROM pg_tables WHERE tablename LIKE 'previ_ecmos_narrow_p%' ORDER BY 1"
-    
+
     cur.execute(sql)
 
     rows = cur.fetchall()
-    
+
     for row in rows:
         PARTITIONS.append(row[0])
 
-def LoadToDatabase(cur, tablename, buff, colbuff):
-    sql = "INSERT INTO data." + tablename + " (station_id, analysis_time, forecast_period, parameter_id, level_id, level_value, value) VALUES (%s, %s, %s, %s, %s, %s, %s)"
+def Partition(station_id):
+    if station_id % 10 == 0:
+        partition = "previ_ecmos_narrow_p" + str(station_id)
+    else:
+        rup = int(math.floor(station_id / 10.0)) * 10
+        partition = "previ_ecmos_narrow_p" + str(rup)
+
+    if not partition in PARTITIONS:
+        partition = "previ_ecmos_narrow"
+
+    return partition
+
+def LoadToDatabase(tablename, buff, on_duplicate):
+    # Each thread has its own connection, and each partition is loaded in
+    # its own transaction: rows are copied to a staging table and moved to
+    # partition with one update and one insert. Existing rows are matched by
+    # key columns, since a unique index on them is not guaranteed (for
+    # example for rows that fall back to the parent table).
+
+    if not hasattr(local, 'conn'):
+        local.conn = Connect()
 
-    ret = 0
+        with connections_lock:
+            connections.append(local.conn)
+
+    conn = local.conn
+    cur = conn.cursor()
 
     try:
-        cur.execute("SAVEPOINT insert")
+        cur.execute("CREATE TEMPORARY TABLE staging (LIKE data." + tablename + " INCLUDING DEFAULTS) ON COMMIT DROP")
 
         f = io.StringIO("\n".join(buff))
+        cur.copy_from(f, 'staging', columns=COLUMNS)
 
-        cur.copy_from(f, tablename, columns=['station_id', 'analysis_time', 'forecast_period', 'parameter_id', 'level_id', 'level_value', 'value'])
+        # Of duplicates within the file, the last one is used
 
-        ret = len(buff)
-        cur.execute("RELEASE SAVEPOINT insert")
+        cur.execute("CREATE TEMPORARY TABLE latest ON COMMIT DROP AS " +
+                    "SELECT DISTINCT ON (" + ",".join(KEY) + ") " + ",".join(COLUMNS) + " FROM staging " +
+                    "ORDER BY " + ",".join(KEY) + ", ctid DESC")
 
-    except psycopg2.IntegrityError as e:
-        if e.pgcode == "23505":
-            
-            print("COPY failed, switch to INSERT")
-    #       print cur.mogrify(sql, (station_id, analysis_time, period, param_id, level_id, level_value, arr[6]))
-            cur.execute("ROLLBACK TO SAVEPOINT insert")
+        match = " AND ".join(["d.%s = s.%s" % (k, k) for k in KEY])
 
-            for row in colbuff:
-                ret = ret+1
+        ret = 0
 
-                try:
-                    cur.execute("SAVEPOINT insert")
-                    cur.execute(sql, row)
-                    cur.execute("RELEASE SAVEPOINT insert")
-
-                except psycopg2.IntegrityError as e:
-                    if e.pgcode != "23505":
-                        print(e)
-                        sys.exit(1)
-                    cur.execute("ROLLBACK TO SAVEPOINT insert")
-                    cur.execute("RELEASE SAVEPOINT insert")
-        else:
-            print(e)
-            sys.exit(1)
-    return ret
+        if on_duplicate == 'update':
+            cur.execute("UPDATE data." + tablename + " d SET value = s.value FROM latest s WHERE " + match)
+            ret = cur.rowcount
 
-def Load(infile_name):
-    infile = open (infile_name)
+        cur.execute("INSERT INTO data." + tablename + " (" + ",".join(COLUMNS) + ") " +
+                    "SELECT " + ",".join(COLUMNS) + " FROM latest s " +
+                    "WHERE NOT EXISTS (SELECT 1 FROM data." + tablename + " d WHERE " + match + ")")
 
-    dsn = "user=%s password=%s host=%s dbname=%s port=%s" % ("mos_rw",  os.environ["MOS_MOSRW_PASSWORD"], os.environ["MOS_HOSTNAME"], "mos", 5432)
+        ret += cur.rowcount
+
+        conn.commit()
 
-    conn = psycopg2.connect(dsn)
+    except psycopg2.Error as e:
+        conn.rollback()
+        raise RuntimeError("Loading partition %s failed: %s" % (tablename, e))
 
+    return ret
+
+def Load(infile_names, opts):
+    start = time.time()
+
+    conn = Connect()
     cur = conn.cursor()
     ReadPartitions(cur)
-    
-    lines = 0
+    conn.close()
+
+    # Rows are grouped by partition first, so that each partition is loaded
+    # with one COPY no matter in which order rows are in file
+
+    partitions = {}
     totlines = 0
+
+    for infile_name in infile_names:
+        infile = open(infile_name)
+
+        for line in infile:
+            line = line.strip()
+
+            if len(line) == 0 or line[0] == '#':
+                continue
+
+            arr = line.split(',')
+
+            #analysis_time,forecast_period,station_id,param_id,level_id,levelvalue,value
+
+            analysis_time = arr[0]
+            period = int(arr[1])
+            station_id = int(arr[2])
+            param_id = int(arr[3])
+            level_id = int(arr[4])
+            level_value = int(arr[5])
+            value = arr[6]
+
+            partitions.setdefault(Partition(station_id), []).append("%s\t%s\t%s\t%s\t%s\t%s\t%s" % (station_id, analysis_time, period, param_id, level_id, level_value, value))
+
+            totlines = totlines + 1
+
+        infile.close()
+
+    print("Read %d rows for %d partitions in %.1f sec" % (totlines, len(partitions), time.time() - start))
+
     totrows = 0
-    prevPartition = None
-    buff = [] # data to be uploaded with COPY
-    colbuff = [] # data to be uploaded with INSERT if COPY fails
-
-    for line in infile:
-        line = line.strip()
-    
-        if line[0] == '#':
-            continue
-    
-        arr = line.split(',')
-
-        #analysis_time,forecast_period,station_id,param_id,level_id,levelvalue,value
-
-        analysis_time = arr[0]
-        period = int(arr[1])
-        station_id = int(arr[2])
-        param_id = int(arr[3])
-        level_id = int(arr[4])
-        level_value = int(arr[5])
-        value = arr[6]
-
-        partition = None
-    
-        if station_id % 10 == 0:
-            partition = "previ_ecmos_narrow_p" + str(station_id)
-        else:
-            rup = int(math.floor(station_id / 10.0)) * 10
-            partition = "previ_ecmos_narrow_p" + str(rup)
-
-        if not partition in PARTITIONS:
-            partition = "previ_ecmos_narrow"
-
-        if prevPartition == None:
-            prevPartition = partition
-
-        if partition != prevPartition:
-            rows = LoadToDatabase(cur, prevPartition,buff, colbuff)
-            prevPartition = partition
-            print("Insert row count: %d" % (rows))
-            totrows += rows
-            totlines += lines
-            if rows != lines:
-                print("Error: lines read=%d but rows loaded=%d" % (lines, rows))
-                sys.exit(1)
-            lines = 0
-            buff = []
-            colbuff = []
-
-        buff.append("%s\t%s\t%s\t%s\t%s\t%s\t%s" % (station_id, analysis_time, period, param_id, level_id, level_value, value))
-        colbuff.append([station_id, analysis_time, period, param_id, level_id, level_value, value])
-
-        lines = lines+1
-
-    rows = LoadToDatabase(cur, prevPartition,buff, colbuff)
-    totrows += rows
-    totlines += lines
-    print("total rows: %d loaded to database: %d" % (totlines, totrows))
-    conn.commit()
-
-    if totlines != totrows:
-        sys.exit(1)
+
+    try:
+        with ThreadPoolExecutor(max_workers=max(1, opts.connections)) as executor:
+            futures = {}
+
+            for tablename, buff in partitions.items():
+                futures[tablename] = executor.submit(LoadToDatabase, tablename, buff, opts.on_duplicate)
+
+            for tablename, future in futures.items():
+                try:
+                    rows = future.result()
+                except RuntimeError as e:
+                    print(e)
+                    sys.exit(1)
+
+                lines = len(partitions[tablename])
+
+                if rows != lines:
+                    print("Partition %s: %d rows, %d loaded, %d duplicates" % (tablename, lines, rows, lines - rows))
+
+                totrows += rows
+    finally:
+        for conn in connections:
+            conn.close()
+
+    print("total rows: %d loaded to database: %d in %.1f sec" % (totlines, totrows, time.time() - start))
 
 def main():
 
     opts = ParseCommandLine(sys.argv)
 
-    wmo_id = None
-    ahour = None
-    target_param_name = None
-    season_id = None
-
-    Load(opts.file[0])
+    Load(opts.file, opts)
 
 if __name__ == "__main__":
     main()
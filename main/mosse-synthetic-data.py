@@ -0,0 +1,162 @@
+#!/usr/bin/env python3
+
+# Write synthetic source data for running mosse without radon:
+#
+# - one grib file per predictor and step on a regular lat-lon grid
+# - source catalog for mosse --source-catalog
+# - weights file for mosse --weights-file
+#
+# Example:
+#
+#   mosse-synthetic-data.py -o /tmp/synth -a "2024-01-01 00:00:00" -s 3 -e 12 -l 3
+#   mosse -s 3 -e 12 -l 3 -a "2024-01-01 00:00:00" -p T-K \
+#     --weights-file /tmp/synth/weights.csv --source-catalog /tmp/synth/catalog.csv \
+#     --fast-path stencil --verify-against-reference
+#
+# Predictors must be given with their source names (ones that mosse reads
+# from radon), for example T-K/HEIGHT/2.
+
+import argparse
+import datetime
+import math
+import os
+import random
+import eccodes
+
+LEVEL_TYPES = {'HEIGHT': 'heightAboveGround', 'GROUND': 'surface', 'PRESSURE': 'isobaricInhPa'}
+
+
+def ParseCommandLine():
+    parser = argparse.ArgumentParser()
+    parser.add_argument('-o', '--output-dir', required=True, help='Output directory')
+    parser.add_argument('-a', '--analysis-time', required=True, help='Analysis time (yyyy-mm-dd hh:mm:ss)')
+    parser.add_argument('-s', '--start-step', type=int, default=3)
+    parser.add_argument('-e', '--end-step', type=int, default=12)
+    parser.add_argument('-l', '--step-length', type=int, default=3)
+    parser.add_argument('-p', '--target-param', default='T-K', help='Parameter produced by mos')
+    parser.add_argument('--predictors', default='T-K/HEIGHT/2,TD-K/HEIGHT/2', help='Comma separated list')
+    parser.add_argument('--producer-id', type=int, default=131)
+    parser.add_argument('--stations', type=int, default=1000)
+    parser.add_argument('--resolution', type=float, default=0.1, help='Grid resolution in degrees')
+    parser.add_argument('--area', default='-10,35,40,72', help='Grid area: west,south,east,north')
+    parser.add_argument('--seed', type=int, default=1)
+
+    return parser.parse_args()
+
+
+def PeriodId(time):
+    if time.month == 12 or time.month < 3:
+        return 1
+    if time.month < 6:
+        return 2
+    if time.month < 9:
+        return 3
+    return 4
+
+
+def WriteGrib(fileName, analysisTime, step, predictor, area, resolution, seed):
+    (param, level, value) = predictor.split('/')[0:3]
+    (west, south, east, north) = area
+
+    ni = int(round((east - west) / resolution)) + 1
+    nj = int(round((north - south) / resolution)) + 1
+
+    gid = eccodes.codes_grib_new_from_samples('regular_ll_sfc_grib2')
+
+    eccodes.codes_set(gid, 'dataDate', int(analysisTime.strftime('%Y%m%d')))
+    eccodes.codes_set(gid, 'dataTime', int(analysisTime.strftime('%H%M')))
+    eccodes.codes_set(gid, 'stepUnits', 'h')
+    eccodes.codes_set(gid, 'forecastTime', step)
+    eccodes.codes_set(gid, 'typeOfFirstFixedSurface', LEVEL_TYPES.get(level, 'surface'))
+    eccodes.codes_set(gid, 'level', int(float(value)))
+    eccodes.codes_set(gid, 'Ni', ni)
+    eccodes.codes_set(gid, 'Nj', nj)
+    eccodes.codes_set(gid, 'longitudeOfFirstGridPointInDegrees', west)
+    eccodes.codes_set(gid, 'latitudeOfFirstGridPointInDegrees', north)
+    eccodes.codes_set(gid, 'longitudeOfLastGridPointInDegrees', east)
+    eccodes.codes_set(gid, 'latitudeOfLastGridPointInDegrees', south)
+    eccodes.codes_set(gid, 'iDirectionIncrementInDegrees', resolution)
+    eccodes.codes_set(gid, 'jDirectionIncrementInDegrees', resolution)
+    eccodes.codes_set(gid, 'jScansPositively', 0)
+
+    # Smooth field with some structure, different for each predictor and step
+
+    rnd = random.Random(seed)
+    a = rnd.uniform(0.05, 0.2)
+    b = rnd.uniform(0.05, 0.2)
+    base = 273.15 if param.endswith('-K') else 50
+
+    values = []
+
+    for j in range(nj):
+        lat = north - j * resolution
+        for i in range(ni):
+            lon = west + i * resolution
+            values.append(base + 10 * math.sin(a * lon + step * 0.1) * math.cos(b * lat) - 0.3 * (lat - 50))
+
+    eccodes.codes_set_values(gid, values)
+
+    with open(fileName, 'wb') as fp:
+        eccodes.codes_write(gid, fp)
+
+    eccodes.codes_release(gid)
+
+    return os.path.getsize(fileName)
+
+
+def Main():
+    args = ParseCommandLine()
+
+    analysisTime = datetime.datetime.strptime(args.analysis_time, '%Y-%m-%d %H:%M:%S')
+    area = [float(x) for x in args.area.split(',')]
+    predictors = args.predictors.split(',')
+    steps = range(args.start_step, args.end_step + 1, args.step_length)
+
+    os.makedirs(args.output_dir, exist_ok=True)
+
+    catalog = os.path.join(args.output_dir, 'catalog.csv')
+
+    with open(catalog, 'w') as fp:
+        fp.write('# producer_id,analysis_time,param_name,level_name,level_value,forecast_period,'
+                 'forecast_type_id,forecast_type_value,geometry_name,file_location,byte_offset,byte_length\n')
+
+        for step in steps:
+            for n, predictor in enumerate(predictors):
+                (param, level, value) = predictor.split('/')[0:3]
+                fileName = os.path.abspath(os.path.join(args.output_dir, '%s_%s_%s_%03d.grib2' %
+                                                        (param, level, value, step)))
+
+                length = WriteGrib(fileName, analysisTime, step, predictor, area, args.resolution,
+                                   args.seed + 1000 * step + n)
+
+                fp.write('%d,%s,%s,%s,%s,%d,1,0,SYNTHETIC,%s,0,%d\n' %
+                         (args.producer_id, args.analysis_time, param, level, value, step, fileName, length))
+
+    # Stations inside grid, away from the edges
+
+    rnd = random.Random(args.seed)
+    (west, south, east, north) = area
+
+    weights = os.path.join(args.output_dir, 'weights.csv')
+
+    with open(weights, 'w') as fp:
+        for station in range(1, args.stations + 1):
+            lon = rnd.uniform(west + 1, east - 1)
+            lat = rnd.uniform(south + 1, north - 1)
+
+            for step in steps:
+                cols = [PeriodId(analysisTime), analysisTime.hour, station, '%.4f' % lon, '%.4f' % lat, step,
+                        args.target_param]
+
+                for predictor in predictors:
+                    cols += [predictor, '%.6f' % (rnd.uniform(-1, 1) / len(predictors))]
+
+                cols += ['INTERCEPT-N/GROUND/0', '%.6f' % rnd.uniform(-2, 2)]
+
+                fp.write(','.join(str(x) for x in cols) + '\n')
+
+    print('Wrote %s and %s' % (catalog, weights))
+
+
+if __name__ == '__main__':
+    Main()
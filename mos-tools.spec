@@ -52,12 +52,14 @@ Requires:	oracle-instantclient19.22-basic
 Requires:	fmi-tnsnames-oracle
 Requires:	postgresql15-libs
 Requires:	python3-psycopg2
+Requires:	python3-eccodes
 Requires:	%{boost}-program-options
 Requires:	%{boost}-filesystem
 Requires:	%{boost}-date-time
 Requires:	%{boost}-program-options
 Requires:	%{boost}-iostreams
 Requires:	%{boost}-regex
+Requires:	%{boost}-container
 Requires:	%{boost}-system
 Provides:	mosse
 
@@ -84,6 +86,7 @@ rm -rf %{buildroot}
 %{_bindir}/mosse
 %{_bindir}/mos_importer.py
 %{_bindir}/mos_factor_loader.py
+%{_bindir}/mosse-synthetic-data.py
 
 %changelog
 * Wed Apr 24 2024 Ville Kuvaja <ville.kuvaja@fmi.fi> - 24.4.24-1.fmi
@@ -0,0 +1,101 @@
+#include "AllocationStats.h"
+#include "Logger.h"
+#include <algorithm>
+#include <cstdlib>
+#include <mutex>
+#include <new>
+
+#ifdef MOSSE_ALLOCATION_STATS
+
+namespace
+{
+thread_local uint64_t allocations = 0;
+
+std::mutex statsMutex;
+uint64_t tasks = 0;
+uint64_t taskAllocations = 0;
+uint64_t maxTaskAllocations = 0;
+}  // namespace
+
+void* operator new(std::size_t size)
+{
+	allocations++;
+
+	if (size == 0)
+	{
+		size = 1;
+	}
+
+	while (true)
+	{
+		void* p = malloc(size);
+
+		if (p)
+		{
+			return p;
+		}
+
+		std::new_handler handler = std::get_new_handler();
+
+		if (!handler)
+		{
+			throw std::bad_alloc();
+		}
+
+		handler();
+	}
+}
+
+void operator delete(void* p) noexcept
+{
+	free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept
+{
+	free(p);
+}
+
+uint64_t ThreadAllocations()
+{
+	return allocations;
+}
+
+void AddTaskAllocations(uint64_t count)
+{
+	std::lock_guard<std::mutex> lock(statsMutex);
+
+	tasks++;
+	taskAllocations += count;
+	maxTaskAllocations = std::max(maxTaskAllocations, count);
+}
+
+void ReportAllocations()
+{
+	std::lock_guard<std::mutex> lock(statsMutex);
+
+	if (tasks == 0)
+	{
+		return;
+	}
+
+	Log(kLogInfo) << "Heap allocations per task in worker thread: " << taskAllocations / tasks << " on average, "
+	              << maxTaskAllocations << " at most (" << tasks << " tasks)";
+}
+
+#else
+
+uint64_t ThreadAllocations()
+{
+	return 0;
+}
+
+void AddTaskAllocations(uint64_t)
+{
+}
+
+void ReportAllocations()
+{
+}
+
+#endif
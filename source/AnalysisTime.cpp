@@ -0,0 +1,79 @@
+#include "AnalysisTime.h"
+#include <cstdio>
+#include <stdexcept>
+
+namespace
+{
+// Days since 1970-01-01 of a date in proleptic Gregorian calendar, and back
+// (http://howardhinnant.github.io/date_algorithms.html)
+
+int64_t DaysFromCivil(int64_t y, int m, int d)
+{
+	y -= m <= 2;
+	const int64_t era = (y >= 0 ? y : y - 399) / 400;
+	const int64_t yoe = y - era * 400;
+	const int64_t doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+	const int64_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+
+	return era * 146097 + doe - 719468;
+}
+
+void CivilFromDays(int64_t z, int& year, int& month, int& day)
+{
+	z += 719468;
+	const int64_t era = (z >= 0 ? z : z - 146096) / 146097;
+	const int64_t doe = z - era * 146097;
+	const int64_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+	const int64_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+	const int64_t mp = (5 * doy + 2) / 153;
+
+	day = static_cast<int>(doy - (153 * mp + 2) / 5 + 1);
+	month = static_cast<int>(mp < 10 ? mp + 3 : mp - 9);
+	year = static_cast<int>(yoe + era * 400 + (month <= 2));
+}
+
+int64_t FloorDiv(int64_t a, int64_t b)
+{
+	return (a >= 0) ? a / b : -((-a + b - 1) / b);
+}
+}  // namespace
+
+AnalysisTime AnalysisTime::Parse(const std::string& time)
+{
+	int year, month, day, hour, minute = 0, second = 0;
+
+	const int n = sscanf(time.c_str(), "%4d-%2d-%2d %2d:%2d:%2d", &year, &month, &day, &hour, &minute, &second);
+
+	if (n < 5 || month < 1 || month > 12 || day < 1 || day > 31 || hour < 0 || hour > 23)
+	{
+		throw std::runtime_error("Invalid analysis time: '" + time + "'");
+	}
+
+	if (minute != 0 || second != 0)
+	{
+		throw std::runtime_error("Analysis time should be at full hour: '" + time + "'");
+	}
+
+	return FromHours(DaysFromCivil(year, month, day) * 24 + hour);
+}
+
+AnalysisTime AnalysisTime::FromHours(int64_t hours)
+{
+	AnalysisTime t;
+
+	const int64_t days = FloorDiv(hours, 24);
+
+	t.itsHours = hours;
+	t.itsHour = static_cast<int>(hours - days * 24);
+
+	CivilFromDays(days, t.itsYear, t.itsMonth, t.itsDay);
+
+	t.itsDayOfYear = static_cast<int>(days - DaysFromCivil(t.itsYear, 1, 1));
+
+	char text[32];
+	snprintf(text, sizeof(text), "%04d-%02d-%02d %02d:00:00", t.itsYear, t.itsMonth, t.itsDay, t.itsHour);
+
+	t.itsText = text;
+
+	return t;
+}
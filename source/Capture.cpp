@@ -0,0 +1,364 @@
+#include "Capture.h"
+#include "Logger.h"
+#include "Options.h"
+#include "WeightTable.h"
+#include <boost/algorithm/string.hpp>
+#include <boost/filesystem.hpp>
+#include <fcntl.h>
+#include <fmt/format.h>
+#include <stdexcept>
+#include <unistd.h>
+
+extern Options opts;
+
+namespace
+{
+const char* kCatalogFile = "catalog.csv";
+const char* kMessagesFile = "messages.grib";
+const char* kArgsFile = "replay.args";
+const char* kParamConfigFile = "params.conf";
+
+std::string WeightsFile(size_t label)
+{
+	return "weights_" + std::to_string(label + 1) + ".csv";
+}
+
+void CopyFile(const std::string& from, const std::string& to)
+{
+	boost::filesystem::remove(to);
+	boost::filesystem::copy_file(from, to);
+}
+
+std::vector<char> ReadRange(const std::string& fileName, size_t offset, size_t length)
+{
+	const int fd = open(fileName.c_str(), O_RDONLY);
+
+	if (fd == -1)
+	{
+		throw std::runtime_error("File open failed for " + fileName);
+	}
+
+	std::vector<char> buffer(length);
+	size_t done = 0;
+
+	while (done < length)
+	{
+		const ssize_t ret = pread(fd, buffer.data() + done, length - done, static_cast<off_t>(offset + done));
+
+		if (ret <= 0)
+		{
+			close(fd);
+			throw std::runtime_error("Read failed for " + fileName + " at offset " + std::to_string(offset + done));
+		}
+
+		done += static_cast<size_t>(ret);
+	}
+
+	close(fd);
+
+	return buffer;
+}
+}  // namespace
+
+Capture* Capture::Instance()
+{
+	static Capture capture;
+	return &capture;
+}
+
+void Capture::Open(const std::string& dir, const std::vector<MosInfo>& mosInfos)
+{
+	boost::filesystem::create_directories(dir + "/files");
+
+	itsCatalog.open(dir + "/" + kCatalogFile);
+	itsMessages.open(dir + "/" + kMessagesFile, std::ios::binary);
+
+	if (!itsCatalog || !itsMessages)
+	{
+		throw std::runtime_error("Unable to create capture files in '" + dir + "'");
+	}
+
+	itsCatalog << "# producer_id,analysis_time,param_name,level_name,level_value,forecast_period,forecast_type_id,"
+	              "forecast_type_value,geometry_name,file_location,byte_offset,byte_length\n";
+
+	itsMosInfos = mosInfos;
+	itsDir = dir;
+
+	Log(kLogInfo) << "Capturing source data, weights and options to '" << dir << "'";
+}
+
+// Messages are copied once even if they are found several times. Files
+// that are read whole keep their own file.
+
+SourceMessage Capture::CopyMessage(const SourceMessage& message)
+{
+	const std::string key = message.fileLocation + "@" + message.byteOffset + "+" + message.byteLength;
+
+	auto it = itsCopies.find(key);
+
+	if (it != itsCopies.end())
+	{
+		return it->second;
+	}
+
+	SourceMessage copy = message;
+
+	if (message.byteOffset.empty() && message.byteLength.empty())
+	{
+		copy.fileLocation = "files/" + std::to_string(++itsFileCount) + ".grib";
+		CopyFile(message.fileLocation, itsDir + "/" + copy.fileLocation);
+	}
+	else
+	{
+		const auto bytes = ReadRange(message.fileLocation, std::stoul(message.byteOffset),
+		                             std::stoul(message.byteLength));
+
+		itsMessages.write(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+
+		if (!itsMessages)
+		{
+			throw std::runtime_error("Writing captured messages failed");
+		}
+
+		copy.fileLocation = kMessagesFile;
+		copy.byteOffset = std::to_string(itsMessagesSize);
+		copy.byteLength = std::to_string(bytes.size());
+
+		itsMessagesSize += bytes.size();
+	}
+
+	return itsCopies.emplace(key, copy).first->second;
+}
+
+void Capture::RecordMessages(const SourceParam& src, const std::vector<SourceMessage>& messages, bool members)
+{
+	std::lock_guard<std::mutex> lock(itsMutex);
+
+	for (const auto& message : messages)
+	{
+		const SourceMessage copy = CopyMessage(message);
+
+		// Deterministic forecast has type 1; control and perturbed members 3
+		// and 4
+
+		const int forecastType = members ? (message.member == 0 ? 3 : 4) : 1;
+
+		const std::string line =
+		    fmt::format("{},{},{},{},{},{},{},{},{},{},{},{}", src.producerId, src.originTime, src.paramName,
+		                src.levelName, src.levelValue, src.step, forecastType, members ? message.member : 0,
+		                message.geometry.empty() ? "capture" : message.geometry, copy.fileLocation, copy.byteOffset,
+		                copy.byteLength);
+
+		if (itsCatalogLines.insert(line).second)
+		{
+			itsCatalog << line << "\n";
+		}
+	}
+}
+
+void Capture::RecordWeights(const MosInfo& mosInfo, int step, const WeightTable& table)
+{
+	std::lock_guard<std::mutex> lock(itsMutex);
+
+	if (!itsRecordedWeights.insert(mosInfo.label + "/" + std::to_string(step) + "/" + mosInfo.paramName).second)
+	{
+		return;
+	}
+
+	auto& out = itsWeights[mosInfo.label];
+
+	if (!out)
+	{
+		size_t index = 0;
+
+		while (index < itsMosInfos.size() && itsMosInfos[index].label != mosInfo.label)
+		{
+			index++;
+		}
+
+		out = std::unique_ptr<std::ofstream>(new std::ofstream(itsDir + "/" + WeightsFile(index)));
+	}
+
+	// Period is the one weights came with, which for database weights is
+	// from mos_period and may differ from the one of analysis date; stations
+	// are identified by wmo id, which is what the output has. Values are
+	// written so that they are parsed back exactly.
+
+	const int periodId = table.PeriodId();
+	const auto& weights = table.Weights();
+
+	fmt::memory_buffer line;
+
+	for (size_t i = 0; i < table.Size(); i++)
+	{
+		const Station& station = table.Stations()[i];
+		const auto& params = table.Params(i);
+		const size_t offset = table.Offset(i);
+
+		line.clear();
+		fmt::format_to(std::back_inserter(line), "{},{},{},{},{},{},{}", periodId, mosInfo.originTime.Hour(),
+		               station.wmoId, station.longitude, station.latitude, step, mosInfo.paramName);
+
+		for (size_t j = 0; j < params.size(); j++)
+		{
+			const ParamLevel& pl = params[j];
+
+			// Same key as in database, origin time adjustment only when set
+
+			fmt::format_to(std::back_inserter(line), ",{}/{}/{}/{}", pl.paramName, pl.levelName, pl.levelValue,
+			               pl.stepAdjustment);
+
+			if (pl.originTimeAdjustment != 0)
+			{
+				fmt::format_to(std::back_inserter(line), "/{}", pl.originTimeAdjustment);
+			}
+
+			fmt::format_to(std::back_inserter(line), ",{}", weights[offset + j]);
+		}
+
+		*out << fmt::to_string(line) << "\n";
+	}
+}
+
+void Capture::Finish()
+{
+	if (!Enabled())
+	{
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock(itsMutex);
+
+	itsCatalog.close();
+	itsMessages.close();
+
+	for (auto& it : itsWeights)
+	{
+		it.second->close();
+	}
+
+	if (!opts.paramConfig.empty())
+	{
+		CopyFile(opts.paramConfig, itsDir + "/" + kParamConfigFile);
+	}
+
+	// Resolved values of options; those that select databases or files are
+	// replaced by the files of bundle when replaying (see SetReplayOptions).
+	// Station selection is already in the captured weights.
+
+	const MosInfo& mosInfo = itsMosInfos[0];
+
+	std::vector<std::string> labels;
+
+	for (const auto& m : itsMosInfos)
+	{
+		labels.push_back(m.label);
+	}
+
+	std::vector<std::pair<std::string, std::string>> args = {
+	    {"--parameter", opts.paramName},
+	    {"--start-step", std::to_string(opts.startStep)},
+	    {"--end-step", std::to_string(opts.endStep)},
+	    {"--step-length", std::to_string(opts.stepLength)},
+	    {"--analysis_time", mosInfo.originTime.ToString()},
+	    {"--producer-id", std::to_string(mosInfo.producerId)},
+	    {"--threads", std::to_string(opts.threadCount)},
+	    {"--station-threads", std::to_string(opts.stationThreads)},
+	    {"--ensemble-size", std::to_string(opts.ensembleSize)},
+	    {"--ensemble-producer-id", std::to_string(opts.ensembleProducerId)},
+	    {"--log-level", opts.logLevel},
+	    {"--log-rate-limit", std::to_string(opts.logRateLimit)},
+	    {"--compact-max-error", fmt::format("{}", opts.compactMaxError)}};
+
+	if (!(labels.size() == 1 && labels[0].empty()))
+	{
+		args.push_back({"--mos-label", boost::algorithm::join(labels, ",")});
+	}
+
+	if (!opts.quantiles.empty())
+	{
+		args.push_back({"--quantiles", opts.quantiles});
+	}
+
+	if (!opts.fastPath.empty())
+	{
+		args.push_back({"--fast-path", opts.fastPath});
+	}
+
+	if (opts.shardCount > 0)
+	{
+		args.push_back({"--shard", fmt::format("{}/{}", opts.shardIndex, opts.shardCount)});
+	}
+
+	if (opts.verify)
+	{
+		args.push_back({"--verify-against-reference", ""});
+		args.push_back({"--verify-tolerance", fmt::format("{}", opts.verifyTolerance)});
+	}
+
+	if (opts.disable0125)
+	{
+		args.push_back({"--disable0125", ""});
+	}
+
+	std::ofstream out(itsDir + "/" + kArgsFile);
+
+	// Values are given with '=', since some can be negative
+
+	for (const auto& arg : args)
+	{
+		out << arg.first << (arg.second.empty() ? "" : "=" + arg.second) << "\n";
+	}
+
+	if (!out)
+	{
+		throw std::runtime_error("Writing '" + itsDir + "/" + kArgsFile + "' failed");
+	}
+
+	Log(kLogInfo) << "Captured " << itsCopies.size() << " grib messages (" << itsMessagesSize / 1024 / 1024
+	              << " MB), " << itsRecordedWeights.size() << " weight tables and options to '" << itsDir
+	              << "'; run again with --replay " << itsDir;
+}
+
+void Capture::SetReplayOptions(const std::string& dir)
+{
+	opts.sourceCatalog = dir + "/" + kCatalogFile;
+
+	std::vector<std::string> labels, files;
+	boost::split(labels, opts.mosLabel, boost::is_any_of(","));
+
+	for (size_t i = 0; i < labels.size(); i++)
+	{
+		files.push_back(dir + "/" + WeightsFile(i));
+	}
+
+	opts.weightsFile = boost::algorithm::join(files, ",");
+
+	if (opts.paramConfig.empty() && boost::filesystem::exists(dir + "/" + kParamConfigFile))
+	{
+		opts.paramConfig = dir + "/" + kParamConfigFile;
+	}
+}
+
+std::vector<std::string> Capture::ReplayArguments(const std::string& dir)
+{
+	std::ifstream in(dir + "/" + kArgsFile);
+
+	if (!in)
+	{
+		throw std::runtime_error("'" + dir + "' is not a capture directory: " + kArgsFile + " not found");
+	}
+
+	std::vector<std::string> args;
+	std::string line;
+
+	while (std::getline(in, line))
+	{
+		if (!line.empty())
+		{
+			args.push_back(line);
+		}
+	}
+
+	return args;
+}
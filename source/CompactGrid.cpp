@@ -0,0 +1,125 @@
+#include "CompactGrid.h"
+#include "Logger.h"
+#include <algorithm>
+#include <cmath>
+#include <mutex>
+
+namespace
+{
+std::mutex statsMutex;
+
+size_t encodedFields = 0;
+size_t rejectedFields = 0;  // error would have been over the limit
+size_t compactBytes = 0;
+size_t floatBytes = 0;
+double maxError = 0;
+}  // namespace
+
+std::shared_ptr<const CompactGrid> CompactGrid::Encode(const NFmiHPlaceDescriptor& hplace,
+                                                       const std::vector<float>& values, double maxAllowedError)
+{
+	float minValue = kFloatMissing, maxValue = kFloatMissing;
+
+	for (float v : values)
+	{
+		if (v == kFloatMissing)
+		{
+			continue;
+		}
+
+		if (minValue == kFloatMissing)
+		{
+			minValue = maxValue = v;
+			continue;
+		}
+
+		minValue = std::min(minValue, v);
+		maxValue = std::max(maxValue, v);
+	}
+
+	std::shared_ptr<CompactGrid> grid(new CompactGrid());
+
+	grid->itsHPlace = hplace;
+	grid->itsOffset = minValue;
+	grid->itsScale = (minValue == kFloatMissing) ? 0 : (static_cast<double>(maxValue) - minValue) / (kMissingCode - 1);
+	grid->itsCodes.resize(values.size());
+
+	// Error is measured from the decoded values, so that it includes float
+	// rounding too
+
+	double error = 0;
+
+	for (size_t i = 0; i < values.size(); i++)
+	{
+		const float v = values[i];
+
+		if (v == kFloatMissing)
+		{
+			grid->itsCodes[i] = kMissingCode;
+			continue;
+		}
+
+		const double code = (grid->itsScale == 0) ? 0 : std::round((v - grid->itsOffset) / grid->itsScale);
+		grid->itsCodes[i] = static_cast<uint16_t>(std::min<double>(code, kMissingCode - 1));
+
+		error = std::max(error, std::fabs(static_cast<double>(grid->Value(i)) - v));
+	}
+
+	grid->itsMaxError = error;
+
+	std::lock_guard<std::mutex> lock(statsMutex);
+
+	if (maxAllowedError >= 0 && error > maxAllowedError)
+	{
+		rejectedFields++;
+		floatBytes += values.size() * sizeof(float);
+		compactBytes += values.size() * sizeof(float);
+		return nullptr;
+	}
+
+	encodedFields++;
+	floatBytes += values.size() * sizeof(float);
+	compactBytes += values.size() * sizeof(uint16_t);
+	maxError = std::max(maxError, error);
+
+	return grid;
+}
+
+std::vector<float> CompactGrid::Values() const
+{
+	std::vector<float> values(itsCodes.size());
+
+	for (size_t i = 0; i < itsCodes.size(); i++)
+	{
+		values[i] = Value(i);
+	}
+
+	return values;
+}
+
+void CompactGrid::Report()
+{
+	std::lock_guard<std::mutex> lock(statsMutex);
+
+	if (encodedFields == 0 && rejectedFields == 0)
+	{
+		return;
+	}
+
+	Log(kLogInfo) << "Compact cache: " << encodedFields << " fields as 16-bit, " << rejectedFields
+	              << " kept as float because of error limit, " << compactBytes / 1024 / 1024 << " MB instead of "
+	              << floatBytes / 1024 / 1024 << " MB, max error " << maxError;
+}
+
+std::vector<float> GridValues(NFmiFastQueryInfo& info)
+{
+	std::vector<float> values;
+	values.reserve(info.SizeLocations());
+
+	for (info.ResetLocation(); info.NextLocation();)
+	{
+		values.push_back(info.FloatValue());
+	}
+
+	return values;
+}
@@ -0,0 +1,383 @@
+#include "DerivedPredictors.h"
+#include "SampleCache.h"
+#include "TraceEvents.h"
+#include <algorithm>
+#include <mutex>
+
+const double PI = 3.14159265359;
+
+double Declination(int step, const AnalysisTime& originTime)
+{
+	const AnalysisTime validTime = originTime.Shifted(step);
+
+	// Formula from Jussi Ylhaisi
+
+	const int hour_of_day = validTime.Hour();
+
+	// Sekä deklinaation että länpötilan vuosisyklin jaksonaika on tasan yksi
+	// vuosi, mutta näillä
+	// aalloilla on vaihe-ero: Lämpötilan vuosisykli on hieman perässä. Esim.
+	// aurinko on on korkeimmillaan
+	// juhannuksena kesäkuun lopulla, mutta silti heinäkuu on ilmastollisesti
+	// lämpimin kuukausi.
+	// Keskimääräiseksi vaihe-eroksi talvi-kesäkausilla tulee kuitenkin n. 32
+	// päivää, tällä saadaan aallot synkkaan.
+	// Tämä on ihan ok oletus kaikkina vuorokaudenaikoina
+
+	double daydoy = validTime.DayOfYear() + hour_of_day / 24. - 32.;
+
+	if (daydoy < 0)
+		daydoy += 365.;
+
+	// 1) Lasketaan auringon deklinaatio (maan akselin ja maan kiertorataa
+	// kohtisuoran viivan välinen kulma)
+
+	// Tässä daydoy on vuoden päivämäärä 0...365/366 vuoden alusta lukien. Tunnit
+	// luetaan tähän mukaan,
+	// eli esim. ajanhetkelle 2.1. klo 15 daydoy=1.625. Huom. päivä ei siis ala
+	// indeksistä 1, vaan 0!
+	// Ylläolevat laskut antavat ulos asteina deklinaation.
+
+	const double declination = -asin(0.39779 * cos(0.98565 / 360 * 2 * PI * (daydoy + 10) +
+	                                               1.914 / 360 * 2 * PI * sin(0.98565 / 360 * 2 * PI * (daydoy - 2)))) *
+	                           360 / 2 / PI;
+
+	return declination;
+}
+
+int PreviousStep(int step)
+{
+	if (step > 144)
+	{
+		return step - 6;
+	}
+	else if (step > 90)
+	{
+		return step - 3;
+	}
+
+	return step - 1;
+}
+
+// Member-independent predictors are read once also in ensemble runs; field
+// requests, field cache and sample cache all use this flag
+
+bool MemberFields(bool ensemble, const ParamInfo& info)
+{
+	return ensemble && !(info.flags & kParamMemberIndependent);
+}
+
+// Transforms
+
+std::vector<double> Broadcast(const PredictorContext& ctx, double value)
+{
+	return std::vector<double>(ctx.stations.size() * ctx.members, value);
+}
+
+std::vector<double> SourceValues(const PredictorContext& ctx)
+{
+
+	return ctx.interpolator.Interpolate(ctx.interpolator.GetField(ctx.mosInfo, ctx.pl, ctx.step, ctx.ensemble),
+	                                    ctx.stations, ctx.ensemble);
+}
+
+// Accumulation since the previous step. Fields are subtracted once for the
+// whole grid; if that is not possible, the subtraction is done for the
+// station values.
+
+std::vector<double> DeaccumulatedValues(const PredictorContext& ctx, bool rate)
+{
+	const int prevStep = PreviousStep(ctx.step);
+	const double divisor = rate ? (ctx.step - prevStep) * 3600 : 1;
+
+	const auto* field =
+	    ctx.interpolator.GetDeaccumulatedField(ctx.mosInfo, ctx.pl, ctx.step, prevStep, divisor, ctx.ensemble);
+
+	if (field)
+	{
+		return ctx.interpolator.Interpolate(*field, ctx.stations, ctx.ensemble);
+	}
+
+	auto values = SourceValues(ctx);
+	const auto prevValues = ctx.interpolator.Interpolate(
+	    ctx.interpolator.GetField(ctx.mosInfo, ctx.pl, prevStep, ctx.ensemble), ctx.stations, ctx.ensemble);
+
+	for (size_t i = 0; i < values.size(); i++)
+	{
+		if (values[i] == kFloatMissing || prevValues[i] == kFloatMissing)
+		{
+			values[i] = kFloatMissing;
+			continue;
+		}
+
+		values[i] = (values[i] - prevValues[i]) / divisor;
+	}
+
+	return values;
+}
+
+std::mutex registryMutex;
+
+std::map<std::string, PredictorTransform>& Registry()
+{
+	static std::map<std::string, PredictorTransform> registry;
+	static std::once_flag oflag;
+
+	std::call_once(oflag,
+	               [&]()
+	               {
+		               registry["INTERCEPT-N"] = [](const PredictorContext& ctx) { return Broadcast(ctx, 1); };
+
+		               // Declination is not in database, and is the same for all stations
+		               registry["DECLINATION-N"] = [](const PredictorContext& ctx)
+		               { return Broadcast(ctx, Declination(ctx.step, ctx.mosInfo.originTime)); };
+	               });
+
+	return registry;
+}
+
+void DerivedPredictors::Register(const std::string& paramName, PredictorTransform transform)
+{
+	std::lock_guard<std::mutex> lock(registryMutex);
+	Registry()[paramName] = transform;
+}
+
+DerivedPredictors::DerivedPredictors(MosInterpolator& interpolator)
+    : itsInterpolator(interpolator), itsStationsHash(0), itsStep(-1)
+{
+}
+
+void DerivedPredictors::Begin(const std::vector<Station>& stations, int step)
+{
+	const size_t hash = Hash(stations);
+
+	if (step != itsStep || hash != itsStationsHash)
+	{
+		itsValues.clear();
+	}
+
+	if (hash != itsStationsHash)
+	{
+		itsStations = stations;
+		itsStationsHash = hash;
+	}
+
+	itsStep = step;
+}
+
+void DerivedPredictors::Prefetch(const MosInfo& mosInfo, const std::vector<ParamLevel>& params)
+{
+	const bool ensemble = mosInfo.ensembleSize > 0;
+
+	// Predictors that are already evaluated are not read again
+
+	std::vector<ParamLevel> unevaluated;
+
+	for (const auto& pl : params)
+	{
+		if (itsValues.count(Key(pl, itsStep, mosInfo.originTime) + (ensemble ? " ens" : "")) == 0)
+		{
+			unevaluated.push_back(pl);
+		}
+	}
+
+	auto requests = FieldRequests(mosInfo, unevaluated, itsStep);
+
+	// Nor are predictors that are found from sample cache
+
+	if (SampleCache::Instance()->Enabled())
+	{
+		requests.erase(std::remove_if(requests.begin(), requests.end(),
+		                              [&](const FieldRequest& r)
+		                              {
+			                              std::string originTime;
+			                              const auto sampleKey = SampleKey(mosInfo, r.pl, r.members, originTime);
+
+			                              return SampleCache::Instance()->Contains(originTime, sampleKey);
+		                              }),
+		               requests.end());
+	}
+
+	itsInterpolator.Prefetch(mosInfo, requests);
+}
+
+std::vector<FieldRequest> DerivedPredictors::FieldRequests(const MosInfo& mosInfo,
+                                                           const std::vector<ParamLevel>& params, int step)
+{
+	const bool ensemble = mosInfo.ensembleSize > 0;
+
+	std::vector<FieldRequest> requests;
+
+	for (const auto& pl : params)
+	{
+		const ParamInfo& info = *pl.info;
+
+		if (info.maxStep != -1 && step > info.maxStep)
+		{
+			continue;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(registryMutex);
+
+			if (Registry().count(pl.paramName))
+			{
+				continue;
+			}
+		}
+
+		const bool members = MemberFields(ensemble, info);
+
+		requests.push_back(FieldRequest{pl, step, members});
+
+		if ((info.flags & (kParamCumulative | kParamCumulativeRadiation)) && PreviousStep(step) > 0)
+		{
+			requests.push_back(FieldRequest{pl, PreviousStep(step), members});
+		}
+	}
+
+	return requests;
+}
+
+const std::vector<double>& DerivedPredictors::Evaluate(const MosInfo& mosInfo, const ParamLevel& pl)
+{
+	if (mosInfo.ensembleSize > 0)
+	{
+		return Evaluate(mosInfo, pl, true);
+	}
+
+	return Evaluate(mosInfo, pl, false);
+}
+
+const std::vector<double>& DerivedPredictors::Evaluated(const MosInfo& mosInfo, const ParamLevel& pl) const
+{
+	const auto key = Key(pl, itsStep, mosInfo.originTime) + (mosInfo.ensembleSize > 0 ? " ens" : "");
+
+	const auto it = itsValues.find(key);
+
+	if (it == itsValues.end())
+	{
+		throw std::runtime_error("Predictor " + key + " has not been evaluated");
+	}
+
+	return it->second;
+}
+
+const std::vector<double>& DerivedPredictors::Evaluate(const MosInfo& mosInfo, const ParamLevel& pl, bool ensemble)
+{
+	const size_t members = ensemble ? static_cast<size_t>(mosInfo.ensembleSize) : 1;
+
+	const auto key = Key(pl, itsStep, mosInfo.originTime) + (ensemble ? " ens" : "");
+
+	auto it = itsValues.find(key);
+
+	if (it != itsValues.end())
+	{
+		return it->second;
+	}
+
+	std::vector<double> values;
+
+	const ParamInfo& info = *pl.info;
+
+	if (info.maxStep != -1 && itsStep > info.maxStep)
+	{
+		values.assign(itsStations.size() * members, kFloatMissing);
+	}
+	else if (ensemble && (info.flags & kParamMemberIndependent))
+	{
+		// Evaluate once per station and copy to all members
+		const auto& single = Evaluate(mosInfo, pl, false);
+
+		values.reserve(single.size() * members);
+
+		for (double v : single)
+		{
+			values.insert(values.end(), members, v);
+		}
+	}
+	else
+	{
+		PredictorTransform transform = SourceValues;
+		bool fromSource = true;  // values depend only on source data and stations
+
+		if (info.flags & kParamCumulativeRadiation)
+		{
+			transform = [](const PredictorContext& ctx) { return DeaccumulatedValues(ctx, true); };
+		}
+		else if (info.flags & kParamCumulative)
+		{
+			transform = [](const PredictorContext& ctx) { return DeaccumulatedValues(ctx, false); };
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(registryMutex);
+
+			const auto& registry = Registry();
+			const auto rit = registry.find(pl.paramName);
+
+			if (rit != registry.end())
+			{
+				transform = rit->second;
+				fromSource = false;
+			}
+		}
+
+		std::string originTime, sampleKey;
+
+		if (fromSource && SampleCache::Instance()->Enabled())
+		{
+			sampleKey = SampleKey(mosInfo, pl, MemberFields(ensemble, info), originTime);
+		}
+
+		if (sampleKey.empty() || !SampleCache::Instance()->Find(originTime, sampleKey, values))
+		{
+			const PredictorContext ctx{mosInfo, itsStations, pl, itsStep, ensemble, members, itsInterpolator};
+
+			TraceSpan span("interpolate", itsStep, pl.paramName, key);
+			values = transform(ctx);
+
+			if (!sampleKey.empty())
+			{
+				SampleCache::Instance()->Store(originTime, sampleKey, values);
+			}
+		}
+
+		assert(values.size() == itsStations.size() * members);
+
+		const double scale = info.scale;
+
+		for (double& v : values)
+		{
+			if (v != kFloatMissing)
+			{
+				v *= scale;
+			}
+		}
+	}
+
+	return itsValues.emplace(key, values).first->second;
+}
+
+// Values are cached before scaling, so the key is the same for all users of
+// the same source data. Accumulations depend on the previous step too, which
+// can come from another geometry.
+
+std::string DerivedPredictors::SampleKey(const MosInfo& mosInfo, const ParamLevel& pl, bool ensemble,
+                                         std::string& originTime)
+{
+	const ParamInfo& info = *pl.info;
+
+	const std::string kind = (info.flags & kParamCumulativeRadiation) ? "rate"
+	                         : (info.flags & kParamCumulative)        ? "accumulation"
+	                                                                  : "value";
+
+	std::string key = itsInterpolator.SampleKey(mosInfo, pl, itsStep, ensemble, originTime) + "/" + kind;
+
+	if (kind != "value" && PreviousStep(itsStep) > 0)
+	{
+		key += "/" + itsInterpolator.Geometry(mosInfo, pl, PreviousStep(itsStep), ensemble);
+	}
+
+	return key + "/" + std::to_string(itsStationsHash);
+}
@@ -0,0 +1,438 @@
+#include "Logger.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+namespace
+{
+struct Record
+{
+	uint64_t sequence;
+	LogLevel level;
+	bool suppressed;
+	std::chrono::system_clock::time_point time;
+	std::string category;
+	std::string text;
+};
+
+// Single producer (owning thread), single consumer (background thread)
+
+class ThreadBuffer
+{
+public:
+	bool Push(Record& record)
+	{
+		const size_t tail = itsTail.load(std::memory_order_relaxed);
+
+		if (tail - itsHead.load(std::memory_order_acquire) >= kCapacity)
+		{
+			return false;
+		}
+
+		itsRecords[tail % kCapacity] = std::move(record);
+		itsTail.store(tail + 1, std::memory_order_release);
+
+		return true;
+	}
+
+	void Drain(std::vector<Record>& records)
+	{
+		const size_t head = itsHead.load(std::memory_order_relaxed);
+		const size_t tail = itsTail.load(std::memory_order_acquire);
+
+		for (size_t i = head; i < tail; i++)
+		{
+			records.push_back(std::move(itsRecords[i % kCapacity]));
+		}
+
+		itsHead.store(tail, std::memory_order_release);
+	}
+
+private:
+	static const size_t kCapacity = 1024;
+
+	std::array<Record, kCapacity> itsRecords;
+	std::atomic<size_t> itsHead{0};
+	std::atomic<size_t> itsTail{0};
+};
+
+const size_t kCategorySlots = 4096;
+const auto kDrainInterval = std::chrono::milliseconds(100);
+const auto kRateWindow = std::chrono::seconds(1);
+
+std::atomic<int> minLevel{kLogInfo};
+std::atomic<int> rateLimit{0};
+std::atomic<bool> running{false};
+std::atomic<uint64_t> sequence{0};
+
+// Messages per category within current rate window; categories are hashed
+// to slots, so two categories sharing a slot share the limit too
+std::array<std::atomic<int>, kCategorySlots> categoryCounts;
+
+std::mutex buffersMutex;
+std::vector<std::shared_ptr<ThreadBuffer>> buffers;
+
+std::mutex drainMutex;
+std::condition_variable drainCondition;
+std::thread drainThread;
+bool stopRequested = false;
+
+// Owned by whoever writes: background thread, or the logging thread when
+// background thread is not running (serialized with writeMutex)
+std::mutex writeMutex;
+std::map<std::string, std::pair<LogLevel, int>> suppressedCounts;
+
+const char* LevelName(LogLevel level)
+{
+	switch (level)
+	{
+		case kLogDebug:
+			return "debug";
+		case kLogInfo:
+			return "info";
+		case kLogWarning:
+			return "warning";
+		case kLogError:
+			return "error";
+	}
+
+	return "";
+}
+
+void Append(std::string& out, std::chrono::system_clock::time_point time, LogLevel level, const std::string& text)
+{
+	const std::time_t t = std::chrono::system_clock::to_time_t(time);
+	const auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(time.time_since_epoch()).count() % 1000;
+
+	std::tm tm;
+	localtime_r(&t, &tm);
+
+	char prefix[40];
+	const size_t len = strftime(prefix, sizeof(prefix), "%H:%M:%S", &tm);
+	snprintf(prefix + len, sizeof(prefix) - len, ".%03d [%s] ", static_cast<int>(ms), LevelName(level));
+
+	out += prefix;
+	out += text;
+	out += '\n';
+}
+
+// Warnings and errors go to stderr, the rest to stdout
+
+FILE* Sink(LogLevel level)
+{
+	return (level >= kLogWarning) ? stderr : stdout;
+}
+
+// Write records in sequence order
+
+void Write(std::vector<Record>& records)
+{
+	std::sort(records.begin(), records.end(),
+	          [](const Record& a, const Record& b) { return a.sequence < b.sequence; });
+
+	std::string out;
+	FILE* stream = stdout;
+
+	for (const auto& r : records)
+	{
+		if (r.suppressed)
+		{
+			auto& count = suppressedCounts[r.category];
+			count.first = r.level;
+			count.second++;
+			continue;
+		}
+
+		FILE* target = Sink(r.level);
+
+		if (target != stream)
+		{
+			fwrite(out.data(), 1, out.size(), stream);
+			fflush(stream);
+			out.clear();
+			stream = target;
+		}
+
+		Append(out, r.time, r.level, r.text);
+	}
+
+	if (!out.empty())
+	{
+		fwrite(out.data(), 1, out.size(), stream);
+		fflush(stream);
+	}
+}
+
+// Summary of messages suppressed in the last rate window
+
+void WriteSummary()
+{
+	if (suppressedCounts.empty())
+	{
+		return;
+	}
+
+	const auto now = std::chrono::system_clock::now();
+
+	for (FILE* stream : {stdout, stderr})
+	{
+		std::string out;
+
+		for (const auto& it : suppressedCounts)
+		{
+			if (Sink(it.second.first) == stream)
+			{
+				Append(out, now, it.second.first,
+				       it.first + ": " + std::to_string(it.second.second) + " similar messages suppressed");
+			}
+		}
+
+		if (!out.empty())
+		{
+			fwrite(out.data(), 1, out.size(), stream);
+			fflush(stream);
+		}
+	}
+
+	suppressedCounts.clear();
+}
+
+void DrainAll()
+{
+	std::vector<std::shared_ptr<ThreadBuffer>> current;
+
+	{
+		std::lock_guard<std::mutex> lock(buffersMutex);
+		current = buffers;
+	}
+
+	std::vector<Record> records;
+
+	for (auto& b : current)
+	{
+		b->Drain(records);
+	}
+
+	std::lock_guard<std::mutex> lock(writeMutex);
+	Write(records);
+}
+
+void ResetRateWindow()
+{
+	for (auto& c : categoryCounts)
+	{
+		c.store(0, std::memory_order_relaxed);
+	}
+
+	std::lock_guard<std::mutex> lock(writeMutex);
+	WriteSummary();
+}
+
+void Run()
+{
+	auto windowStart = std::chrono::steady_clock::now();
+
+	while (true)
+	{
+		bool stop;
+
+		{
+			std::unique_lock<std::mutex> lock(drainMutex);
+			drainCondition.wait_for(lock, kDrainInterval);
+			stop = stopRequested;
+		}
+
+		DrainAll();
+
+		if (stop)
+		{
+			break;
+		}
+
+		if (std::chrono::steady_clock::now() - windowStart >= kRateWindow)
+		{
+			ResetRateWindow();
+			windowStart = std::chrono::steady_clock::now();
+		}
+	}
+
+	ResetRateWindow();
+}
+
+ThreadBuffer& LocalBuffer()
+{
+	thread_local std::shared_ptr<ThreadBuffer> buffer;
+
+	if (!buffer)
+	{
+		// Buffer is owned by logger too, so that messages of a finished
+		// thread are still written out
+		buffer = std::make_shared<ThreadBuffer>();
+
+		std::lock_guard<std::mutex> lock(buffersMutex);
+		buffers.push_back(buffer);
+	}
+
+	return *buffer;
+}
+
+std::ostringstream& LocalStream()
+{
+	thread_local std::ostringstream stream;
+	return stream;
+}
+}  // namespace
+
+LogMessage::LogMessage(LogLevel level, const std::string& category)
+    : itsLevel(level), itsCategory(category), itsEnabled(false), itsSuppressed(false), itsStream(nullptr)
+{
+	Logger* logger = Logger::Instance();
+
+	itsEnabled = logger->Enabled(level);
+
+	if (!itsEnabled)
+	{
+		return;
+	}
+
+	itsSuppressed = !logger->Admit(category);
+
+	if (!itsSuppressed)
+	{
+		itsStream = &LocalStream();
+		itsStream->str(std::string());
+		itsStream->clear();
+	}
+}
+
+LogMessage::~LogMessage()
+{
+	if (itsEnabled)
+	{
+		Logger::Instance()->Push(itsLevel, itsCategory, itsStream ? itsStream->str() : std::string(), itsSuppressed);
+	}
+}
+
+Logger* Logger::Instance()
+{
+	static Logger instance;
+	return &instance;
+}
+
+void Logger::Start(LogLevel level, int limit)
+{
+	minLevel = level;
+	rateLimit = limit;
+
+	if (running.exchange(true))
+	{
+		return;
+	}
+
+	drainThread = std::thread(Run);
+
+	// Messages are not lost when exit() is called
+	std::atexit([]() { Logger::Instance()->Stop(); });
+}
+
+void Logger::Stop()
+{
+	if (!running.exchange(false))
+	{
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(drainMutex);
+		stopRequested = true;
+	}
+
+	drainCondition.notify_all();
+	drainThread.join();
+
+	// Anything pushed while background thread was stopping
+	DrainAll();
+	ResetRateWindow();
+}
+
+bool Logger::Enabled(LogLevel level) const
+{
+	return level >= minLevel.load(std::memory_order_relaxed);
+}
+
+LogLevel Logger::ParseLevel(const std::string& level)
+{
+	if (level == "debug")
+	{
+		return kLogDebug;
+	}
+	else if (level == "info")
+	{
+		return kLogInfo;
+	}
+	else if (level == "warning")
+	{
+		return kLogWarning;
+	}
+	else if (level == "error")
+	{
+		return kLogError;
+	}
+
+	throw std::runtime_error("Invalid log level: " + level);
+}
+
+bool Logger::Admit(const std::string& category)
+{
+	const int limit = rateLimit.load(std::memory_order_relaxed);
+
+	if (category.empty() || limit <= 0)
+	{
+		return true;
+	}
+
+	const size_t slot = std::hash<std::string>()(category) % kCategorySlots;
+
+	return categoryCounts[slot].fetch_add(1, std::memory_order_relaxed) < limit;
+}
+
+void Logger::Push(LogLevel level, const std::string& category, std::string text, bool suppressed)
+{
+	Record record{sequence++, level, suppressed, std::chrono::system_clock::now(),
+	              suppressed ? category : std::string(), std::move(text)};
+
+	ThreadBuffer* buffer = running.load(std::memory_order_acquire) ? &LocalBuffer() : nullptr;
+
+	while (buffer && !buffer->Push(record))
+	{
+		// Buffer full: wake up background thread and wait for it to make room
+		drainCondition.notify_one();
+		std::this_thread::yield();
+
+		if (!running.load(std::memory_order_acquire))
+		{
+			buffer = nullptr;
+		}
+	}
+
+	if (!buffer)
+	{
+		// No background thread: write directly
+		std::vector<Record> records;
+		records.push_back(std::move(record));
+
+		std::lock_guard<std::mutex> lock(writeMutex);
+		Write(records);
+	}
+}
@@ -1,4 +1,6 @@
 #include "MosDB.h"
+#include "Logger.h"
+#include "TraceEvents.h"
 #include <boost/algorithm/string.hpp>
 #include <boost/algorithm/string_regex.hpp>
 #include <boost/foreach.hpp>
@@ -11,7 +13,7 @@
 #include <boost/numeric/ublas/io.hpp>
 #endif
 
-std::string ToHstore(const std::vector<ParamLevel>& keys, const boost::numeric::ublas::vector<double>& values)
+std::string ToHstore(const Weight::Predictors& keys, const Weight::Values& values)
 {
 	std::stringstream ret;
 
@@ -19,9 +21,9 @@ std::string ToHstore(const std::vector<ParamLevel>& keys, const boost::numeric::
 
 	for (size_t i = 0; i < keys.size(); i++)
 	{
-		std::string key = keys[i].paramName + "/" + keys[i].levelName + "/" +
-		                  boost::lexical_cast<std::string>(keys[i].levelValue) + "/" +
-		                  boost::lexical_cast<std::string>(keys[i].stepAdjustment);
+		const ParamLevel& pl = Predictor(keys[i]);
+		std::string key = pl.paramName + "/" + pl.levelName + "/" + boost::lexical_cast<std::string>(pl.levelValue) +
+		                  "/" + boost::lexical_cast<std::string>(pl.stepAdjustment);
 		ret << key << " => " << values[i] << ",";
 	}
 
@@ -47,7 +49,7 @@ std::string GetEnv(const std::string& key)
 
 MosDB::MosDB() : MosDB(0) {}
 
-MosDB::MosDB(int theId) : NFmiPostgreSQL(theId)
+MosDB::MosDB(int theId) : NFmiPostgreSQL(theId), itsStatements(*this)
 {
 	user_ = "mos_rw";
 	password_ = GetEnv("MOS_MOSRW_PASSWORD");
@@ -65,23 +67,21 @@ MosDB::MosDB(int theId) : NFmiPostgreSQL(theId)
 		throw std::runtime_error("Hostname should be given with env variable 'MOS_HOSTNAME'");
 	}
 
-	std::cout << "MosDB details: " << user_ << "/xxx@" << hostname_ << std::endl;
+	Log(kLogInfo) << "MosDB details: " << user_ << "/xxx@" << hostname_;
 }
 
 MosDB::~MosDB() { Disconnect(); }
-Weights MosDB::GetWeights(const MosInfo& mosInfo, int step)
+std::shared_ptr<const WeightTable> MosDB::GetWeights(const MosInfo& mosInfo, int step)
 {
-	Weights weights;
+	WeightTableBuilder builder;
 
 	std::stringstream query;
 
 	// get period information
 
-	std::string atime = mosInfo.originTime.substr(0, 10);
-
-	int year = boost::lexical_cast<int>(mosInfo.originTime.substr(0, 4));
-	int month = boost::lexical_cast<int>(mosInfo.originTime.substr(5, 2));
-	int day = boost::lexical_cast<int>(mosInfo.originTime.substr(8, 2));
+	const int year = mosInfo.originTime.Year();
+	const int month = mosInfo.originTime.Month();
+	int day = mosInfo.originTime.Day();
 
 	if (month == 2 && day == 29)
 	{
@@ -101,23 +101,26 @@ Weights MosDB::GetWeights(const MosInfo& mosInfo, int step)
 
 	query << "WITH times AS ("
 	      << "SELECT id,CASE "
-	      << "WHEN id = 1 THEN to_date('" << (year - 1) << "-'||start_month||'-'||start_day , 'yyyy-mm-dd') "
-	      << "ELSE to_date('" << year << "-'||start_month||'-'||start_day , 'yyyy-mm-dd') END AS start,"
-	      << "to_date('" << year << "-'||stop_month||'-'||stop_day, 'yyyy-mm-dd') AS stop FROM mos_period "
+	      << "WHEN id = 1 THEN to_date(($1::int - 1)||'-'||start_month||'-'||start_day , 'yyyy-mm-dd') "
+	      << "ELSE to_date($1::int||'-'||start_month||'-'||start_day , 'yyyy-mm-dd') END AS start,"
+	      << "to_date($1::int||'-'||stop_month||'-'||stop_day, 'yyyy-mm-dd') AS stop FROM mos_period "
 	      << "UNION "
 	      << "SELECT id, "
-	      << "to_date('" << year << "-'||start_month||'-'||start_day , 'yyyy-mm-dd'),"
-	      << "to_date('" << (year + 1) << "-'||stop_month||'-'||stop_day, 'yyyy-mm-dd') FROM mos_period WHERE id = 1) "
-	      << "SELECT id FROM times WHERE to_date('" << year << "-" << std::setfill('0') << std::setw(2) << month << "-"
-	      << std::setfill('0') << std::setw(2) << day << "', 'yyyy-mm-dd') BETWEEN start AND stop";
+	      << "to_date($1::int||'-'||start_month||'-'||start_day , 'yyyy-mm-dd'),"
+	      << "to_date(($1::int + 1)||'-'||stop_month||'-'||stop_day, 'yyyy-mm-dd') FROM mos_period WHERE id = 1) "
+	      << "SELECT id FROM times WHERE to_date($2::text, 'yyyy-mm-dd') BETWEEN start AND stop";
+
+	std::stringstream date;
+	date << year << "-" << std::setfill('0') << std::setw(2) << month << "-" << std::setfill('0') << std::setw(2)
+	     << day;
 
-	Query(query.str());
+	itsStatements.Query(query.str(), {std::to_string(year), date.str()});
 
 	auto row = FetchRow();
 
 	if (row.empty())
 	{
-		return weights;
+		return builder.Build(-1, step);
 	}
 
 	query.str("");
@@ -125,7 +128,7 @@ Weights MosDB::GetWeights(const MosInfo& mosInfo, int step)
 	int periodId = boost::lexical_cast<int>(row[0]);
 
 #ifdef EXTRADEBUG
-	std::cout << "Got period id " << periodId << std::endl;
+	Log(kLogInfo) << "Got period id " << periodId;
 #endif
 
 	query << "SELECT "
@@ -138,25 +141,33 @@ Weights MosDB::GetWeights(const MosInfo& mosInfo, int step)
 	      << "s.name, "
 	      << "s.id "
 	      << "FROM mos_weight f, mos_version v, station_network_mapping snm, station s, param p, mos_period pe WHERE "
-	      << "v.label = '" << mosInfo.label << "' AND "
-	      << "p.name = '" << mosInfo.paramName << "' AND "
+	      << "v.label = $1::text AND "
+	      << "p.name = $2::text AND "
 	      << "p.id = f.target_param_id AND "
-	      << "snm.network_id = " << mosInfo.networkId << " AND "
+	      << "snm.network_id = $3::int AND "
 	      << "snm.station_id = s.id AND "
 	      << "f.station_id = s.id AND "
 	      << "f.mos_version_id = v.id AND "
 	      << "pe.id = f.mos_period_id AND "
-	      << "extract(epoch FROM f.forecast_period)/3600 = " << step << " AND "
-	      << "analysis_hour = " << mosInfo.originTime.substr(11, 2) << " AND "
-	      << "pe.id = " << periodId << " ";
+	      << "extract(epoch FROM f.forecast_period)/3600 = $4::int AND "
+	      << "analysis_hour = $5::int AND "
+	      << "pe.id = $6::int ";
+
+	std::vector<std::string> params{mosInfo.label,
+	                                mosInfo.paramName,
+	                                std::to_string(mosInfo.networkId),
+	                                std::to_string(step),
+	                                std::to_string(mosInfo.originTime.Hour()),
+	                                std::to_string(periodId)};
 
 	if (mosInfo.stationId != -1)
 	{
-		query << "AND snm.local_station_id::int IN (" << mosInfo.stationId << ") ";
+		query << "AND snm.local_station_id::int IN ($7::int) ";
+		params.push_back(std::to_string(mosInfo.stationId));
 	}
 	query << "ORDER BY wmo_id, forecast_period, weight_keys";
 
-	Query(query.str());
+	itsStatements.Query(query.str(), params);
 
 	while (true)
 	{
@@ -167,10 +178,11 @@ Weights MosDB::GetWeights(const MosInfo& mosInfo, int step)
 			break;
 		}
 #ifdef EXTRADEBUG
-		for (size_t i = 0; i < row.size(); i++) std::cout << i << " " << row[i] << std::endl;
+		for (size_t i = 0; i < row.size(); i++) Log(kLogDebug) << i << " " << row[i];
 #endif
 
 		std::vector<std::string> weightkeysstr, weightvalsstr;
+		std::vector<double> weightvals;
 
 		boost::trim_if(row[0],
 		               boost::is_any_of("{}"));  // remove {} that come from database as column if of type "array"
@@ -179,12 +191,8 @@ Weights MosDB::GetWeights(const MosInfo& mosInfo, int step)
 		boost::split(weightkeysstr, row[0], boost::is_any_of(","));
 		boost::split(weightvalsstr, row[1], boost::is_any_of(","));
 
-		Weight w;
 		Station s;
 
-		w.weights.resize(weightkeysstr.size(), 0);
-		w.params.resize(weightkeysstr.size());
-
 		assert(weightkeysstr.size() == weightvalsstr.size());
 
 		for (size_t i = 0; i < weightvalsstr.size(); i++)
@@ -192,34 +200,23 @@ Weights MosDB::GetWeights(const MosInfo& mosInfo, int step)
 			double val = boost::lexical_cast<double>(weightvalsstr[i]);
 			assert(val == val);  // no NaN
 
-			w.weights[i] = val;
-
-			std::string key = weightkeysstr[i];
-
-			ParamLevel pl(key);
-
-			w.params[i] = pl;
+			weightvals.push_back(val);
 		}
 
-		w.step = step;
-		// w.startDate = startDate;
-		// w.stopDate = stopDate;
-		w.periodId = periodId;
-
 		s.id = boost::lexical_cast<int>(row[6]);
 		s.wmoId = boost::lexical_cast<int>(row[2]);
 		s.latitude = boost::lexical_cast<double>(row[3]);
 		s.longitude = boost::lexical_cast<double>(row[4]);
 		s.name = row[5];
 
-		assert(w.params.size() == w.weights.size());
-
-		if (!w.params.empty()) weights[s] = w;
+		if (!weightkeysstr.empty()) builder.Add(s, weightkeysstr, weightvals);
 	}
 
+	auto weights = builder.Build(periodId, step);
+
 	if (mosInfo.traceOutput)
 	{
-		std::cout << "Read weights for " << weights.size() << " stations" << std::endl;
+		Log(kLogInfo) << "Read weights for " << weights->Size() << " stations";
 	}
 
 	return weights;
@@ -229,11 +226,7 @@ MosInfo MosDB::GetMosInfo(const std::string& mosLabel)
 {
 	MosInfo mosInfo;
 
-	std::stringstream s;
-
-	s << "SELECT id,label,producer_id FROM mos_version WHERE label = '" << mosLabel << "'";
-
-	Query(s.str());
+	itsStatements.Query("SELECT id,label,producer_id FROM mos_version WHERE label = $1::text", {mosLabel});
 
 	auto row = FetchRow();
 
@@ -251,31 +244,29 @@ MosInfo MosDB::GetMosInfo(const std::string& mosLabel)
 
 void MosDB::WriteTrace(const MosInfo& mosInfo, const Results& results, const std::string& run_time)
 {
-	std::stringstream query;
+	const std::string sql =
+	    "INSERT INTO mos_trace "
+	    "(mos_version_id, mos_period_id, mos_other_period_id, analysis_time, station_id, forecast_period, "
+	    "target_param_id, target_level_id, target_level_value, weights, source_values, value, run_time) "
+	    "SELECT $1::int, $2::int, NULL, to_timestamp($3::text, 'yyyy-mm-dd hh24:mi:ss'), $4::int, "
+	    "$5::int * interval '1 hour', p.id, l.id, 0, $6::hstore, $7::hstore, $8::double precision, "
+	    "to_timestamp($9::text, 'yyyy-mm-dd hh24:mi:ss') "
+	    "FROM param p, level l WHERE p.name = $10::text AND l.name = 'GROUND'";
 
 	BOOST_FOREACH (const auto& it, results)
 	{
 		const auto station = it.first;
 		const auto result = it.second;
 
-		query.str("");
-
-		query << "INSERT INTO mos_trace "
-		      << "(mos_version_id, mos_period_id, mos_other_period_id, analysis_time, station_id, forecast_period, "
-		         "target_param_id, target_level_id, target_level_value, weights, source_values, value, run_time) "
-		      << "SELECT " << mosInfo.id << "," << result.weights.periodId << ","
-		      << "NULL,"
-		      << "to_timestamp('" << mosInfo.originTime << "', 'yyyy-mm-dd hh24:mi:ss')," << station.id << ","
-		      << result.weights.step << " * interval '1 hour',"
-		      << "p.id,"
-		      << "l.id,"
-		      << "0,"
-		      << "'" << ToHstore(result.weights.params, result.weights.weights) << "',"
-		      << "'" << ToHstore(result.weights.params, result.weights.values) << "'," << result.value << ","
-		      << "to_timestamp('" << run_time << "', 'yyyy-mm-dd hh24:mi:ss') "
-		      << " FROM param p, level l WHERE p.name = '" << mosInfo.paramName << "' AND l.name = 'GROUND'";
-
-		Execute(query.str());
+		std::stringstream value;
+		value << result.value;
+
+		itsStatements.Execute(sql, {std::to_string(mosInfo.id), std::to_string(result.weights.periodId),
+		                            mosInfo.originTime.ToString(), std::to_string(station.id),
+		                            std::to_string(result.weights.step),
+		                            ToHstore(result.weights.params, result.weights.weights),
+		                            ToHstore(result.weights.params, result.weights.values), value.str(), run_time,
+		                            mosInfo.paramName});
 	}
 
 	Commit();
@@ -322,6 +313,7 @@ MosDB* MosDBPool::GetConnection()
 	 * 3. Sleep and start over
 	 */
 
+	TraceSpan span("get connection");
 	std::lock_guard<std::mutex> lock(itsGetMutex);
 
 	while (true)
@@ -334,7 +326,7 @@ MosDB* MosDBPool::GetConnection()
 				itsWorkingList[i] = 1;
 
 #ifdef DEBUG
-				std::cout << "DEBUG: Idle mosdb worker returned with id " << itsWorkerList[i]->Id() << std::endl;
+				Log(kLogDebug) << "Idle mosdb worker returned with id " << itsWorkerList[i]->Id();
 #endif
 				return itsWorkerList[i];
 			}
@@ -347,7 +339,7 @@ MosDB* MosDBPool::GetConnection()
 				itsWorkingList[i] = 1;
 
 #ifdef DEBUG
-				std::cout << "DEBUG: New mosdb worker returned with id " << itsWorkerList[i]->Id() << std::endl;
+				Log(kLogDebug) << "New mosdb worker returned with id " << itsWorkerList[i]->Id();
 #endif
 				return itsWorkerList[i];
 			}
@@ -355,7 +347,7 @@ MosDB* MosDBPool::GetConnection()
 
 // All threads active
 #ifdef DEBUG
-		std::cout << "DEBUG: Waiting for worker release" << std::endl;
+		Log(kLogDebug) << "Waiting for worker release";
 #endif
 
 		usleep(100000);  // 100 ms
@@ -370,6 +362,6 @@ void MosDBPool::Release(MosDB* theWorker)
 	itsWorkingList[theWorker->Id()] = 0;
 
 #ifdef DEBUG
-	std::cout << "DEBUG: mosdb worker released for id " << theWorker->Id() << std::endl;
+	Log(kLogDebug) << "mosdb worker released for id " << theWorker->Id();
 #endif
 }
@@ -1,6 +1,11 @@
 #include "MosInterpolator.h"
+#include "Logger.h"
 #include "NFmiGrib.h"
 #include "Options.h"
+#include "RegridTable.h"
+#include "SourceReader.h"
+#include "ThreadPool.h"
+#include "TraceEvents.h"
 #include <NFmiLatLonArea.h>
 #include <NFmiMetTime.h>
 #include <NFmiQueryData.h>
@@ -8,294 +13,486 @@
 #include <NFmiRotatedLatLonArea.h>
 #include <NFmiStreamQueryData.h>
 #include <NFmiTimeList.h>
+#include <mutex>
 
 extern Options opts;
-extern boost::posix_time::ptime ToPtime(const std::string& time, const std::string& timeMask);
 extern std::string GetEnv(const std::string& username);
 
-datas InterpolateToGrid(NFmiFastQueryInfo& sourceInfo, double distanceBetweenGridPointsInDegrees);
-datas ToQueryInfo(const ParamLevel& pl, int step, const std::string& fileName, const std::string& offset,
-                  const std::string& length);
-double Declination(int step, const std::string& originTime);
-FmiInterpolationMethod InterpolationMethod(const std::string& paramName);
+namespace
+{
+// Decode buffers of one batch of messages (a prefetch, or the members of a
+// field), shared by the threads decoding them. Buffers are reused between
+// messages of the batch and freed when the batch ends, so that a worker
+// does not keep memory of its largest field for the rest of the run.
 
-const double PI = 3.14159265359;
+class DecodeBuffers
+{
+public:
+	struct Buffers
+	{
+		std::vector<double> decoded;
+		std::vector<float> values;
+	};
 
-static std::once_flag oflag;
+	std::unique_ptr<Buffers> Acquire()
+	{
+		std::lock_guard<std::mutex> lock(itsMutex);
 
-MosInterpolator::MosInterpolator()
-{
-	call_once(
-	    oflag,
-	    [&]()
-	    {
-		    const auto pw = GetEnv("RADON_RADONCLIENT_PASSWORD");
-		    const auto hostname = GetEnv("RADON_HOSTNAME");
-
-		    if (pw.empty())
-		    {
-			    throw std::runtime_error("Password should be given with env variable 'RADON_RADONCLIENT_PASSWORD'");
-		    }
+		if (itsFree.empty())
+		{
+			return std::unique_ptr<Buffers>(new Buffers());
+		}
 
-		    if (hostname.empty())
-		    {
-			    throw std::runtime_error("Hostname should be given with env variable 'RADON_HOSTNAME'");
-		    }
+		auto ret = std::move(itsFree.back());
+		itsFree.pop_back();
+
+		return ret;
+	}
 
-		    NFmiRadonDBPool::Instance()->Username("radon_client");
-		    NFmiRadonDBPool::Instance()->Password(pw);
-		    NFmiRadonDBPool::Instance()->Database("radon");
-		    NFmiRadonDBPool::Instance()->Hostname(hostname);
-	    });
+	void Release(std::unique_ptr<Buffers> buffers)
+	{
+		std::lock_guard<std::mutex> lock(itsMutex);
+		itsFree.push_back(std::move(buffers));
+	}
 
-	itsRadonDB = std::unique_ptr<NFmiRadonDB>(NFmiRadonDBPool::Instance()->GetConnection());
-}
+private:
+	std::mutex itsMutex;
+	std::vector<std::unique_ptr<Buffers>> itsFree;
+};
 
-MosInterpolator::~MosInterpolator()
+// Buffer is reallocated with exact size only if it is too small; resize
+// alone could leave it up to twice as large as needed
+
+template <typename T>
+void ResizeBuffer(std::vector<T>& buffer, size_t size)
 {
-	// Return connection to pool
-	if (itsRadonDB)
+	if (buffer.capacity() < size)
 	{
-		NFmiRadonDBPool::Instance()->Release(itsRadonDB.get());
+		buffer = std::vector<T>();
+		buffer.reserve(size);
 	}
 
-	// release unique_ptr ownership without calling destructor
-	itsRadonDB.release();
+	buffer.resize(size);
 }
 
-double MosInterpolator::GetValue(const MosInfo& mosInfo, const Station& station, const ParamLevel& pl, int step)
+// Gives buffers back to batch also when decoding fails
+
+class BuffersInUse
 {
-	auto key = Key(pl, step, mosInfo.originTime);
+public:
+	explicit BuffersInUse(DecodeBuffers& buffers) : itsBuffers(buffers), itsInUse(buffers.Acquire()) {}
+	~BuffersInUse() { itsBuffers.Release(std::move(itsInUse)); }
 
-	assert(step >= 0);
+	BuffersInUse(const BuffersInUse&) = delete;
+	BuffersInUse& operator=(const BuffersInUse&) = delete;
+
+	DecodeBuffers::Buffers* operator->() { return itsInUse.get(); }
+
+private:
+	DecodeBuffers& itsBuffers;
+	std::unique_ptr<DecodeBuffers::Buffers> itsInUse;
+};
+}  // namespace
+
+datas InterpolateToGrid(NFmiFastQueryInfo& sourceInfo, double distanceBetweenGridPointsInDegrees);
+datas InterpolateToGridWithTable(NFmiFastQueryInfo& sourceInfo, double distanceBetweenGridPointsInDegrees);
+datas ToQueryInfo(const ParamLevel& pl, int step, NFmiGrib& reader, bool regrid);
+datas ToQueryInfo(const ParamLevel& pl, int step, NFmiGrib& reader, bool regrid, bool regridTable,
+                  DecodeBuffers& buffers);
+FmiInterpolationMethod InterpolationMethod(const ParamLevel& pl);
+
+MosInterpolator::MosInterpolator(const ExecutionPath& path) : itsPath(path), itsCatalog(SourceCatalog::Create())
+{
+}
 
-	// Special cases
+MosInterpolator::~MosInterpolator() = default;
+
+bool MosInterpolator::Regrid() const
+{
+	return !opts.disable0125 && !itsPath.nativeGrid;
+}
 
-	// Declination is not in database
+std::string ExecutionPath::Name() const
+{
+	std::vector<std::string> names;
 
-	if (pl.paramName == "DECLINATION-N")
+	if (stencil)
 	{
-		return Declination(step, mosInfo.originTime);
+		names.push_back("stencil");
 	}
 
-	// Following parameters are not defined for step > 144
-
-	if (step > 144 && (pl.paramName == "FFG3H-MS" || pl.paramName == "TMAX3H-K" || pl.paramName == "TMIN3H-K"))
+	if (nativeGrid)
 	{
-		return kFloatMissing;
+		names.push_back("native-grid");
 	}
 
-	NFmiPoint latlon(station.longitude, station.latitude);
+	if (compact)
+	{
+		names.push_back("compact");
+	}
 
-	// These are cumulative parameters
-	bool isCumulativeParameter =
-	    (pl.paramName == "EVAP-KGM2" || pl.paramName == "RUNOFF-M" || pl.paramName == "SUBRUNOFF-M" ||
-	     pl.paramName == "RRC-KGM2" || pl.paramName == "RRL-KGM2");
+	return names.empty() ? "reference" : boost::algorithm::join(names, ",");
+}
 
-	// These are cumulative radiation parameters
-	bool isCumulativeRadiationParameter =
-	    (pl.paramName == "FLSEN-JM2" || pl.paramName == "FLLAT-JM2" || pl.paramName == "RNETSW-WM2" ||
-	     pl.paramName == "RNETLW-WM2" || pl.paramName == "RADDIRSOLAR-JM2" || pl.paramName == "RADLW-WM2" ||
-	     pl.paramName == "RADGLO-WM2");
+ExecutionPath ExecutionPath::Parse(const std::string& names)
+{
+	ExecutionPath path;
 
-	int prevStep;
+	std::vector<std::string> split;
+	boost::split(split, names, boost::is_any_of(","));
 
-	if (step > 144)
+	for (const auto& name : split)
 	{
-		prevStep = step - 6;
+		if (name.empty() || name == "reference")
+		{
+			continue;
+		}
+		else if (name == "stencil")
+		{
+			path.stencil = true;
+		}
+		else if (name == "native-grid")
+		{
+			path.nativeGrid = true;
+		}
+		else if (name == "compact")
+		{
+			path.compact = true;
+		}
+		else
+		{
+			throw std::runtime_error("Unknown execution path: " + name);
+		}
 	}
-	else if (step > 90)
+
+	return path;
+}
+
+const std::vector<Field>& MosInterpolator::GetField(const MosInfo& mosInfo, const ParamLevel& pl, int step,
+                                                   bool members)
+{
+	assert(step >= 0);
+
+	const auto key = Key(pl, step, mosInfo.originTime);
+
+	// Intentionally not catching exceptions here: if error
+	// occurs, program execution should stop
+
+	if (members)
 	{
-		prevStep = step - 3;
+		// All members of a field are fetched and decoded together
+
+		auto it = itsMemberDatas.find(key);
+
+		if (it == itsMemberDatas.end())
+		{
+			it = itsMemberDatas.emplace(key, GetData(mosInfo, pl, step, true)).first;
+		}
+
+		return it->second;
 	}
-	else
+
+	auto it = itsDatas.find(key);
+
+	if (it == itsDatas.end())
 	{
-		prevStep = step - 1;
+		it = itsDatas.emplace(key, GetData(mosInfo, pl, step, false)).first;
 	}
 
-	if (itsDatas.find(key) == itsDatas.end())
-	{
-		// Intentionally not catching exceptions here: if error
-		// occurs, program execution should stop
+	return it->second;
+}
 
-		itsDatas[Key(pl, step, mosInfo.originTime)] = GetData(mosInfo, pl, step);
+// Compact fields are subtracted as decoded values, and the result encoded
+// again; returns false if the result cannot be encoded within error limit
 
-		if ((isCumulativeParameter || isCumulativeRadiationParameter) && prevStep > 0)
+bool Deaccumulate(const CompactGrid& current, const CompactGrid* previous, double divisor, Field& result)
+{
+	std::vector<float> values = current.Values();
+
+	for (size_t i = 0; i < values.size(); i++)
+	{
+		const float prevValue = previous ? previous->Value(i) : 0;
+
+		if (values[i] == kFloatMissing || prevValue == kFloatMissing)
 		{
-			itsDatas[Key(pl, prevStep, mosInfo.originTime)] = GetData(mosInfo, pl, prevStep);
+			values[i] = kFloatMissing;
+			continue;
 		}
+
+		values[i] = static_cast<float>((values[i] - prevValue) / divisor);
 	}
 
-	double value = kFloatMissing;
+	result.compact = CompactGrid::Encode(current.HPlace(), values, opts.compactMaxError);
 
-	double scale = 1, base = 0;
+	return result.compact != nullptr;
+}
 
-	if (pl.paramName == "POTVORT-N" || pl.paramName == "ABSVO-HZ")
-	{
-		scale = 1000000;
-	}
-	else if (pl.paramName == "SD-M" || pl.paramName == "EVAP-KGM2" || pl.paramName == "RUNOFF-M" ||
-	         pl.paramName == "SUBRUNOFF-M")
+datas Deaccumulate(NFmiFastQueryInfo& current, NFmiFastQueryInfo* previous, double divisor)
+{
+	NFmiFastQueryInfo qi(current.ParamDescriptor(), current.TimeDescriptor(), current.HPlaceDescriptor(),
+	                     current.VPlaceDescriptor());
+
+	auto data = std::shared_ptr<NFmiQueryData>(NFmiQueryDataUtil::CreateEmptyData(qi));
+
+	NFmiFastQueryInfo info(data.get());
+	info.First();
+
+	for (current.ResetLocation(), info.ResetLocation(); info.NextLocation() && current.NextLocation();)
 	{
-		scale = 1000;
+		float value = current.FloatValue();
+		float prevValue = 0;
+
+		if (previous)
+		{
+			previous->LocationIndex(current.LocationIndex());
+			prevValue = previous->FloatValue();
+		}
+
+		if (value == kFloatMissing || prevValue == kFloatMissing)
+		{
+			info.FloatValue(kFloatMissing);
+			continue;
+		}
+
+		info.FloatValue(static_cast<float>((value - prevValue) / divisor));
 	}
-	else if (pl.paramName == "ALBEDO-PRCNT" || pl.paramName == "IC-0TO1" || pl.paramName == "LC-0TO1")
+
+	return std::make_pair(data, info);
+}
+
+const std::vector<Field>* MosInterpolator::GetDeaccumulatedField(const MosInfo& mosInfo, const ParamLevel& pl,
+                                                                 int step, int prevStep, double divisor, bool members)
+{
+	const auto key = Key(pl, step, mosInfo.originTime) + " - " + std::to_string(prevStep) + (members ? " ens" : "");
+
+	auto it = itsDeaccumulatedDatas.find(key);
+
+	if (it != itsDeaccumulatedDatas.end())
 	{
-		scale = 100;
+		return &it->second;
 	}
 
-	for (datas& d : itsDatas[key])
-	{
-		value = d.second.InterpolatedValue(latlon);
-		assert(value == value);
+	// Copies of the cached infos, so that iterating them here does not
+	// interfere with other users
 
-		if (value == kFloatMissing)
-			continue;  // Try another geometry (if exists)
+	std::vector<Field> current = GetField(mosInfo, pl, step, members);
+	std::vector<Field> previous;
 
-		if (isCumulativeParameter || isCumulativeRadiationParameter)
+	// analysis hour value = 0
+	if (prevStep > 0)
+	{
+		previous = GetField(mosInfo, pl, prevStep, members);
+
+		if (previous.size() != current.size())
 		{
-			double prevValue = kFloatMissing;
+			return nullptr;
+		}
 
-			// analysis hour value = 0
-			if (prevStep == 0)
-			{
-				prevValue = 0;
-			}
-			else
+		for (size_t i = 0; i < current.size(); i++)
+		{
+			if (!(current[i].HPlace() == previous[i].HPlace()) || !current[i].compact != !previous[i].compact)
 			{
-				for (datas& d2 : itsDatas[Key(pl, prevStep, mosInfo.originTime)])
-				{
-					prevValue = d2.second.InterpolatedValue(latlon);
-					if (prevValue == kFloatMissing)
-					{
-						continue;
-					}
-					else
-					{
-						break;
-					}
-				}
+				// Fields are in different geometries and cannot be subtracted
+				// grid point by grid point
+				return nullptr;
 			}
+		}
+	}
 
-			assert(prevValue != kFloatMissing);
-
-			if (value != kFloatMissing && prevValue != kFloatMissing)
-			{
-				value -= prevValue;
+	std::vector<Field> ret(current.size());
 
-				if (isCumulativeRadiationParameter)
-				{
-					value /= ((step - prevStep) * 3600);
-				}
-			}
-			else
+	for (size_t i = 0; i < current.size(); i++)
+	{
+		if (current[i].compact)
+		{
+			if (!Deaccumulate(*current[i].compact, previous.empty() ? nullptr : previous[i].compact.get(), divisor,
+			                  ret[i]))
 			{
-				value = kFloatMissing;
+				return nullptr;
 			}
+
+			continue;
 		}
 
-		break;
+		ret[i].data =
+		    Deaccumulate(current[i].data.second, previous.empty() ? nullptr : &previous[i].data.second, divisor);
 	}
 
-	if (value != kFloatMissing)
+	return &itsDeaccumulatedDatas.emplace(key, ret).first->second;
+}
+
+const std::vector<Stencil>& MosInterpolator::GetStencils(const NFmiHPlaceDescriptor& hplace,
+                                                         const std::vector<Station>& stations, size_t stationsHash)
+{
+	for (const auto& cached : itsStencils)
 	{
-		value = value * scale + base;
+		if (cached.stationsHash == stationsHash && cached.hplace == hplace)
+		{
+			return cached.stencils;
+		}
 	}
 
-	return value;
+	std::vector<Stencil> stencils(stations.size());
+
+	ThreadPool::Instance()->ParallelFor(stations.size(), kMinStationChunk,
+	                                    [&](size_t begin, size_t end)
+	                                    {
+		                                    for (size_t s = begin; s < end; s++)
+		                                    {
+			                                    const NFmiPoint latlon(stations[s].longitude, stations[s].latitude);
+			                                    stencils[s] = MakeStencil(hplace.Grid(), latlon);
+		                                    }
+	                                    });
+
+	itsStencils.push_back(StencilCache{hplace, stationsHash, std::move(stencils)});
+
+	return itsStencils.back().stencils;
 }
 
-std::vector<datas> MosInterpolator::GetData(const MosInfo& mosInfo, const ParamLevel& pl, int step)
+double ApplyStencil(Field& field, const Stencil& s)
 {
-	int producerId = mosInfo.producerId;
-	std::string levelName = pl.levelName;
-	std::string paramName = pl.paramName;
+	return field.compact ? ApplyStencil(*field.compact, s) : ApplyStencil(field.data.second, s);
+}
 
-	// Perform parameter transformation, to make sure we get the same data
-	// mos was used to train
+std::vector<double> MosInterpolator::Interpolate(const std::vector<Field>& field, const std::vector<Station>& stations,
+                                                 bool members)
+{
+	if (field.empty())
+	{
+		return std::vector<double>(stations.size(), kFloatMissing);
+	}
 
-	// Radiation is used as power (W/m2)
+	const size_t perStation = members ? field.size() : 1;
 
-	/*	if (paramName == "RNETLW-WM2")
-	        {
-	                producerId = 240;
-	                levelName = "HEIGHT";
-	        }
-	        else
-	        if (paramName == "RADGLO-WM2")
-	        {
-	                producerId = 240;
-	                levelName = "HEIGHT";
-	        }
-	        else if (paramName == "RADLW-WM2")
-	        {
-	                producerId = 240;
-	                levelName = "HEIGHT";
-	        }
-	*/
+	std::vector<double> ret(stations.size() * perStation, kFloatMissing);
 
-	// Note! RR, RRC and RRL *need* to be one hour accumulation (source: J.
-	// Ylhaisi)!
+	// Compact fields can only be interpolated with stencils
 
-	if (paramName == "RR-KGM2")
-	{
-		producerId = 240;
-		levelName = "HEIGHT";
-		paramName = "RRR-KGM2";
-	}
-	else if (paramName == "RRC-KGM2")
-	{
-		producerId = 240;
-		levelName = "HEIGHT";
-		paramName = "RRRC-KGM2";
-	}
-	else if (paramName == "RRL-KGM2")
+	if (members || itsPath.stencil || itsPath.compact)
 	{
-		producerId = 240;
-		levelName = "HEIGHT";
-		paramName = "RRRL-KGM2";
-	}
+		// Station stencils are calculated once per geometry and station set.
+		// Members share the geometry; for deterministic forecast there is a
+		// stencil set for each geometry.
 
-	// Erroneus metadata in neons
+		const size_t stationsHash = Hash(stations);
+		const size_t geometries = members ? 1 : field.size();
 
-	else if (paramName == "TOTCW-KGM2")
-	{
-		paramName = "TCW-KGM2";
-	}
+		std::vector<const std::vector<Stencil>*> stencils;
 
-	// Meansea pressure is at level GROUND in neons (surface (station) pressure is
-	// PGR-PA)
+		for (size_t g = 0; g < geometries; g++)
+		{
+			stencils.push_back(&GetStencils(field[g].HPlace(), stations, stationsHash));
+		}
 
-	else if (paramName == "P-PA" && levelName == "MEANSEA")
-	{
-		levelName = "GROUND";
-	}
+		ThreadPool::Instance()->ParallelFor(
+		    stations.size(), kMinStationChunk,
+		    [&](size_t begin, size_t end)
+		    {
+			    // Applying a stencil moves the location of info
+			    std::vector<Field> chunkInfos = field;
+
+			    for (size_t s = begin; s < end; s++)
+			    {
+				    if (members)
+				    {
+					    for (size_t m = 0; m < chunkInfos.size(); m++)
+					    {
+						    ret[s * perStation + m] = ApplyStencil(chunkInfos[m], (*stencils[0])[s]);
+					    }
+
+					    continue;
+				    }
+
+				    for (size_t g = 0; g < geometries; g++)
+				    {
+					    ret[s] = ApplyStencil(chunkInfos[g], (*stencils[g])[s]);
+
+					    if (ret[s] != kFloatMissing)
+					    {
+						    break;
+					    }
+
+					    // Try another geometry (if exists)
+				    }
+			    }
+		    });
 
-	else if (paramName == "NL-PRCNT")
-	{
-		paramName = "NL-0TO1";
+		return ret;
 	}
 
-	else if (paramName == "NM-PRCNT")
+	// Stations are split to chunks that are interpolated in parallel. Each
+	// chunk has local copies of infos since interpolation changes their state.
+
+	ThreadPool::Instance()->ParallelFor(stations.size(), kMinStationChunk,
+	                                    [&](size_t begin, size_t end)
+	                                    {
+		                                    std::vector<Field> chunkInfos = field;
+
+		                                    for (size_t s = begin; s < end; s++)
+		                                    {
+			                                    const NFmiPoint latlon(stations[s].longitude, stations[s].latitude);
+
+			                                    double value = kFloatMissing;
+
+			                                    for (Field& f : chunkInfos)
+			                                    {
+				                                    value = f.data.second.InterpolatedValue(latlon);
+				                                    assert(value == value);
+
+				                                    if (value != kFloatMissing)
+				                                    {
+					                                    break;
+				                                    }
+
+				                                    // Try another geometry (if exists)
+			                                    }
+
+			                                    ret[s] = value;
+		                                    }
+	                                    });
+
+	return ret;
+}
+
+// Perform parameter transformation, to make sure we get the same data
+// mos was used to train
+
+SourceParam ResolveSource(const MosInfo& mosInfo, const ParamLevel& pl, int step, bool ensemble)
+{
+	SourceParam src;
+
+	src.producerId = ensemble ? mosInfo.ensembleProducerId : mosInfo.producerId;
+	src.levelName = pl.levelName;
+	src.levelValue = pl.levelValue;
+	src.paramName = pl.paramName;
+
+	const ParamInfo& info = *pl.info;
+
+	if (info.sourceName)
 	{
-		paramName = "NM-0TO1";
+		src.paramName = info.sourceName;
 	}
 
-	else if (paramName == "NH-PRCNT")
+	if (info.sourceLevel && (!info.levelCondition || src.levelName == info.levelCondition))
 	{
-		paramName = "NH-0TO1";
+		src.levelName = info.sourceLevel;
 	}
 
-	else if (paramName == "T-MEAN-K")
+	// For ensemble, derived fields (like one hour accumulations) are expected to
+	// be found from the ensemble producer itself; ensemble statistics are read
+	// from their own producer.
+
+	if (info.producerId != -1)
 	{
-		producerId = 134;
+		src.producerId =
+		    (ensemble && !(info.flags & kParamMemberIndependent)) ? mosInfo.ensembleProducerId : info.producerId;
 	}
 
 	if (pl.stepAdjustment < 0)
 	{
 #ifdef DEBUG
-		std::cout << "Param " << pl.paramName << "/" << pl.levelName << "/" << pl.levelValue << " at step " << step
-		          << " has step adjustment " << pl.stepAdjustment << std::endl;
+		Log(kLogDebug) << "Param " << pl.paramName << "/" << pl.levelName << "/" << pl.levelValue << " at step "
+		               << step << " has step adjustment " << pl.stepAdjustment;
 #endif
 
 		if (step < 0)
@@ -303,8 +500,8 @@ std::vector<datas> MosInterpolator::GetData(const MosInfo& mosInfo, const ParamL
 			throw std::runtime_error("Previous timestep data requested for time step 0");
 		}
 
-		// T-MEAN-K only in 3h steps
-		if (step <= 90 && paramName != "T-MEAN-K")
+		// Some parameters (like T-MEAN-K) only in 3h steps
+		if (step <= 90 && !(info.flags & kParamThreeHourly))
 		{
 			step += 1 * pl.stepAdjustment;
 		}
@@ -318,25 +515,20 @@ std::vector<datas> MosInterpolator::GetData(const MosInfo& mosInfo, const ParamL
 		}
 	}
 
-	auto realOrigin = mosInfo.originTime;
+	src.originTime = mosInfo.originTime.ToString();
 
 	if (pl.originTimeAdjustment == -1)
 	{
 #ifdef DEBUG
-		std::cout << "Param " << pl.paramName << "/" << pl.levelName << "/" << pl.levelValue << " at step " << step
-		          << " has origintime adjustment " << pl.originTimeAdjustment << std::endl;
+		Log(kLogDebug) << "Param " << pl.paramName << "/" << pl.levelName << "/" << pl.levelValue << " at step "
+		               << step << " has origintime adjustment " << pl.originTimeAdjustment;
 #endif
-		using namespace boost::posix_time;
-
-		ptime time(time_from_string(mosInfo.originTime));
-		time = time - hours(12);
-
-		realOrigin = ToSQLTime(time);
+		src.originTime = mosInfo.originTime.Shifted(-12).ToString();
 
 		step += 12;
 	}
 
-	if (paramName == "T-MEAN-K" && pl.originTimeAdjustment == -1)
+	if ((info.flags & kParamThreeHourly) && pl.originTimeAdjustment == -1)
 	{
 		int origStep = step;
 
@@ -346,7 +538,7 @@ std::vector<datas> MosInterpolator::GetData(const MosInfo& mosInfo, const ParamL
 		if ((step == 147 || step == 153))
 		{
 			step -= 3;
-			std::cout << "Adjusting T-MEAN-K step from " << origStep << " to " << step << std::endl;
+			Log(kLogInfo) << "Adjusting " << pl.paramName << " step from " << origStep << " to " << step;
 		}
 
 		// T-MEAN-K does not exist for 1h steps; read the closest T-MEAN step instead
@@ -356,98 +548,233 @@ std::vector<datas> MosInterpolator::GetData(const MosInfo& mosInfo, const ParamL
 		else if (step <= 90 + 12)
 		{
 			step -= (step % 3);
-			std::cout << "Adjusting T-MEAN-K step from " << origStep << " to " << step << std::endl;
+			Log(kLogInfo) << "Adjusting " << pl.paramName << " step from " << origStep << " to " << step;
 		}
 	}
-	auto prodInfo = itsRadonDB->GetProducerDefinition(producerId);
 
-	assert(prodInfo.size());
+	src.step = step;
+
+	return src;
+}
 
-	auto gridgeoms = itsRadonDB->GetGridGeoms(prodInfo["ref_prod"], realOrigin);
+// Everything that affects the station values: source data, including the
+// geometry it is found from, and how it is interpolated. Geometry is looked
+// up from catalog, so that values of a geometry that was the only one found
+// at first are not used once a preferred geometry arrives.
 
-	assert(gridgeoms.size());
+std::string MosInterpolator::SampleKey(const MosInfo& mosInfo, const ParamLevel& pl, int step, bool members,
+                                       std::string& originTime)
+{
+	const auto src = ResolveSource(mosInfo, pl, step, members);
 
-	if (gridgeoms.size() > 1)
+	originTime = src.originTime;
+
+	return fmt::format("{}/{}/{}/{}/{}/{}/{}/{}/{}/{}", src.producerId, src.paramName, src.levelName, src.levelValue,
+	                   src.step, members ? "ens" + std::to_string(mosInfo.ensembleSize) : "det",
+	                   Geometry(mosInfo, pl, step, members), itsPath.Name(), Regrid() ? "0125" : "native",
+	                   static_cast<int>(InterpolationMethod(pl)));
+}
+
+std::string MosInterpolator::Geometry(const MosInfo& mosInfo, const ParamLevel& pl, int step, bool members)
+{
+	SourceParam src;
+	std::vector<SourceMessage> messages;
+	std::string error;
+
+	if (!FindMessages(mosInfo, pl, step, members, src, messages, error))
 	{
-		// order so that GLO is first, EUR second
-		std::sort(gridgeoms.begin(), gridgeoms.end(),
-		          [](const std::vector<std::string>& lhs, const std::vector<std::string>& rhs)
-		          {
-			          if (lhs[3].find("ECGLO") != std::string::npos && rhs[3].find("ECGLO") == std::string::npos)
-			          {
-				          return true;
-			          }
-			          if (lhs[3].find("ECEUR") != std::string::npos &&
-			              (rhs[3].find("ECGLO") == std::string::npos && rhs[3].find("ECEUR") == std::string::npos))
-			          {
-				          return true;
-			          }
-			          return false;
-		          });
+		return "";
 	}
 
-	std::vector<datas> ret;
+	return messages[0].geometry;
+}
+
+// Source messages of a field: for deterministic forecast the first geometry
+// found, for ensemble all members in member order. Returns false if the
+// field is not found.
+
+bool MosInterpolator::FindMessages(const MosInfo& mosInfo, const ParamLevel& pl, int step, bool members,
+                                   SourceParam& src, std::vector<SourceMessage>& messages, std::string& error)
+{
+	src = ResolveSource(mosInfo, pl, step, members);
+
+	TraceSpan span("catalog query", src.step, pl.paramName, src.originTime);
 
-	for (const auto& geom : gridgeoms)
+	if (!members)
 	{
-		const std::string tableName = geom[1];
+		SourceMessage message;
+
+		if (!itsCatalog->Find(src, message))
+		{
+			error = "No data found for " + boost::lexical_cast<std::string>(src.producerId) + "/" +
+			        Key(pl, src.step, mosInfo.originTime);
+			return false;
+		}
 
-		std::stringstream query;
+		messages = {message};
+		return true;
+	}
 
-		query << "SELECT param_name, level_name, level_value, extract(epoch from forecast_period) / 3600, "
-		      << "file_location, byte_offset, byte_length "
-		      << "FROM " << tableName << "_v "
-		      << "WHERE param_name = upper('" << paramName << "') "
-		      << "AND level_name = upper('" << levelName << "') "
-		      << "AND level_value = " << pl.levelValue << " "
-		      << "AND extract(epoch from forecast_period) / 3600 = " << step << " AND analysis_time = '" << realOrigin
-		      << "'"
-		      << " AND geometry_id = " << geom[0] << " ORDER BY 4,2,3";
+	const size_t count = static_cast<size_t>(mosInfo.ensembleSize);
 
-		itsRadonDB->Query(query.str());
+	const auto found = itsCatalog->FindMembers(src, count);
 
-		const auto row = itsRadonDB->FetchRow();
+	if (found.empty())
+	{
+		error = "No ensemble data found for " + boost::lexical_cast<std::string>(src.producerId) + "/" +
+		        Key(pl, src.step, mosInfo.originTime);
+		return false;
+	}
 
-		if (row.empty())
+	if (found.size() != count)
+	{
+		error = "Found " + std::to_string(found.size()) + " members for " + Key(pl, src.step, mosInfo.originTime) +
+		        ", expected " + std::to_string(count);
+		return false;
+	}
+
+	messages.assign(count, SourceMessage());
+	std::vector<bool> seen(count, false);
+
+	for (const auto& message : found)
+	{
+		const size_t member = static_cast<size_t>(message.member);
+
+		if (seen[member])
 		{
-			continue;
+			error = "Duplicate ensemble members found for " + Key(pl, src.step, mosInfo.originTime);
+			return false;
 		}
 
-		ret.push_back(ToQueryInfo(pl, step, row[4], row[5], row[6]));
-		break;  // stop on first grid found
+		seen[member] = true;
+		messages[member] = message;
 	}
 
-	if (ret.empty())
+	return true;
+}
+
+std::vector<Field> MosInterpolator::GetData(const MosInfo& mosInfo, const ParamLevel& pl, int step, bool members)
+{
+	SourceParam src;
+	std::vector<SourceMessage> messages;
+	std::string error;
+
+	if (!FindMessages(mosInfo, pl, step, members, src, messages, error))
 	{
-		throw std::runtime_error("No data found for " + boost::lexical_cast<std::string>(producerId) + "/" +
-		                         Key(pl, step, mosInfo.originTime));
+		throw std::runtime_error(error);
 	}
 
+	std::vector<Field> ret(messages.size());
+	DecodeBuffers buffers;
+
+	SourceReader::Read(messages, [&](size_t i, NFmiGrib& reader)
+	                   { ret[i] = MakeField(ToQueryInfo(pl, src.step, reader, Regrid(), itsPath.stencil, buffers)); });
+
 	return ret;
 }
 
-datas ToQueryInfo(const ParamLevel& pl, int step, const std::string& fileName, const std::string& offset,
-                  const std::string& length)
+// With compact cache, query data is dropped if values fit to 16 bits within
+// error limit
+
+Field MosInterpolator::MakeField(datas data) const
 {
-	NFmiGrib reader;
+	Field field;
 
-	if (!reader.Open(fileName))
+	if (itsPath.compact)
 	{
-		std::cerr << "File open failed for " << fileName << std::endl;
-		throw 1;
+		field.compact =
+		    CompactGrid::Encode(data.second.HPlaceDescriptor(), GridValues(data.second), opts.compactMaxError);
+
+		if (field.compact)
+		{
+			return field;
+		}
 	}
 
-	if (offset.empty() && length.empty())
+	field.data = std::move(data);
+
+	return field;
+}
+
+void MosInterpolator::Prefetch(const MosInfo& mosInfo, const std::vector<FieldRequest>& requests)
+{
+	// Fields are read here in file and offset order, and then found from
+	// cache when predictors are evaluated. Fields that are not found are
+	// skipped; GetField reports them when they are needed.
+
+	struct Target
 	{
-		std::cout << "Reading file '" << fileName << "' (" << pl << ")" << std::endl;
-		reader.NextMessage();
-	}
-	else
+		std::vector<Field>* field;
+		size_t index;
+		const ParamLevel* pl;
+		int step;
+	};
+
+	std::map<std::string, std::vector<Field>> fields, memberFields;
+	std::vector<SourceMessage> messages;
+	std::vector<Target> targets;
+
+	for (const auto& r : requests)
 	{
-		std::cout << "Reading file '" << fileName << "' " << offset << ":" << length << " (" << pl << ")" << std::endl;
-		reader.ReadMessage(std::stol(offset), std::stol(length));
+		const auto key = Key(r.pl, r.step, mosInfo.originTime);
+
+		auto& cache = r.members ? itsMemberDatas : itsDatas;
+		auto& staged = r.members ? memberFields : fields;
+
+		if (cache.count(key) || staged.count(key))
+		{
+			continue;
+		}
+
+		SourceParam src;
+		std::vector<SourceMessage> found;
+		std::string error;
+
+		if (!FindMessages(mosInfo, r.pl, r.step, r.members, src, found, error))
+		{
+			continue;
+		}
+
+		auto& field = staged[key];
+		field.resize(found.size());
+
+		for (size_t i = 0; i < found.size(); i++)
+		{
+			messages.push_back(found[i]);
+			targets.push_back(Target{&field, i, &r.pl, src.step});
+		}
 	}
 
+	DecodeBuffers buffers;
+
+	SourceReader::Read(messages,
+	                   [&](size_t i, NFmiGrib& reader)
+	                   {
+		                   const Target& t = targets[i];
+		                   (*t.field)[t.index] = MakeField(ToQueryInfo(*t.pl, t.step, reader, Regrid(), itsPath.stencil, buffers));
+	                   });
+
+	itsDatas.insert(fields.begin(), fields.end());
+	itsMemberDatas.insert(memberFields.begin(), memberFields.end());
+}
+
+// Single message with buffers of its own
+
+datas ToQueryInfo(const ParamLevel& pl, int step, NFmiGrib& reader, bool regrid)
+{
+	DecodeBuffers buffers;
+	return ToQueryInfo(pl, step, reader, regrid, false, buffers);
+}
+
+// Grib message to query data; if regrid is set, data is interpolated to
+// 0.125 degree grid like mos was trained with, with a cached regrid table
+// if regridTable is set
+
+datas ToQueryInfo(const ParamLevel& pl, int step, NFmiGrib& reader, bool regrid, bool regridTable,
+                  DecodeBuffers& buffers)
+{
+	TraceSpan span("decode", step, pl.paramName);
+
 	long dataDate = reader.Message().DataDate();
 	long dataTime = reader.Message().DataTime();
 
@@ -459,7 +786,7 @@ datas ToQueryInfo(const ParamLevel& pl, int step, const std::string& fileName, c
 
 	NFmiParamBag pbag;
 	NFmiParam p(1, pl.paramName);
-	p.InterpolationMethod(InterpolationMethod(pl.paramName));
+	p.InterpolationMethod(InterpolationMethod(pl));
 
 	pbag.Add(NFmiDataIdent(p));
 
@@ -500,31 +827,43 @@ datas ToQueryInfo(const ParamLevel& pl, int step, const std::string& fileName, c
 	bl.Y(fy);
 	tr.Y(ly);
 
-	size_t len = ni * nj;
-	double* ddata = new double[len];
-	reader.Message().GetValues(ddata, &len);
+	const size_t width = static_cast<size_t>(ni);
+	const size_t height = static_cast<size_t>(nj);
+
+	size_t len = width * height;
 
-	assert(len == static_cast<size_t>(ni * nj));
+	BuffersInUse inUse(buffers);
+
+	auto& decoded = inUse->decoded;
+	ResizeBuffer(decoded, len);
+	reader.Message().GetValues(decoded.data(), &len);
+
+	if (len != width * height)
+	{
+		throw std::runtime_error("Grib message has " + std::to_string(len) + " values, expected " +
+		                         std::to_string(width * height));
+	}
 
 	if (!jpos)
 	{
 		bl.Y(ly);
 		tr.Y(fy);
+	}
 
-		size_t halfSize = static_cast<size_t>(floor(static_cast<double>(nj) / 2));
+	// Values in query data order (first row is the southernmost), converted
+	// to float in the same pass
 
-		for (size_t y = 0; y < halfSize; y++)
-		{
-			for (size_t x = 0; x < static_cast<size_t>(ni); x++)
-			{
-				size_t ui = y * ni + x;
-				size_t li = (nj - 1 - y) * ni + x;
-				double upper = ddata[ui];
-				double lower = ddata[li];
+	auto& values = inUse->values;
+	ResizeBuffer(values, len);
 
-				ddata[ui] = lower;
-				ddata[li] = upper;
-			}
+	for (size_t y = 0; y < height; y++)
+	{
+		const double* src = decoded.data() + (jpos ? y : height - 1 - y) * width;
+		float* dst = values.data() + y * width;
+
+		for (size_t x = 0; x < width; x++)
+		{
+			dst[x] = static_cast<float>(src[x]);
 		}
 	}
 
@@ -542,7 +881,7 @@ datas ToQueryInfo(const ParamLevel& pl, int step, const std::string& fileName, c
 		area = new NFmiRotatedLatLonArea(bl, tr, NFmiPoint(spx, spy), NFmiPoint(0, 0), NFmiPoint(1, 1), true);
 	}
 
-	NFmiGrid grid(area, ni, nj, kBottomLeft, InterpolationMethod(pl.paramName));
+	NFmiGrid grid(area, ni, nj, kBottomLeft, InterpolationMethod(pl));
 
 	NFmiHPlaceDescriptor hdesc(grid);
 
@@ -553,24 +892,22 @@ datas ToQueryInfo(const ParamLevel& pl, int step, const std::string& fileName, c
 	NFmiFastQueryInfo info(data.get());
 	info.First();
 
-	int num = 0;
-	for (info.ResetLocation(); info.NextLocation(); ++num)
+	if (!info.SetValues(values))
 	{
-		info.FloatValue(static_cast<float>(ddata[num]));
+		throw std::runtime_error("Unable to set values of " + pl.paramName);
 	}
 
 	delete area;
-	delete[] ddata;
 
 	double dx = reader.Message().iDirectionIncrement();
 	double dy = reader.Message().jDirectionIncrement();
 
 	const double wantedGridResolution = 0.125;
 
-	if (wantedGridResolution < dx)
+	if (regrid && wantedGridResolution < dx)
 	{
-		std::cout << "Will not interpolate to a finer grid (" << wantedGridResolution << ") than the source data ("
-		          << dx << ")" << std::endl;
+		Log(kLogInfo) << "Will not interpolate to a finer grid (" << wantedGridResolution << ") than the source data ("
+		              << dx << ")";
 		return std::make_pair(data, info);
 	}
 
@@ -582,12 +919,14 @@ datas ToQueryInfo(const ParamLevel& pl, int step, const std::string& fileName, c
 	                            data.get()));
 #endif
 
-	if (opts.disable0125 == false && (dx != wantedGridResolution || dy != wantedGridResolution))
+	if (regrid && (dx != wantedGridResolution || dy != wantedGridResolution))
 	{
 #ifdef DEBUG
-		std::cout << "Interpolating " << pl << " to " << wantedGridResolution << " degree grid" << std::endl;
+		Log(kLogDebug) << "Interpolating " << pl << " to " << wantedGridResolution << " degree grid";
 #endif
-		auto ret = InterpolateToGrid(info, wantedGridResolution);
+		TraceSpan regridSpan("regrid", step, pl.paramName);
+		auto ret = regridTable ? InterpolateToGridWithTable(info, wantedGridResolution)
+		                       : InterpolateToGrid(info, wantedGridResolution);
 
 #ifdef EXTRADEBUG
 		assert(streamData.WriteData(pl.paramName + "_" + pl.levelName + "_" +
@@ -599,12 +938,16 @@ datas ToQueryInfo(const ParamLevel& pl, int step, const std::string& fileName, c
 		return ret;
 	}
 
-	assert(dx <= wantedGridResolution);
-	assert(dy <= wantedGridResolution);
+	// Without regrid, source grid can be of any resolution
+	assert(!regrid || dx <= wantedGridResolution);
+	assert(!regrid || dy <= wantedGridResolution);
 
 	return std::make_pair(data, info);
 }
 
+// Reference regrid, with NFmiFastQueryInfo::InterpolatedValue at each
+// target point
+
 datas InterpolateToGrid(NFmiFastQueryInfo& sourceInfo, double distanceBetweenGridPointsInDegrees)
 {
 	auto bl = sourceInfo.Area()->BottomLeftLatLon();
@@ -636,56 +979,36 @@ datas InterpolateToGrid(NFmiFastQueryInfo& sourceInfo, double distanceBetweenGri
 	return std::make_pair(data, info);
 }
 
-double Declination(int step, const std::string& originTime)
-{
-	auto orig = ToPtime(originTime, "%Y-%m-%d %H:%M:00");
-	orig += boost::posix_time::seconds(3600 * step);
-
-	tm orig_tm = to_tm(orig);
+// With --fast-path stencil: target grid and source points of each target
+// point come from a table that is shared by all fields of the same
+// geometry. Missing source points are left out like in ApplyStencil.
 
-	// Formula from Jussi Ylhaisi
-
-	const int hour_of_day = orig_tm.tm_hour;
+datas InterpolateToGridWithTable(NFmiFastQueryInfo& sourceInfo, double distanceBetweenGridPointsInDegrees)
+{
+	const auto table = RegridTable::Get(sourceInfo, distanceBetweenGridPointsInDegrees);
 
-	// Sekä deklinaation että länpötilan vuosisyklin jaksonaika on tasan yksi
-	// vuosi, mutta näillä
-	// aalloilla on vaihe-ero: Lämpötilan vuosisykli on hieman perässä. Esim.
-	// aurinko on on korkeimmillaan
-	// juhannuksena kesäkuun lopulla, mutta silti heinäkuu on ilmastollisesti
-	// lämpimin kuukausi.
-	// Keskimääräiseksi vaihe-eroksi talvi-kesäkausilla tulee kuitenkin n. 32
-	// päivää, tällä saadaan aallot synkkaan.
-	// Tämä on ihan ok oletus kaikkina vuorokaudenaikoina
+	NFmiFastQueryInfo qi(sourceInfo.ParamDescriptor(), sourceInfo.TimeDescriptor(), table->Target(),
+	                     sourceInfo.VPlaceDescriptor());
 
-	double daydoy = orig_tm.tm_yday + hour_of_day / 24. - 32.;
+	auto data = std::shared_ptr<NFmiQueryData>(NFmiQueryDataUtil::CreateEmptyData(qi));
 
-	if (daydoy < 0)
-		daydoy += 365.;
+	NFmiFastQueryInfo info(data.get());
+	info.First();
 
-	// 1) Lasketaan auringon deklinaatio (maan akselin ja maan kiertorataa
-	// kohtisuoran viivan välinen kulma)
+	const std::vector<float> source = sourceInfo.Values();
+	std::vector<float> values(table->Size());
 
-	// Tässä daydoy on vuoden päivämäärä 0...365/366 vuoden alusta lukien. Tunnit
-	// luetaan tähän mukaan,
-	// eli esim. ajanhetkelle 2.1. klo 15 daydoy=1.625. Huom. päivä ei siis ala
-	// indeksistä 1, vaan 0!
-	// Ylläolevat laskut antavat ulos asteina deklinaation.
+	table->Apply(source.data(), values.data());
 
-	const double declination = -asin(0.39779 * cos(0.98565 / 360 * 2 * PI * (daydoy + 10) +
-	                                               1.914 / 360 * 2 * PI * sin(0.98565 / 360 * 2 * PI * (daydoy - 2)))) *
-	                           360 / 2 / PI;
+	if (!info.SetValues(values))
+	{
+		throw std::runtime_error("Unable to set regridded values");
+	}
 
-	return declination;
+	return std::make_pair(data, info);
 }
 
-FmiInterpolationMethod InterpolationMethod(const std::string& paramName)
+FmiInterpolationMethod InterpolationMethod(const ParamLevel& pl)
 {
-	FmiInterpolationMethod method = kLinearly;
-
-	if (paramName == "RR-KGM2" || paramName == "RRL-KGM2" || paramName == "RRC-KGM2")
-	{
-		method = kNearestPoint;
-	}
-
-	return method;
+	return (pl.info->flags & kParamNearestPoint) ? kNearestPoint : kLinearly;
 }
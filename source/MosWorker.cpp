@@ -2,17 +2,29 @@
 #include <fstream>
 #include <sstream>
 
+#include "AllocationStats.h"
+#include "Capture.h"
+#include "Logger.h"
+#include "Options.h"
 #include "Result.h"
-#include <boost/numeric/ublas/matrix.hpp>
-#include <boost/numeric/ublas/vector.hpp>
+#include "ThreadPool.h"
+#include "TraceEvents.h"
+#include "Verification.h"
+#include "WeightTable.h"
+#include <chrono>
+#include <numeric>
 
 #ifdef DEBUG
 #include <boost/numeric/ublas/io.hpp>
 #endif
 
-extern std::map<int, std::map<std::string, Weights>> allWeights;
+extern WeightStore allWeights;
+extern Options opts;
 boost::posix_time::ptime ToPtime(const std::string& time, const std::string& timeMask);
 
+// Formatted rows are written to file in pieces of about this size
+const size_t kWriteBufferSize = 1 << 16;
+
 std::string ToSQLInterval(int step)
 {
 	char ret[11];
@@ -38,6 +50,34 @@ std::string ToString(boost::posix_time::ptime p, const std::string& timeMask)
 	return s.str();
 }
 
+// Missing predictor values are reported for many stations at a time, so
+// they are rate limited per predictor
+
+void LogMissingValue(const MosInfo& mosInfo, const Station& station, const ParamLevel& pl, int step,
+                     const std::string& action)
+{
+	const std::string what = "Missing value for " + Key(pl, step, mosInfo.originTime) + ", " + action;
+
+	Log(kLogWarning, what) << "Missing value for station " << station.id << " " << station.name << " "
+	                       << Key(pl, step, mosInfo.originTime) << ", " << action;
+}
+
+// Quantile with linear interpolation between closest ranks; values must be
+// sorted
+
+double Quantile(const std::vector<double>& values, double q)
+{
+	assert(!values.empty());
+	assert(q >= 0 && q <= 1);
+	assert(std::is_sorted(values.begin(), values.end()));
+
+	const double h = q * static_cast<double>(values.size() - 1);
+	const size_t lo = static_cast<size_t>(std::floor(h));
+	const size_t hi = std::min(lo + 1, values.size() - 1);
+
+	return values[lo] + (h - static_cast<double>(lo)) * (values[hi] - values[lo]);
+}
+
 boost::posix_time::ptime ToPtime(const std::string& time, const std::string& timeMask)
 {
 	std::stringstream s(time);
@@ -57,8 +97,10 @@ boost::posix_time::ptime ToPtime(const std::string& time, const std::string& tim
 	return p;
 }
 
-void MosWorker::Write(const MosInfo& mosInfo, const Results& results)
+void MosWorker::Write(const MosInfo& mosInfo, int step, const Results& results)
 {
+	TraceSpan span("write", step, mosInfo.paramName, mosInfo.label);
+
 	// Current time
 
 	const boost::posix_time::ptime now = boost::posix_time::second_clock::local_time();
@@ -66,39 +108,31 @@ void MosWorker::Write(const MosInfo& mosInfo, const Results& results)
 
 	// leadtime
 
-	if (results.empty())
+	// A shard writes its part even if it has no stations, so that merging
+	// can check that all parts are there
+
+	if (results.empty() && opts.shardCount == 0)
 	{
-		std::cerr << "No results to write" << std::endl;
+		Log(kLogWarning) << "No results to write";
 		return;
 	}
 
 	std::ofstream outfile;
 	std::stringstream fileName;
-	fileName << "mos_" << mosInfo.paramName << "_" << std::setw(3) << std::setfill('0') << results.begin()->second.step
-	         << ".txt";
+	fileName << "mos_" << (mosInfo.outputTag.empty() ? "" : mosInfo.outputTag + "_") << mosInfo.paramName << "_" << std::setw(3) << std::setfill('0') << step;
+
+	if (opts.shardCount > 0)
+	{
+		fileName << ".part" << mosInfo.stationGroup + 1 << "of" << mosInfo.stationGroups;
+	}
+
+	fileName << ".txt";
 
 	outfile.open(fileName.str());
 
-	int paramId;
+	const int paramId = ParamRegistry::Get(mosInfo.paramName).outputParamId;
 
-	// this could be replaced with a database lookup
-	if (mosInfo.paramName == "T-K")
-	{
-		paramId = 153;
-	}
-	else if (mosInfo.paramName == "TMAX12H-K")
-	{
-		paramId = 738;
-	}
-	else if (mosInfo.paramName == "TMIN12H-K")
-	{
-		paramId = 739;
-	}
-	else if (mosInfo.paramName == "TD-K")
-	{
-		paramId = 162;
-	}
-	else
+	if (paramId == -1)
 	{
 		throw std::runtime_error("Unable to find id for parameter: " + mosInfo.paramName);
 	}
@@ -111,29 +145,67 @@ void MosWorker::Write(const MosInfo& mosInfo, const Results& results)
 	           "forecast_type_id,forecast_type_value,value"
 	        << std::endl;
 
+	// Rows are formatted to one reused buffer in task arena; {:g} gives the
+	// same output as default stream formatting
+
+	typedef fmt::basic_memory_buffer<char, fmt::inline_buffer_size, boost::container::pmr::polymorphic_allocator<char>>
+	    Buffer;
+
+	Buffer rows(itsArena.Resource()), prefix(itsArena.Resource());
+
 	for (const auto& it : results)
 	{
-		const auto station = it.first;
-		const auto result = it.second;
+		const auto& station = it.first;
+		const auto& result = it.second;
 
-		boost::posix_time::ptime originTime = ToPtime(mosInfo.originTime, "%Y-%m-%d %H:%M:00");
+		prefix.clear();
+		fmt::format_to(std::back_inserter(prefix), "{},{},{},{},{},{:g},-1,{},", mosInfo.producerId,
+		               mosInfo.originTime.ToString(), station.wmoId, paramId, levelId, levelValue,
+		               ToSQLInterval(result.step));
 
-		outfile << mosInfo.producerId << "," << ToString(originTime, "%Y-%m-%d %H:%M:%S") << "," << station.wmoId << ","
-		        << paramId << "," << levelId << "," << levelValue << ",-1," << ToSQLInterval(result.step) << ",1,-1,"
-		        << result.value << std::endl;
+		const fmt::string_view prefixView(prefix.data(), prefix.size());
+
+		if (result.memberValues.empty())
+		{
+			fmt::format_to(std::back_inserter(rows), "{}1,-1,{:g}\n", prefixView, result.value);
+		}
+
+		// forecast types: 3 = control, 4 = perturbed member, 5 = statistical processing (quantile, value in percent)
+
+		for (size_t i = 0; i < result.memberValues.size(); i++)
+		{
+			fmt::format_to(std::back_inserter(rows), "{}{},{},{:g}\n", prefixView, (i == 0 ? 3 : 4), i,
+			               result.memberValues[i]);
+		}
+
+		for (size_t i = 0; i < result.quantileValues.size(); i++)
+		{
+			fmt::format_to(std::back_inserter(rows), "{}5,{:g},{:g}\n", prefixView, mosInfo.quantiles[i] * 100,
+			               result.quantileValues[i]);
+		}
+
+		if (rows.size() > kWriteBufferSize)
+		{
+			outfile.write(rows.data(), static_cast<std::streamsize>(rows.size()));
+			rows.clear();
+		}
 	}
 
+	outfile.write(rows.data(), static_cast<std::streamsize>(rows.size()));
+	outfile.flush();
+
 	if (mosInfo.traceOutput)
 	{
-		std::cout << "Writing trace" << std::endl;
+		Log(kLogInfo) << "Writing trace for " << mosInfo.label;
 		itsMosDB->WriteTrace(mosInfo, results, nowstr);
 	}
 
 	outfile.close();
-	std::cout << "Wrote file '" << fileName.str() << "'" << std::endl;
+	Log(kLogInfo) << "Wrote file '" << fileName.str() << "'";
 }
 
 MosWorker::MosWorker()
+    : itsMosInterpolator(ExecutionPath::Parse(opts.fastPath)), itsDerivedPredictors(itsMosInterpolator)
 {
 	if (allWeights.empty())
 	{
@@ -148,109 +220,415 @@ MosWorker::~MosWorker()
 	}
 }
 
-bool MosWorker::Mosh(const MosInfo& mosInfo, int step)
+void MosWorker::GatherMemberValues(const MosInfo& mosInfo, const Station& station, int step, const ParamLevel& pl,
+                                   const double* source, size_t members, double& weight, double* memberValues,
+                                   double& value)
 {
-	Weights weights;
+	std::copy(source, source + members, memberValues);
 
-	// 1. Get weights
+	// Weights are shared by all members: if a predictor is missing from any
+	// member, it is dropped from all of them
+
+	const bool anyMissing = std::find(memberValues, memberValues + members, kFloatMissing) != memberValues + members;
+
+	if (anyMissing && weight != 0)
+	{
+		if (pl.info->flags & kParamFillMissing)
+		{
+			std::replace(memberValues, memberValues + members, static_cast<double>(kFloatMissing), pl.info->fillValue);
+			LogMissingValue(mosInfo, station, pl, step, fmt::format("setting value to {}", pl.info->fillValue));
+		}
+		else
+		{
+			weight = 0;
+			LogMissingValue(mosInfo, station, pl, step, "setting weight to zero");
+		}
+	}
+
+	// trace output shows the control forecast
+	value = memberValues[0];
+}
+
+std::shared_ptr<const WeightTable> TaskWeights(const MosInfo& mosInfo, int step, MosDB* db)
+{
+	std::shared_ptr<const WeightTable> table;
 
 	if (allWeights.empty())
 	{
-		std::cout << "Fetching weights from MOS database" << std::endl;
-		weights = itsMosDB->GetWeights(mosInfo, step);
+		Log(kLogInfo) << "Fetching weights from MOS database";
+		TraceSpan fetch("fetch weights", step, mosInfo.paramName, mosInfo.label);
+		table = db->GetWeights(mosInfo, step);
 	}
 	else
 	{
 		try
 		{
-			weights = allWeights.at(step).at(mosInfo.paramName);
+			table = allWeights.at(mosInfo.label).at(step).at(mosInfo.paramName);
 		}
 		catch (const std::exception& e)
 		{
 		}
 	}
 
-	if (weights.empty())
+	if (table && Capture::Instance()->Enabled())
 	{
-		std::cerr << "No weights for analysis time " << mosInfo.originTime << " step " << step << std::endl;
-		return false;
+		Capture::Instance()->RecordWeights(mosInfo, step, *table);
 	}
 
-	// 2. Get raw forecasts
+	return table;
+}
 
-	std::cout << "Fetching source data for step " << step << std::endl;
+// Releases the task arena when task ends, and collects the number of heap
+// allocations the task made in worker thread
 
-	for (auto& it : weights)
+class TaskScope
+{
+public:
+	explicit TaskScope(TaskArena& arena) : itsArena(arena), itsStart(ThreadAllocations()) {}
+	~TaskScope()
 	{
-		Station station = it.first;
-#ifdef DEBUG
-		if (mosInfo.traceOutput)
+		AddTaskAllocations(ThreadAllocations() - itsStart);
+		itsArena.Release();
+	}
+
+	TaskScope(const TaskScope&) = delete;
+	TaskScope& operator=(const TaskScope&) = delete;
+
+private:
+	TaskArena& itsArena;
+	const uint64_t itsStart;
+};
+
+bool MosWorker::Mosh(const MosInfo& mosInfo, int step)
+{
+	// Declared first so that everything allocated from arena is gone before
+	// it is released
+	TaskScope scope(itsArena);
+
+	TraceSpan span("mosh", step, mosInfo.paramName, mosInfo.label);
+
+	// 1. Get weights
+
+	auto table = TaskWeights(mosInfo, step, itsMosDB.get());
+
+	if (!table || table->Empty())
+	{
+		Log(kLogWarning) << "No weights for " << mosInfo.label << " analysis time " << mosInfo.originTime << " step "
+		                 << step;
+		return false;
+	}
+
+	if (mosInfo.stationGroups > 1)
+	{
+		const size_t size = table->Size();
+		const size_t groups = static_cast<size_t>(mosInfo.stationGroups);
+		const size_t group = static_cast<size_t>(mosInfo.stationGroup);
+
+		table = table->Slice(group * size / groups, (group + 1) * size / groups);
+
+		Log(kLogInfo) << "Station group " << group + 1 << "/" << groups << " has " << table->Size() << " stations";
+
+		if (table->Empty())
 		{
-			std::cout << station.id << " " << station.name << " " << it.second.params.size() << " weights" << std::endl;
+			Write(mosInfo, step, Results(itsArena.Resource()));
+			return true;
 		}
-#endif
+	}
 
-		it.second.values.resize(it.second.weights.size(), 0);
+	// 2. Get raw forecasts and apply weights
 
-		for (size_t i = 0; i < it.second.params.size(); i++)
-		{
-			ParamLevel pl = it.second.params[i];
+	if (!opts.verify)
+	{
+		Write(mosInfo, step, Apply(mosInfo, step, *table, itsDerivedPredictors).results);
+		return true;
+	}
 
-			double value = kFloatMissing;
+	// Same task with both paths; reference results are written
 
-			if (pl.paramName == "INTERCEPT-N")
-			{
-				value = 1;
-			}
-			else
-			{
-				value = itsMosInterpolator.GetValue(mosInfo, station, pl, step);
-			}
+	if (!itsReferenceInterpolator)
+	{
+		itsReferenceInterpolator = std::unique_ptr<MosInterpolator>(new MosInterpolator());
+		itsReferencePredictors =
+		    std::unique_ptr<DerivedPredictors>(new DerivedPredictors(*itsReferenceInterpolator));
+	}
+
+	auto Timed = [&](DerivedPredictors& predictors, double& seconds)
+	{
+		const auto start = std::chrono::steady_clock::now();
+		TaskValues values = Apply(mosInfo, step, *table, predictors);
+		seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		return values;
+	};
+
+	// Paths take turns to run first, since the one run second finds source
+	// files in page cache
+
+	itsReferenceFirst = !itsReferenceFirst;
+
+	double referenceSeconds = 0, candidateSeconds = 0;
+
+	const TaskValues first = itsReferenceFirst ? Timed(*itsReferencePredictors, referenceSeconds)
+	                                           : Timed(itsDerivedPredictors, candidateSeconds);
+	const TaskValues second = itsReferenceFirst ? Timed(itsDerivedPredictors, candidateSeconds)
+	                                            : Timed(*itsReferencePredictors, referenceSeconds);
+
+	const TaskValues& reference = itsReferenceFirst ? first : second;
+	const TaskValues& candidate = itsReferenceFirst ? second : first;
+
+	Verification::Instance()->Compare(mosInfo, step, *table, reference, candidate, referenceSeconds,
+	                                  candidateSeconds);
+
+	// 3. Write to file
+
+	Write(mosInfo, step, reference.results);
+
+	return true;
+}
+
+// Predictors that have non-zero weight at some station, per predictor set.
+// With trace output all predictors are needed, since values of all of them
+// are written.
+
+std::vector<std::vector<bool>> NeededPredictors(const MosInfo& mosInfo, const WeightTable& table)
+{
+	const auto& predictorSets = table.PredictorSets();
+	const auto& weights = table.Weights();
+
+	std::vector<std::vector<bool>> needed;
+
+	for (const auto& set : predictorSets)
+	{
+		needed.push_back(std::vector<bool>(set.size(), mosInfo.traceOutput));
+	}
+
+	if (mosInfo.traceOutput)
+	{
+		return needed;
+	}
 
-			if (value == kFloatMissing && it.second.weights[i] != 0)
+	for (size_t index = 0; index < table.Size(); index++)
+	{
+		auto& setNeeded = needed[table.PredictorSet(index)];
+		const size_t offset = table.Offset(index);
+
+		for (size_t i = 0; i < setNeeded.size(); i++)
+		{
+			if (weights[offset + i] != 0)
 			{
-				if (pl.paramName == "CLDBASE-M")
-				{
-					it.second.values[i] = 20000;  // Number comes from J. Ylhaisi
-					std::cout << "Missing value for station " << station.id << " " << station.name << " "
-					          << Key(pl, step, mosInfo.originTime) << ", setting value to 20000" << std::endl;
-				}
-				else
-				{
-					it.second.weights[i] = 0;
-					std::cout << "Missing value for station " << station.id << " " << station.name << " "
-					          << Key(pl, step, mosInfo.originTime) << ", setting weight to zero" << std::endl;
-				}
+				setNeeded[i] = true;
 			}
-			else
+		}
+	}
+
+	size_t total = 0, skipped = 0;
+
+	for (const auto& setNeeded : needed)
+	{
+		total += setNeeded.size();
+		skipped += static_cast<size_t>(std::count(setNeeded.begin(), setNeeded.end(), false));
+	}
+
+	if (skipped > 0)
+	{
+		Log(kLogInfo) << "Skipping " << skipped << " of " << total
+		              << " predictors that have zero weight at all stations";
+	}
+
+	return needed;
+}
+
+TaskValues MosWorker::Apply(const MosInfo& mosInfo, int step, const WeightTable& table,
+                            DerivedPredictors& derivedPredictors)
+{
+	const bool ensemble = mosInfo.ensembleSize > 0;
+
+	Log(kLogInfo) << "Fetching source data for step " << step;
+
+	// Predictors are evaluated for all stations at once, and before stations
+	// are split to threads
+
+	const auto& stations = table.Stations();
+
+	derivedPredictors.Begin(stations, step);
+
+	const auto& predictorSets = table.PredictorSets();
+	const auto needed = NeededPredictors(mosInfo, table);
+
+	// Source data of all needed predictors is read at once, in file order.
+	// Prefetch adds the fields that predictors depend on, like the previous
+	// step of cumulative parameters.
+
+	std::vector<ParamLevel> prefetched;
+
+	for (size_t i = 0; i < predictorSets.size(); i++)
+	{
+		for (size_t j = 0; j < predictorSets[i].size(); j++)
+		{
+			if (needed[i][j])
 			{
-				it.second.values[i] = value;
+				prefetched.push_back(predictorSets[i][j]);
 			}
 		}
 	}
 
-	// 3. Apply
+	derivedPredictors.Prefetch(mosInfo, prefetched);
 
-	std::cout << "Applying weights" << std::endl;
+	// Values of predictors that are not needed are null
 
-	Results results;
+	std::vector<std::vector<const std::vector<double>*>> predictorValues(predictorSets.size());
 
-	for (const auto& it : weights)
+	for (size_t i = 0; i < predictorSets.size(); i++)
 	{
-		Station station = it.first;
+		for (size_t j = 0; j < predictorSets[i].size(); j++)
+		{
+			predictorValues[i].push_back(needed[i][j] ? &derivedPredictors.Evaluate(mosInfo, predictorSets[i][j])
+			                                          : nullptr);
+		}
+	}
 
-		Result r;
+	const size_t members = ensemble ? static_cast<size_t>(mosInfo.ensembleSize) : 1;
 
-		r.value = boost::numeric::ublas::inner_prod(it.second.values, it.second.weights);
-		r.weights = it.second;
-		r.step = step;
+	// Task's own copy of weights (missing predictors zero them) and values;
+	// layout is the same as in the weight table
 
-		results[station] = r;
-	}
+	TaskValues task(itsArena.Resource());
 
-	// 4. Write to file
+	task.weights.assign(table.Weights().begin(), table.Weights().end());
+	task.values.assign(task.weights.size(), 0);
+	task.memberValues.assign(ensemble ? task.weights.size() * members : 0, 0);
 
-	Write(mosInfo, results);
+	auto& weights = task.weights;
+	auto& values = task.values;
+	auto& memberValues = task.memberValues;
 
-	return true;
+	ThreadPool::Instance()->ParallelFor(
+	    stations.size(), kMinStationChunk,
+	    [&](size_t begin, size_t end)
+	    {
+		    for (size_t index = begin; index < end; index++)
+		    {
+			    const Station& station = stations[index];
+			    const auto& params = table.Params(index);
+			    const auto& sources = predictorValues[table.PredictorSet(index)];
+			    const size_t offset = table.Offset(index);
+
+#ifdef DEBUG
+			    if (mosInfo.traceOutput)
+			    {
+				    Log(kLogDebug) << station.id << " " << station.name << " " << params.size() << " weights";
+			    }
+#endif
+
+			    for (size_t i = 0; i < params.size(); i++)
+			    {
+				    const ParamLevel& pl = params[i];
+				    const size_t k = offset + i;
+
+				    if (!sources[i])
+				    {
+					    // Weight is zero at all stations, value is left zero
+					    continue;
+				    }
+
+				    if (ensemble)
+				    {
+					    GatherMemberValues(mosInfo, station, step, pl, sources[i]->data() + index * members, members,
+					                       weights[k], &memberValues[k * members], values[k]);
+					    continue;
+				    }
+
+				    const double value = (*sources[i])[index];
+
+				    if (value == kFloatMissing && weights[k] != 0)
+				    {
+					    if (pl.info->flags & kParamFillMissing)
+					    {
+						    values[k] = pl.info->fillValue;
+						    LogMissingValue(mosInfo, station, pl, step,
+						                    fmt::format("setting value to {}", pl.info->fillValue));
+					    }
+					    else
+					    {
+						    weights[k] = 0;
+						    LogMissingValue(mosInfo, station, pl, step, "setting weight to zero");
+					    }
+				    }
+				    else
+				    {
+					    values[k] = value;
+				    }
+			    }
+		    }
+	    });
+
+	// Apply
+
+	Log(kLogInfo) << "Applying weights";
+
+	TraceSpan span("apply", step, mosInfo.paramName, mosInfo.label);
+
+	// Each chunk collects its results to its own buffer
+
+	std::vector<Result> stationResults(stations.size());
+
+	ThreadPool::Instance()->ParallelFor(
+	    stations.size(), kMinStationChunk,
+	    [&](size_t begin, size_t end)
+	    {
+		    for (size_t index = begin; index < end; index++)
+		    {
+			    const size_t offset = table.Offset(index);
+			    const size_t count = table.Params(index).size();
+
+			    Result& r = stationResults[index];
+
+			    if (ensemble)
+			    {
+				    // Member values of one predictor are consecutive
+				    r.memberValues.assign(members, 0);
+
+				    for (size_t k = offset; k < offset + count; k++)
+				    {
+					    for (size_t m = 0; m < members; m++)
+					    {
+						    r.memberValues[m] += memberValues[k * members + m] * weights[k];
+					    }
+				    }
+
+				    r.value = std::accumulate(r.memberValues.begin(), r.memberValues.end(), 0.) /
+				              static_cast<double>(members);
+
+				    if (!mosInfo.quantiles.empty())
+				    {
+					    // Member values stay in member order for output
+					    std::vector<double> sorted(r.memberValues);
+					    std::sort(sorted.begin(), sorted.end());
+
+					    for (double q : mosInfo.quantiles)
+					    {
+						    r.quantileValues.push_back(Quantile(sorted, q));
+					    }
+				    }
+			    }
+			    else
+			    {
+				    r.value = ApplyWeights(values.data() + offset, weights.data() + offset, count);
+			    }
+
+			    // Full copy of weights only for trace
+			    if (mosInfo.traceOutput)
+			    {
+				    r.weights = table.ToWeight(index, weights.data(), values.data());
+			    }
+
+			    r.step = step;
+		    }
+	    });
+
+	for (size_t index = 0; index < stations.size(); index++)
+	{
+		task.results.emplace_hint(task.results.end(), stations[index], std::move(stationResults[index]));
+	}
+
+	return task;
 }
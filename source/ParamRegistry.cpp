@@ -0,0 +1,274 @@
+#include "ParamRegistry.h"
+#include "Logger.h"
+#include <array>
+#include <boost/algorithm/string.hpp>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
+
+// clang-format off
+constexpr ParamInfo kParams[] = {
+	// name               source name    source level  level cond.  producer  scale    max step  output id  fill    flags
+
+	// target parameters
+	{"T-K",               nullptr,       nullptr,      nullptr,     -1,       1,       -1,       153,       0,      0},
+	{"TD-K",              nullptr,       nullptr,      nullptr,     -1,       1,       -1,       162,       0,      0},
+	{"TMAX12H-K",         nullptr,       nullptr,      nullptr,     -1,       1,       -1,       738,       0,      0},
+	{"TMIN12H-K",         nullptr,       nullptr,      nullptr,     -1,       1,       -1,       739,       0,      0},
+
+	// not in database
+	{"INTERCEPT-N",       nullptr,       nullptr,      nullptr,     -1,       1,       -1,       -1,        0,      kParamMemberIndependent},
+	{"DECLINATION-N",     nullptr,       nullptr,      nullptr,     -1,       1,       -1,       -1,        0,      kParamMemberIndependent},
+
+	// Note! RR, RRC and RRL *need* to be one hour accumulation (source: J. Ylhaisi)!
+	{"RR-KGM2",           "RRR-KGM2",    "HEIGHT",     nullptr,     240,      1,       -1,       -1,        0,      kParamNearestPoint},
+	{"RRC-KGM2",          "RRRC-KGM2",   "HEIGHT",     nullptr,     240,      1,       -1,       -1,        0,      kParamNearestPoint | kParamCumulative},
+	{"RRL-KGM2",          "RRRL-KGM2",   "HEIGHT",     nullptr,     240,      1,       -1,       -1,        0,      kParamNearestPoint | kParamCumulative},
+
+	// Erroneus metadata in neons
+	{"TOTCW-KGM2",        "TCW-KGM2",    nullptr,      nullptr,     -1,       1,       -1,       -1,        0,      0},
+
+	// Meansea pressure is at level GROUND in neons (surface (station) pressure is PGR-PA)
+	{"P-PA",              nullptr,       "GROUND",     "MEANSEA",   -1,       1,       -1,       -1,        0,      0},
+
+	{"NL-PRCNT",          "NL-0TO1",     nullptr,      nullptr,     -1,       1,       -1,       -1,        0,      0},
+	{"NM-PRCNT",          "NM-0TO1",     nullptr,      nullptr,     -1,       1,       -1,       -1,        0,      0},
+	{"NH-PRCNT",          "NH-0TO1",     nullptr,      nullptr,     -1,       1,       -1,       -1,        0,      0},
+
+	// ensemble mean
+	{"T-MEAN-K",          nullptr,       nullptr,      nullptr,     134,      1,       -1,       -1,        0,      kParamMemberIndependent | kParamThreeHourly},
+
+	{"EVAP-KGM2",         nullptr,       nullptr,      nullptr,     -1,       1000,    -1,       -1,        0,      kParamCumulative},
+	{"RUNOFF-M",          nullptr,       nullptr,      nullptr,     -1,       1000,    -1,       -1,        0,      kParamCumulative},
+	{"SUBRUNOFF-M",       nullptr,       nullptr,      nullptr,     -1,       1000,    -1,       -1,        0,      kParamCumulative},
+
+	{"FLSEN-JM2",         nullptr,       nullptr,      nullptr,     -1,       1,       -1,       -1,        0,      kParamCumulativeRadiation},
+	{"FLLAT-JM2",         nullptr,       nullptr,      nullptr,     -1,       1,       -1,       -1,        0,      kParamCumulativeRadiation},
+	{"RNETSW-WM2",        nullptr,       nullptr,      nullptr,     -1,       1,       -1,       -1,        0,      kParamCumulativeRadiation},
+	{"RNETLW-WM2",        nullptr,       nullptr,      nullptr,     -1,       1,       -1,       -1,        0,      kParamCumulativeRadiation},
+	{"RADDIRSOLAR-JM2",   nullptr,       nullptr,      nullptr,     -1,       1,       -1,       -1,        0,      kParamCumulativeRadiation},
+	{"RADLW-WM2",         nullptr,       nullptr,      nullptr,     -1,       1,       -1,       -1,        0,      kParamCumulativeRadiation},
+	{"RADGLO-WM2",        nullptr,       nullptr,      nullptr,     -1,       1,       -1,       -1,        0,      kParamCumulativeRadiation},
+
+	{"SD-M",              nullptr,       nullptr,      nullptr,     -1,       1000,    -1,       -1,        0,      0},
+	{"POTVORT-N",         nullptr,       nullptr,      nullptr,     -1,       1000000, -1,       -1,        0,      0},
+	{"ABSVO-HZ",          nullptr,       nullptr,      nullptr,     -1,       1000000, -1,       -1,        0,      0},
+	{"ALBEDO-PRCNT",      nullptr,       nullptr,      nullptr,     -1,       100,     -1,       -1,        0,      0},
+	{"IC-0TO1",           nullptr,       nullptr,      nullptr,     -1,       100,     -1,       -1,        0,      0},
+	{"LC-0TO1",           nullptr,       nullptr,      nullptr,     -1,       100,     -1,       -1,        0,      0},
+
+	// Following parameters are not defined for step > 144
+	{"FFG3H-MS",          nullptr,       nullptr,      nullptr,     -1,       1,       144,      -1,        0,      0},
+	{"TMAX3H-K",          nullptr,       nullptr,      nullptr,     -1,       1,       144,      -1,        0,      0},
+	{"TMIN3H-K",          nullptr,       nullptr,      nullptr,     -1,       1,       144,      -1,        0,      0},
+
+	// Number comes from J. Ylhaisi
+	{"CLDBASE-M",         nullptr,       nullptr,      nullptr,     -1,       1,       -1,       -1,        20000,  kParamFillMissing},
+};
+// clang-format on
+
+constexpr size_t kParamCount = sizeof(kParams) / sizeof(kParams[0]);
+
+// Perfect hash: a seed is searched at compile time so that every built-in
+// parameter name hashes to its own slot
+
+constexpr size_t kSlotCount = 256;
+
+static_assert(kParamCount < kSlotCount / 2, "Too many parameters for hash table");
+
+constexpr uint32_t Fnv1a(const char* str, uint32_t seed)
+{
+	uint32_t hash = 2166136261u ^ seed;
+
+	while (*str)
+	{
+		hash ^= static_cast<unsigned char>(*str++);
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
+
+constexpr uint32_t FindSeed()
+{
+	for (uint32_t seed = 0; seed < 10000; seed++)
+	{
+		bool used[kSlotCount] = {};
+		bool collision = false;
+
+		for (size_t i = 0; i < kParamCount && !collision; i++)
+		{
+			const size_t slot = Fnv1a(kParams[i].name, seed) % kSlotCount;
+
+			collision = used[slot];
+			used[slot] = true;
+		}
+
+		if (!collision)
+		{
+			return seed;
+		}
+	}
+
+	return ~0u;
+}
+
+constexpr uint32_t kSeed = FindSeed();
+
+static_assert(kSeed != ~0u, "No perfect hash seed found for parameter table");
+
+constexpr std::array<int16_t, kSlotCount> MakeSlots()
+{
+	std::array<int16_t, kSlotCount> slots{};
+
+	for (size_t i = 0; i < kSlotCount; i++)
+	{
+		slots[i] = -1;
+	}
+
+	for (size_t i = 0; i < kParamCount; i++)
+	{
+		slots[Fnv1a(kParams[i].name, kSeed) % kSlotCount] = static_cast<int16_t>(i);
+	}
+
+	return slots;
+}
+
+constexpr std::array<int16_t, kSlotCount> kSlots = MakeSlots();
+
+constexpr ParamInfo kDefaultParam = {"", nullptr, nullptr, nullptr, -1, 1, -1, -1, 0, 0};
+
+// Parameters read from configuration file; these override built-in ones
+std::unordered_map<std::string, ParamInfo> loadedParams;
+std::deque<std::string> loadedStrings;  // storage for the strings of loaded parameters
+
+const ParamInfo& ParamRegistry::Get(const std::string& name)
+{
+	if (!loadedParams.empty())
+	{
+		const auto it = loadedParams.find(name);
+
+		if (it != loadedParams.end())
+		{
+			return it->second;
+		}
+	}
+
+	const int16_t index = kSlots[Fnv1a(name.c_str(), kSeed) % kSlotCount];
+
+	if (index >= 0 && strcmp(kParams[index].name, name.c_str()) == 0)
+	{
+		return kParams[index];
+	}
+
+	return kDefaultParam;
+}
+
+// File format, one parameter per line:
+//
+// name,source_name,source_level,level_condition,producer_id,scale,max_step,output_param_id,fill_value,flags
+//
+// Empty columns get default values. Flags are separated with '|' and can be
+// cumulative, radiation, member-independent, nearest, three-hourly, fill-missing.
+// Lines starting with '#' are comments.
+//
+// Example: a new target parameter
+//
+// RH-PRCNT,,,,,,,13,,
+
+void ParamRegistry::Load(const std::string& fileName)
+{
+	std::ifstream in(fileName);
+
+	if (!in)
+	{
+		throw std::runtime_error("Unable to open parameter file '" + fileName + "'");
+	}
+
+	auto Store = [](const std::string& str) -> const char*
+	{
+		if (str.empty())
+		{
+			return nullptr;
+		}
+
+		loadedStrings.push_back(str);
+		return loadedStrings.back().c_str();
+	};
+
+	std::string line;
+
+	while (std::getline(in, line))
+	{
+		boost::trim(line);
+
+		if (line.empty() || line[0] == '#')
+		{
+			continue;
+		}
+
+		std::vector<std::string> cols;
+		boost::split(cols, line, boost::is_any_of(","));
+
+		if (cols.size() != 10)
+		{
+			throw std::runtime_error("Invalid line in parameter file '" + fileName + "': " + line);
+		}
+
+		for (auto& col : cols)
+		{
+			boost::trim(col);
+		}
+
+		ParamInfo info = kDefaultParam;
+
+		loadedStrings.push_back(cols[0]);
+		info.name = loadedStrings.back().c_str();
+		info.sourceName = Store(cols[1]);
+		info.sourceLevel = Store(cols[2]);
+		info.levelCondition = Store(cols[3]);
+
+		if (!cols[4].empty())
+			info.producerId = std::stoi(cols[4]);
+		if (!cols[5].empty())
+			info.scale = std::stod(cols[5]);
+		if (!cols[6].empty())
+			info.maxStep = std::stoi(cols[6]);
+		if (!cols[7].empty())
+			info.outputParamId = std::stoi(cols[7]);
+		if (!cols[8].empty())
+			info.fillValue = std::stod(cols[8]);
+
+		std::vector<std::string> flags;
+		boost::split(flags, cols[9], boost::is_any_of("|"));
+
+		for (const auto& flag : flags)
+		{
+			if (flag.empty())
+				continue;
+			else if (flag == "cumulative")
+				info.flags |= kParamCumulative;
+			else if (flag == "radiation")
+				info.flags |= kParamCumulativeRadiation;
+			else if (flag == "member-independent")
+				info.flags |= kParamMemberIndependent;
+			else if (flag == "nearest")
+				info.flags |= kParamNearestPoint;
+			else if (flag == "three-hourly")
+				info.flags |= kParamThreeHourly;
+			else if (flag == "fill-missing")
+				info.flags |= kParamFillMissing;
+			else
+				throw std::runtime_error("Unknown parameter flag '" + flag + "' in file '" + fileName + "'");
+		}
+
+		loadedParams[cols[0]] = info;
+	}
+
+	Log(kLogInfo) << "Read " << loadedParams.size() << " parameter definitions from '" << fileName << "'";
+}
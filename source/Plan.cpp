@@ -0,0 +1,362 @@
+#include "Plan.h"
+#include "DerivedPredictors.h"
+#include "Logger.h"
+#include "MosWorker.h"
+#include "Options.h"
+#include "SourceReader.h"
+#include "WeightTable.h"
+#include <NFmiGrib.h>
+#include <algorithm>
+#include <boost/algorithm/string/join.hpp>
+#include <boost/filesystem.hpp>
+#include <fmt/format.h>
+#include <map>
+#include <set>
+
+extern WeightStore allWeights;
+extern Options opts;
+
+namespace
+{
+// Grid points of a message that cannot be read are estimated from its
+// length; grib values are usually packed with 12-16 bits
+const uint64_t kBitsPerPackedValue = 16;
+
+// Resolution of regrid in ToQueryInfo
+const double kRegridResolution = 0.125;
+
+// Grid of a geometry
+struct GridShape
+{
+	uint64_t points;        // of a source message
+	uint64_t cachedPoints;  // of a cached field
+};
+
+// Grid is read from message headers, values are not decoded. Like in
+// ToQueryInfo, fields are not interpolated to a finer grid than they have.
+
+GridShape ReadShape(const SourceMessage& message, bool regrid)
+{
+	GridShape shape{0, 0};
+
+	SourceReader::Read({message},
+	                   [&](size_t, NFmiGrib& reader)
+	                   {
+		                   const long ni = reader.Message().SizeX();
+		                   const long nj = reader.Message().SizeY();
+		                   const double dx = reader.Message().iDirectionIncrement();
+		                   const double dy = reader.Message().jDirectionIncrement();
+
+		                   shape.points = static_cast<uint64_t>(ni * nj);
+		                   shape.cachedPoints = shape.points;
+
+		                   if (regrid && dx <= kRegridResolution &&
+		                       (dx != kRegridResolution || dy != kRegridResolution))
+		                   {
+			                   shape.cachedPoints =
+			                       static_cast<uint64_t>(static_cast<double>(ni - 1) * dx / kRegridResolution) *
+			                       static_cast<uint64_t>(static_cast<double>(nj - 1) * dy / kRegridResolution);
+		                   }
+	                   });
+
+	return shape;
+}
+
+// Messages without offset and length are whole files
+uint64_t MessageBytes(const SourceMessage& message)
+{
+	if (!message.byteLength.empty())
+	{
+		return std::stoull(message.byteLength);
+	}
+
+	boost::system::error_code ec;
+	const uint64_t size = boost::filesystem::file_size(message.fileLocation, ec);
+
+	return ec ? 0 : size;
+}
+
+std::string Megabytes(uint64_t bytes)
+{
+	return fmt::format("{:.1f} MB", static_cast<double>(bytes) / (1024 * 1024));
+}
+}  // namespace
+
+Plan Plan::Build(const std::vector<MosInfo>& mosInfos, const std::vector<std::string>& params,
+                 const std::vector<Task>& tasks, int stationGroups)
+{
+	Plan plan;
+	plan.itsUnits = tasks.size();
+	plan.itsStationGroups = stationGroups;
+
+	const ExecutionPath path = ExecutionPath::Parse(opts.fastPath);
+	MosInterpolator interpolator(path);
+
+	// Fields are cached as float query data, or as 16-bit codes with compact
+	// path (assuming all fit in the error limit)
+	const uint64_t bytesPerPoint = path.compact ? sizeof(uint16_t) : sizeof(float);
+
+	// geometry -> grid
+	std::map<std::string, GridShape> shapes;
+
+	std::unique_ptr<MosDB> db;
+
+	if (allWeights.empty())
+	{
+		db = std::unique_ptr<MosDB>(MosDBPool::Instance()->GetConnection());
+	}
+
+	std::map<std::string, size_t> loadIndex;
+
+	// Same order as workers process tasks (see Run)
+
+	for (size_t u = 0; u < tasks.size(); u++)
+	{
+		const int step = tasks[u].step;
+
+		for (const auto& paramName : params)
+		{
+			for (MosInfo mosInfo : mosInfos)
+			{
+				mosInfo.paramName = paramName;
+				mosInfo.stationGroup = tasks[u].stationGroup;
+				mosInfo.stationGroups = stationGroups;
+
+				PlanTask task{mosInfo.label, paramName, step, tasks[u].stationGroup, 0, 0, 0, false, u, {}};
+
+				auto table = TaskWeights(mosInfo, step, db.get());
+
+				if (table && !table->Empty())
+				{
+					task.weights = true;
+
+					if (stationGroups > 1)
+					{
+						const size_t size = table->Size();
+						const size_t groups = static_cast<size_t>(stationGroups);
+						const size_t group = static_cast<size_t>(tasks[u].stationGroup);
+
+						table = table->Slice(group * size / groups, (group + 1) * size / groups);
+					}
+				}
+
+				if (!task.weights || table->Empty())
+				{
+					plan.itsTasks.push_back(task);
+					continue;
+				}
+
+				task.stations = table->Size();
+
+				const auto& predictorSets = table->PredictorSets();
+				const auto needed = NeededPredictors(mosInfo, *table);
+
+				std::vector<ParamLevel> predictors;
+
+				for (size_t i = 0; i < predictorSets.size(); i++)
+				{
+					for (size_t j = 0; j < predictorSets[i].size(); j++)
+					{
+						if (needed[i][j])
+						{
+							predictors.push_back(predictorSets[i][j]);
+						}
+					}
+
+					task.predictors += predictorSets[i].size();
+				}
+
+				task.skippedPredictors = task.predictors - predictors.size();
+
+				for (const auto& r : DerivedPredictors::FieldRequests(mosInfo, predictors, step))
+				{
+					const auto key = Key(r.pl, r.step, mosInfo.originTime) + (r.members ? " ens" : "");
+
+					auto it = loadIndex.find(key);
+
+					if (it == loadIndex.end())
+					{
+						PlanLoad load{key, SourceParam(), 0, 0, 0, 0, "", {}};
+						std::vector<SourceMessage> messages;
+
+						if (interpolator.FindMessages(mosInfo, r.pl, r.step, r.members, load.src, messages, load.error))
+						{
+							for (const auto& message : messages)
+							{
+								load.bytes += MessageBytes(message);
+							}
+
+							load.messages = messages.size();
+
+							const std::string geometry =
+							    std::to_string(load.src.producerId) + "/" + messages[0].geometry;
+
+							auto sit = shapes.find(geometry);
+
+							if (sit == shapes.end())
+							{
+								GridShape shape{0, 0};
+
+								try
+								{
+									shape = ReadShape(messages[0], interpolator.Regrid());
+								}
+								catch (const std::exception& e)
+								{
+									Log(kLogWarning) << "Unable to read grid of " << key << ": " << e.what();
+								}
+
+								sit = shapes.emplace(geometry, shape).first;
+							}
+
+							if (sit->second.points > 0)
+							{
+								load.points = sit->second.points * load.messages;
+								load.residentBytes = sit->second.cachedPoints * load.messages * bytesPerPoint;
+							}
+							else
+							{
+								load.points = load.bytes * 8 / kBitsPerPackedValue;
+								load.residentBytes = load.points * bytesPerPoint;
+							}
+						}
+
+						it = loadIndex.emplace(key, plan.itsLoads.size()).first;
+						plan.itsLoads.push_back(load);
+					}
+
+					if (std::find(task.loads.begin(), task.loads.end(), it->second) == task.loads.end())
+					{
+						task.loads.push_back(it->second);
+						plan.itsLoads[it->second].tasks.push_back(plan.itsTasks.size());
+					}
+				}
+
+				plan.itsTasks.push_back(task);
+			}
+		}
+	}
+
+	if (db)
+	{
+		MosDBPool::Instance()->Release(db.release());
+	}
+
+	return plan;
+}
+
+bool Plan::Report(std::ostream& out, int threadCount) const
+{
+	bool complete = true;
+
+	out << "Grid loads:\n";
+
+	uint64_t bytes = 0, points = 0;
+	size_t messages = 0;
+
+	for (size_t i = 0; i < itsLoads.size(); i++)
+	{
+		const PlanLoad& load = itsLoads[i];
+
+		if (!load.error.empty())
+		{
+			out << fmt::format("  L{} {}: MISSING ({}), needed by {} tasks\n", i, load.key, load.error,
+			                   load.tasks.size());
+			complete = false;
+			continue;
+		}
+
+		out << fmt::format("  L{} {}: producer {} analysis time {} step {}, {} messages, {}, {:.1f}M grid points, "
+		                   "needed by {} tasks\n",
+		                   i, load.key, load.src.producerId, load.src.originTime, load.src.step, load.messages,
+		                   Megabytes(load.bytes), static_cast<double>(load.points) / 1e6, load.tasks.size());
+
+		bytes += load.bytes;
+		points += load.points;
+		messages += load.messages;
+	}
+
+	out << "\nTasks:\n";
+
+	for (size_t i = 0; i < itsTasks.size(); i++)
+	{
+		const PlanTask& task = itsTasks[i];
+
+		out << fmt::format("  T{} label '{}' param {} step {}", i, task.label, task.paramName, task.step);
+
+		if (itsStationGroups > 1)
+		{
+			out << " group " << task.stationGroup + 1;
+		}
+
+		if (!task.weights)
+		{
+			out << ": NO WEIGHTS\n";
+			complete = false;
+			continue;
+		}
+
+		std::vector<std::string> loads;
+
+		for (size_t l : task.loads)
+		{
+			loads.push_back("L" + std::to_string(l));
+		}
+
+		out << fmt::format(": {} stations, {} predictors ({} with zero weight), loads {}\n", task.stations,
+		                   task.predictors, task.skippedPredictors,
+		                   loads.empty() ? "-" : boost::algorithm::join(loads, ","));
+	}
+
+	// Workers take tasks in order, so with tasks of about the same cost each
+	// worker gets every threadCount'th unit. Fields stay in the cache of the
+	// worker that read them until the end of the run. Nothing here changes
+	// how the run distributes work.
+
+	const size_t workers = static_cast<size_t>(std::max(1, threadCount));
+
+	std::vector<std::set<size_t>> workerLoads(workers);
+	std::vector<size_t> workerTasks(workers, 0);
+
+	for (const auto& task : itsTasks)
+	{
+		const size_t w = task.unit % workers;
+
+		workerTasks[w]++;
+		workerLoads[w].insert(task.loads.begin(), task.loads.end());
+	}
+
+	uint64_t peak = 0, largest = 0;
+	size_t workerLoadCount = 0;
+
+	out << "\nWorkers:\n";
+
+	for (size_t w = 0; w < workers; w++)
+	{
+		uint64_t resident = 0, read = 0;
+
+		for (size_t l : workerLoads[w])
+		{
+			resident += itsLoads[l].residentBytes;
+			read += itsLoads[l].bytes;
+		}
+
+		out << fmt::format("  worker {}: {} tasks, {} grid loads, reads {}, {} resident\n", w, workerTasks[w],
+		                   workerLoads[w].size(), Megabytes(read), Megabytes(resident));
+
+		peak += resident;
+		largest = std::max(largest, resident);
+		workerLoadCount += workerLoads[w].size();
+	}
+
+	out << "\nEstimates:\n"
+	    << fmt::format("  {} tasks in {} units, {} grid loads ({} messages)\n", itsTasks.size(), itsUnits,
+	                   itsLoads.size(), messages)
+	    << fmt::format("  read {}, decode {:.1f}M grid points\n", Megabytes(bytes), static_cast<double>(points) / 1e6)
+	    << fmt::format("  {} grid loads repeated by another worker\n", workerLoadCount - itsLoads.size())
+	    << fmt::format("  peak resident source data {} ({} in largest worker)\n", Megabytes(peak), Megabytes(largest));
+
+	out << "\nPlan is " << (complete ? "complete" : "NOT complete: weights or source data missing") << std::endl;
+
+	return complete;
+}
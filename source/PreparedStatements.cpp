@@ -0,0 +1,72 @@
+#include "PreparedStatements.h"
+#include "Logger.h"
+
+std::string QuoteLiteral(const std::string& value)
+{
+	std::string ret = "E'";
+
+	for (char c : value)
+	{
+		if (c == '\'' || c == '\\')
+		{
+			ret += c;
+		}
+
+		ret += c;
+	}
+
+	return ret + "'";
+}
+
+std::string PreparedStatements::Statement(const std::string& sql, const std::vector<std::string>& params)
+{
+	auto it = itsNames.find(sql);
+
+	if (it == itsNames.end())
+	{
+		const std::string name = "mosse_" + std::to_string(itsNames.size() + 1);
+
+		// Added only after prepare has succeeded
+		itsConnection.Execute("PREPARE " + name + " AS " + sql);
+		it = itsNames.emplace(sql, name).first;
+
+#ifdef DEBUG
+		Log(kLogDebug) << "Prepared statement " << name << ": " << sql;
+#endif
+	}
+
+	std::string ret = "EXECUTE " + it->second;
+
+	if (!params.empty())
+	{
+		ret += "(";
+
+		for (size_t i = 0; i < params.size(); i++)
+		{
+			ret += (i == 0 ? "" : ",") + QuoteLiteral(params[i]);
+		}
+
+		ret += ")";
+	}
+
+	return ret;
+}
+
+void PreparedStatements::Deallocate()
+{
+	if (!itsNames.empty())
+	{
+		itsConnection.Execute("DEALLOCATE ALL");
+		itsNames.clear();
+	}
+}
+
+void PreparedStatements::Query(const std::string& sql, const std::vector<std::string>& params)
+{
+	itsConnection.Query(Statement(sql, params));
+}
+
+void PreparedStatements::Execute(const std::string& sql, const std::vector<std::string>& params)
+{
+	itsConnection.Execute(Statement(sql, params));
+}
@@ -0,0 +1,196 @@
+#include "RegridTable.h"
+#include "Stencil.h"
+#include "ThreadPool.h"
+#include "TraceEvents.h"
+#include <cassert>
+#include <cmath>
+#include <limits>
+#include <mutex>
+#include <stdexcept>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define MOSSE_HAVE_AVX2_KERNEL
+#endif
+
+namespace
+{
+// Smallest number of target points worth giving to one thread
+const size_t kMinPointChunk = 16384;
+
+std::mutex cacheMutex;
+std::vector<std::shared_ptr<const RegridTable>> cache;
+
+bool HaveAvx2()
+{
+#ifdef MOSSE_HAVE_AVX2_KERNEL
+	static const bool have = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+	return have;
+#else
+	return false;
+#endif
+}
+}  // namespace
+
+std::shared_ptr<const RegridTable> RegridTable::Get(const NFmiFastQueryInfo& sourceInfo, double resolution)
+{
+	const NFmiHPlaceDescriptor& source = sourceInfo.HPlaceDescriptor();
+	const FmiInterpolationMethod method = sourceInfo.Grid()->InterpolationMethod();
+
+	// Tables are few (one per source geometry), and built while holding the
+	// lock so that a table is never built twice
+
+	std::lock_guard<std::mutex> lock(cacheMutex);
+
+	for (const auto& table : cache)
+	{
+		if (table->itsResolution == resolution && table->itsMethod == method && table->itsSource == source)
+		{
+			return table;
+		}
+	}
+
+	TraceSpan span("build regrid table");
+
+	auto bl = sourceInfo.Area()->BottomLeftLatLon();
+	auto tr = sourceInfo.Area()->TopRightLatLon();
+
+	assert(tr.X() > bl.X());
+	assert(tr.Y() > bl.Y());
+
+	int ni = static_cast<int>(fabs(tr.X() - bl.X()) / resolution);
+	int nj = static_cast<int>(fabs(tr.Y() - bl.Y()) / resolution);
+
+	NFmiGrid grid(sourceInfo.Area(), ni, nj, kBottomLeft, method);
+
+	std::shared_ptr<const RegridTable> table(new RegridTable(source, NFmiHPlaceDescriptor(grid), resolution, method));
+
+	cache.push_back(table);
+
+	return table;
+}
+
+RegridTable::RegridTable(const NFmiHPlaceDescriptor& source, const NFmiHPlaceDescriptor& target, double resolution,
+                         FmiInterpolationMethod method)
+    : itsSource(source), itsTarget(target), itsResolution(resolution), itsMethod(method)
+{
+	const NFmiGrid* sourceGrid = itsSource.Grid();
+	const NFmiGrid* targetGrid = itsTarget.Grid();
+
+	if (static_cast<uint64_t>(sourceGrid->XNumber()) * sourceGrid->YNumber() >
+	    static_cast<uint64_t>(std::numeric_limits<int32_t>::max()))
+	{
+		throw std::runtime_error("Source grid is too large to regrid");
+	}
+
+	const size_t ni = targetGrid->XNumber();
+	const size_t size = ni * targetGrid->YNumber();
+
+	for (size_t c = 0; c < 4; c++)
+	{
+		itsIndex[c].resize(size);
+		itsWeight[c].resize(size);
+	}
+
+	ThreadPool::Instance()->ParallelFor(
+	    size, kMinPointChunk,
+	    [&](size_t begin, size_t end)
+	    {
+		    for (size_t i = begin; i < end; i++)
+		    {
+			    const NFmiPoint gp(static_cast<double>(i % ni), static_cast<double>(i / ni));
+			    const Stencil s = MakeStencil(sourceGrid, targetGrid->GridToLatLon(gp));
+
+			    // Points outside source grid have zero weights and become
+			    // missing
+
+			    for (int c = 0; c < 4; c++)
+			    {
+				    itsIndex[c][i] = (c < s.size) ? static_cast<int32_t>(s.index[c]) : 0;
+				    itsWeight[c][i] = (c < s.size) ? static_cast<float>(s.weight[c]) : 0;
+			    }
+		    }
+	    });
+}
+
+void RegridTable::Apply(const float* source, float* target) const
+{
+	const bool avx2 = HaveAvx2();
+
+	ThreadPool::Instance()->ParallelFor(Size(), kMinPointChunk,
+	                                    [&](size_t begin, size_t end)
+	                                    {
+		                                    if (avx2)
+		                                    {
+			                                    ApplyAvx2(source, target, begin, end);
+		                                    }
+		                                    else
+		                                    {
+			                                    ApplyScalar(source, target, begin, end);
+		                                    }
+	                                    });
+}
+
+void RegridTable::ApplyScalar(const float* source, float* target, size_t begin, size_t end) const
+{
+	for (size_t i = begin; i < end; i++)
+	{
+		float sum = 0, wsum = 0;
+
+		for (size_t c = 0; c < 4; c++)
+		{
+			const float v = source[itsIndex[c][i]];
+			const float w = (v == kFloatMissing) ? 0 : itsWeight[c][i];
+
+			sum += w * v;
+			wsum += w;
+		}
+
+		target[i] = (wsum == 0) ? kFloatMissing : sum / wsum;
+	}
+}
+
+#ifdef MOSSE_HAVE_AVX2_KERNEL
+
+// Eight target points at a time: gather the source values of each corner,
+// mask out missing values and accumulate with fused multiply-add
+
+__attribute__((target("avx2,fma"))) void RegridTable::ApplyAvx2(const float* source, float* target, size_t begin,
+                                                                size_t end) const
+{
+	const __m256 missing = _mm256_set1_ps(kFloatMissing);
+	const __m256 zero = _mm256_setzero_ps();
+
+	size_t i = begin;
+
+	for (; i + 8 <= end; i += 8)
+	{
+		__m256 sum = zero, wsum = zero;
+
+		for (size_t c = 0; c < 4; c++)
+		{
+			const __m256i index = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(itsIndex[c].data() + i));
+			const __m256 v = _mm256_i32gather_ps(source, index, 4);
+			const __m256 w =
+			    _mm256_and_ps(_mm256_loadu_ps(itsWeight[c].data() + i), _mm256_cmp_ps(v, missing, _CMP_NEQ_OQ));
+
+			sum = _mm256_fmadd_ps(w, v, sum);
+			wsum = _mm256_add_ps(wsum, w);
+		}
+
+		const __m256 value = _mm256_div_ps(sum, wsum);
+
+		_mm256_storeu_ps(target + i, _mm256_blendv_ps(value, missing, _mm256_cmp_ps(wsum, zero, _CMP_EQ_OQ)));
+	}
+
+	ApplyScalar(source, target, i, end);
+}
+
+#else
+
+void RegridTable::ApplyAvx2(const float* source, float* target, size_t begin, size_t end) const
+{
+	ApplyScalar(source, target, begin, end);
+}
+
+#endif
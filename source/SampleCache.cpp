@@ -0,0 +1,270 @@
+#include "SampleCache.h"
+#include "Logger.h"
+#include <cctype>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace
+{
+const uint32_t kRecordMagic = 0x534d4f4d;     // "MOMS"
+const uint32_t kRecordEndMagic = 0x454d4f4d;  // "MOME"
+
+struct RecordHeader
+{
+	uint32_t magic;
+	uint32_t keyLength;
+	uint64_t count;
+};
+
+struct RecordTrailer
+{
+	uint32_t magic;
+	uint32_t length;  // of the whole record
+};
+
+size_t Padded(size_t length)
+{
+	return (length + 7) & ~static_cast<size_t>(7);
+}
+
+size_t RecordLength(size_t keyLength, size_t count)
+{
+	return sizeof(RecordHeader) + Padded(keyLength) + count * sizeof(double) + sizeof(RecordTrailer);
+}
+
+// End of the record at offset: 0 if there is no whole record, more than size
+// if the record does not fit in file (yet)
+
+size_t RecordEnd(const char* data, size_t size, size_t offset)
+{
+	RecordHeader header;
+	memcpy(&header, data + offset, sizeof(header));
+
+	if (header.magic != kRecordMagic || header.count > size / sizeof(double))
+	{
+		return 0;
+	}
+
+	const size_t end = offset + RecordLength(header.keyLength, header.count);
+
+	if (end > size)
+	{
+		return end;
+	}
+
+	RecordTrailer trailer;
+	memcpy(&trailer, data + end - sizeof(trailer), sizeof(trailer));
+
+	return (trailer.magic == kRecordEndMagic && trailer.length == end - offset) ? end : 0;
+}
+}  // namespace
+
+SampleCache* SampleCache::itsInstance = NULL;
+
+SampleCache* SampleCache::Instance()
+{
+	if (!itsInstance)
+	{
+		itsInstance = new SampleCache();
+	}
+
+	return itsInstance;
+}
+
+SampleCache::~SampleCache()
+{
+	for (auto& it : itsFiles)
+	{
+		if (it.second->mapping)
+		{
+			munmap(it.second->mapping, it.second->mappingSize);
+		}
+
+		close(it.second->fd);
+	}
+}
+
+void SampleCache::Open(const std::string& directory)
+{
+	itsDirectory = directory;
+}
+
+bool SampleCache::Enabled() const
+{
+	return !itsDirectory.empty();
+}
+
+SampleCache::File& SampleCache::Get(const std::string& originTime)
+{
+	auto it = itsFiles.find(originTime);
+
+	if (it != itsFiles.end())
+	{
+		return *it->second;
+	}
+
+	// yyyy-mm-dd hh:mm:ss -> yyyymmddhhmm
+
+	std::string stamp;
+
+	for (char c : originTime.substr(0, 16))
+	{
+		if (isdigit(c))
+		{
+			stamp += c;
+		}
+	}
+
+	const std::string fileName = itsDirectory + "/samples_" + stamp + ".bin";
+
+	std::unique_ptr<File> file(new File());
+
+	file->fd = open(fileName.c_str(), O_RDWR | O_CREAT | O_APPEND, 0644);
+
+	if (file->fd == -1)
+	{
+		throw std::runtime_error("Unable to open sample cache file '" + fileName + "'");
+	}
+
+	struct stat st;
+	fstat(file->fd, &st);
+
+	const size_t size = static_cast<size_t>(st.st_size);
+
+	if (size > 0)
+	{
+		file->mapping = mmap(nullptr, size, PROT_READ, MAP_SHARED, file->fd, 0);
+
+		if (file->mapping == MAP_FAILED)
+		{
+			throw std::runtime_error("Unable to map sample cache file '" + fileName + "'");
+		}
+
+		file->mappingSize = size;
+	}
+
+	// Index records. A record that does not fit in file ends it (it is being
+	// written, or the write was interrupted). A record whose trailer does not
+	// match was cut short by a failed write, and records of other processes
+	// follow it; indexing continues from the next whole record. Records are
+	// then not aligned, so values are copied from the mapping.
+
+	const char* data = static_cast<const char*>(file->mapping);
+	size_t offset = 0;
+
+	while (offset + sizeof(RecordHeader) <= size)
+	{
+		const size_t end = RecordEnd(data, size, offset);
+
+		if (end == 0)
+		{
+			size_t next = offset + 1;
+
+			while (next + sizeof(RecordHeader) <= size && RecordEnd(data, size, next) == 0)
+			{
+				next++;
+			}
+
+			Log(kLogWarning) << "Skipping " << next - offset << " bytes of partial record in sample cache file '"
+			                 << fileName << "' at offset " << offset;
+			offset = next;
+			continue;
+		}
+
+		if (end > size)
+		{
+			break;
+		}
+
+		RecordHeader header;
+		memcpy(&header, data + offset, sizeof(header));
+
+		const size_t keyOffset = offset + sizeof(RecordHeader);
+		const size_t valueOffset = keyOffset + Padded(header.keyLength);
+
+		file->mapped[std::string(data + keyOffset, header.keyLength)] =
+		    std::make_pair(data + valueOffset, static_cast<size_t>(header.count));
+
+		offset = end;
+	}
+
+	Log(kLogInfo) << "Sample cache file '" << fileName << "' has " << file->mapped.size() << " records";
+
+	return *itsFiles.emplace(originTime, std::move(file)).first->second;
+}
+
+bool SampleCache::Contains(const std::string& originTime, const std::string& key)
+{
+	std::lock_guard<std::mutex> lock(itsMutex);
+
+	File& file = Get(originTime);
+
+	return file.mapped.count(key) || file.stored.count(key);
+}
+
+bool SampleCache::Find(const std::string& originTime, const std::string& key, std::vector<double>& values)
+{
+	std::lock_guard<std::mutex> lock(itsMutex);
+
+	File& file = Get(originTime);
+
+	const auto mit = file.mapped.find(key);
+
+	if (mit != file.mapped.end())
+	{
+		values.resize(mit->second.second);
+		memcpy(values.data(), mit->second.first, values.size() * sizeof(double));
+		return true;
+	}
+
+	const auto sit = file.stored.find(key);
+
+	if (sit != file.stored.end())
+	{
+		values = sit->second;
+		return true;
+	}
+
+	return false;
+}
+
+void SampleCache::Store(const std::string& originTime, const std::string& key, const std::vector<double>& values)
+{
+	std::lock_guard<std::mutex> lock(itsMutex);
+
+	File& file = Get(originTime);
+
+	if (file.mapped.count(key) || file.stored.count(key))
+	{
+		return;
+	}
+
+	// Whole record with one write, so that records of concurrent writers do
+	// not mix
+
+	const RecordHeader header{kRecordMagic, static_cast<uint32_t>(key.size()), values.size()};
+	const size_t length = RecordLength(key.size(), values.size());
+	const RecordTrailer trailer{kRecordEndMagic, static_cast<uint32_t>(length)};
+
+	std::vector<char> record(length, 0);
+
+	memcpy(record.data(), &header, sizeof(header));
+	memcpy(record.data() + sizeof(header), key.data(), key.size());
+	memcpy(record.data() + sizeof(header) + Padded(key.size()), values.data(), values.size() * sizeof(double));
+	memcpy(record.data() + length - sizeof(trailer), &trailer, sizeof(trailer));
+
+	const ssize_t ret = write(file.fd, record.data(), record.size());
+
+	if (ret != static_cast<ssize_t>(record.size()))
+	{
+		// Partial record is skipped when file is indexed
+		Log(kLogWarning) << "Writing to sample cache failed for " << key;
+	}
+
+	file.stored[key] = values;
+}
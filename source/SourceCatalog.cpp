@@ -0,0 +1,438 @@
+#include "SourceCatalog.h"
+#include "Capture.h"
+#include "Logger.h"
+#include "NFmiRadonDB.h"
+#include "Options.h"
+#include "PreparedStatements.h"
+#include <algorithm>
+#include <cassert>
+#include <boost/algorithm/string.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/lexical_cast.hpp>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <sstream>
+
+extern Options opts;
+extern std::string GetEnv(const std::string& username);
+
+namespace
+{
+// Source data locations from radon
+
+class RadonCatalog : public SourceCatalog
+{
+public:
+	RadonCatalog();
+	~RadonCatalog();
+
+	bool Find(const SourceParam& src, SourceMessage& message) override;
+	std::vector<SourceMessage> FindMembers(const SourceParam& src, size_t members) override;
+
+private:
+	std::vector<std::vector<std::string>> GetGeometries(int producerId, const std::string& originTime);
+
+	std::unique_ptr<NFmiRadonDB> itsRadonDB;
+
+	// File location queries; there is one statement for each table.
+	// Statements are deallocated before connection goes back to pool, so
+	// the next user of connection starts with none.
+	std::unique_ptr<PreparedStatements> itsStatements;
+};
+
+std::once_flag oflag;
+
+RadonCatalog::RadonCatalog()
+{
+	call_once(
+	    oflag,
+	    [&]()
+	    {
+		    const auto pw = GetEnv("RADON_RADONCLIENT_PASSWORD");
+		    const auto hostname = GetEnv("RADON_HOSTNAME");
+
+		    if (pw.empty())
+		    {
+			    throw std::runtime_error("Password should be given with env variable 'RADON_RADONCLIENT_PASSWORD'");
+		    }
+
+		    if (hostname.empty())
+		    {
+			    throw std::runtime_error("Hostname should be given with env variable 'RADON_HOSTNAME'");
+		    }
+
+		    NFmiRadonDBPool::Instance()->Username("radon_client");
+		    NFmiRadonDBPool::Instance()->Password(pw);
+		    NFmiRadonDBPool::Instance()->Database("radon");
+		    NFmiRadonDBPool::Instance()->Hostname(hostname);
+	    });
+
+	itsRadonDB = std::unique_ptr<NFmiRadonDB>(NFmiRadonDBPool::Instance()->GetConnection());
+	itsStatements = std::unique_ptr<PreparedStatements>(new PreparedStatements(*itsRadonDB));
+}
+
+RadonCatalog::~RadonCatalog()
+{
+	// Return connection to pool
+	if (itsRadonDB)
+	{
+		try
+		{
+			itsStatements->Deallocate();
+		}
+		catch (const std::exception& e)
+		{
+			Log(kLogWarning) << "Deallocating prepared statements failed: " << e.what();
+		}
+
+		NFmiRadonDBPool::Instance()->Release(itsRadonDB.get());
+	}
+
+	// release unique_ptr ownership without calling destructor
+	itsRadonDB.release();
+}
+
+std::vector<std::vector<std::string>> RadonCatalog::GetGeometries(int producerId, const std::string& originTime)
+{
+	auto prodInfo = itsRadonDB->GetProducerDefinition(producerId);
+
+	assert(prodInfo.size());
+
+	auto gridgeoms = itsRadonDB->GetGridGeoms(prodInfo["ref_prod"], originTime);
+
+	assert(gridgeoms.size());
+
+	if (gridgeoms.size() > 1)
+	{
+		// order so that GLO is first, EUR second
+		std::sort(gridgeoms.begin(), gridgeoms.end(),
+		          [](const std::vector<std::string>& lhs, const std::vector<std::string>& rhs)
+		          {
+			          if (lhs[3].find("ECGLO") != std::string::npos && rhs[3].find("ECGLO") == std::string::npos)
+			          {
+				          return true;
+			          }
+			          if (lhs[3].find("ECEUR") != std::string::npos &&
+			              (rhs[3].find("ECGLO") == std::string::npos && rhs[3].find("ECEUR") == std::string::npos))
+			          {
+				          return true;
+			          }
+			          return false;
+		          });
+	}
+
+	return gridgeoms;
+}
+
+bool RadonCatalog::Find(const SourceParam& src, SourceMessage& message)
+{
+	const auto gridgeoms = GetGeometries(src.producerId, src.originTime);
+
+	for (const auto& geom : gridgeoms)
+	{
+		const std::string tableName = geom[1];
+
+		std::stringstream query;
+
+		// Table name comes from radon itself, everything else is a parameter
+
+		query << "SELECT param_name, level_name, level_value, extract(epoch from forecast_period) / 3600, "
+		      << "file_location, byte_offset, byte_length "
+		      << "FROM " << tableName << "_v "
+		      << "WHERE param_name = upper($1::text) "
+		      << "AND level_name = upper($2::text) "
+		      << "AND level_value = $3::double precision "
+		      << "AND extract(epoch from forecast_period) / 3600 = $4::int AND analysis_time = $5::timestamp"
+		      << " AND geometry_id = $6::int ORDER BY 4,2,3";
+
+		itsStatements->Query(query.str(),
+		                     {src.paramName, src.levelName, boost::lexical_cast<std::string>(src.levelValue),
+		                      std::to_string(src.step), src.originTime, geom[0]});
+
+		const auto row = itsRadonDB->FetchRow();
+
+		if (row.empty())
+		{
+			continue;
+		}
+
+		message = SourceMessage{0, row[4], row[5], row[6], geom[3]};
+		return true;  // stop on first grid found
+	}
+
+	return false;
+}
+
+std::vector<SourceMessage> RadonCatalog::FindMembers(const SourceParam& src, size_t members)
+{
+	const auto gridgeoms = GetGeometries(src.producerId, src.originTime);
+
+	std::vector<SourceMessage> ret;
+
+	for (const auto& geom : gridgeoms)
+	{
+		const std::string tableName = geom[1];
+
+		std::stringstream query;
+
+		// Control forecast is member 0, perturbed forecasts are members 1...N-1
+
+		query << "SELECT forecast_type_value, file_location, byte_offset, byte_length "
+		      << "FROM " << tableName << "_v "
+		      << "WHERE param_name = upper($1::text) "
+		      << "AND level_name = upper($2::text) "
+		      << "AND level_value = $3::double precision "
+		      << "AND extract(epoch from forecast_period) / 3600 = $4::int AND analysis_time = $5::timestamp"
+		      << " AND geometry_id = $6::int AND forecast_type_id IN (3, 4)"
+		      << " AND forecast_type_value < $7::int ORDER BY file_location, byte_offset";
+
+		itsStatements->Query(query.str(),
+		                     {src.paramName, src.levelName, boost::lexical_cast<std::string>(src.levelValue),
+		                      std::to_string(src.step), src.originTime, geom[0], std::to_string(members)});
+
+		while (true)
+		{
+			auto row = itsRadonDB->FetchRow();
+
+			if (row.empty())
+			{
+				break;
+			}
+
+			ret.push_back(SourceMessage{std::stoi(row[0]), row[1], row[2], row[3], geom[3]});
+		}
+
+		if (!ret.empty())
+		{
+			break;
+		}
+	}
+
+	return ret;
+}
+
+// Source data locations from a csv file, one grib message per line:
+//
+// producer_id,analysis_time,param_name,level_name,level_value,forecast_period,forecast_type_id,forecast_type_value,geometry_name,file_location,byte_offset,byte_length
+//
+// analysis_time is like 2024-01-01 00:00:00 and forecast_period in hours.
+// Offset and length can be empty if file has only one message. Geometries
+// are preferred in the order they first appear in file. Relative file
+// locations are relative to the directory of catalog. Lines starting with
+// '#' are comments.
+
+class LocalCatalog : public SourceCatalog
+{
+public:
+	LocalCatalog(const std::string& fileName);
+
+	bool Find(const SourceParam& src, SourceMessage& message) override;
+	std::vector<SourceMessage> FindMembers(const SourceParam& src, size_t members) override;
+
+private:
+	struct Entry
+	{
+		int geometry;  // order of preference
+		int forecastTypeId;
+		SourceMessage message;
+	};
+
+	static std::string Key(const SourceParam& src);
+
+	// Catalog is read once and shared by all workers
+	static std::map<std::string, std::vector<Entry>> itsEntries;
+	static std::once_flag itsLoadFlag;
+};
+
+std::map<std::string, std::vector<LocalCatalog::Entry>> LocalCatalog::itsEntries;
+std::once_flag LocalCatalog::itsLoadFlag;
+
+std::string LocalCatalog::Key(const SourceParam& src)
+{
+	return std::to_string(src.producerId) + "/" + src.originTime + "/" + boost::to_upper_copy(src.paramName) + "/" +
+	       boost::to_upper_copy(src.levelName) + "/" + boost::lexical_cast<std::string>(src.levelValue) + "/" +
+	       std::to_string(src.step);
+}
+
+LocalCatalog::LocalCatalog(const std::string& fileName)
+{
+	std::call_once(
+	    itsLoadFlag,
+	    [&]()
+	    {
+		    std::ifstream in(fileName);
+
+		    if (!in)
+		    {
+			    throw std::runtime_error("Unable to open source catalog '" + fileName + "'");
+		    }
+
+		    const std::string dir = boost::filesystem::path(fileName).parent_path().string();
+
+		    std::map<std::string, int> geometries;
+		    std::string line;
+		    size_t count = 0;
+
+		    while (std::getline(in, line))
+		    {
+			    boost::trim(line);
+
+			    if (line.empty() || line[0] == '#')
+			    {
+				    continue;
+			    }
+
+			    std::vector<std::string> cols;
+			    boost::split(cols, line, boost::is_any_of(","));
+
+			    if (cols.size() != 12)
+			    {
+				    throw std::runtime_error("Invalid line in source catalog '" + fileName + "': " + line);
+			    }
+
+			    SourceParam src;
+			    src.producerId = std::stoi(cols[0]);
+			    src.originTime = cols[1];
+			    src.paramName = cols[2];
+			    src.levelName = cols[3];
+			    src.levelValue = std::stod(cols[4]);
+			    src.step = std::stoi(cols[5]);
+
+			    const auto geom = geometries.emplace(cols[8], static_cast<int>(geometries.size())).first->second;
+
+			    std::string location = cols[9];
+
+			    if (!dir.empty() && !location.empty() && location[0] != '/')
+			    {
+				    location = dir + "/" + location;
+			    }
+
+			    itsEntries[Key(src)].push_back(Entry{
+			        geom, std::stoi(cols[6]), SourceMessage{std::stoi(cols[7]), location, cols[10], cols[11], cols[8]}});
+			    count++;
+		    }
+
+		    for (auto& it : itsEntries)
+		    {
+			    std::stable_sort(it.second.begin(), it.second.end(),
+			                     [](const Entry& a, const Entry& b) { return a.geometry < b.geometry; });
+		    }
+
+		    Log(kLogInfo) << "Read " << count << " grib messages from source catalog '" << fileName << "'";
+	    });
+}
+
+bool LocalCatalog::Find(const SourceParam& src, SourceMessage& message)
+{
+	const auto it = itsEntries.find(Key(src));
+
+	if (it == itsEntries.end())
+	{
+		return false;
+	}
+
+	for (const auto& e : it->second)
+	{
+		if (e.forecastTypeId != 3 && e.forecastTypeId != 4)
+		{
+			message = e.message;
+			message.member = 0;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+std::vector<SourceMessage> LocalCatalog::FindMembers(const SourceParam& src, size_t members)
+{
+	std::vector<SourceMessage> ret;
+
+	const auto it = itsEntries.find(Key(src));
+
+	if (it == itsEntries.end())
+	{
+		return ret;
+	}
+
+	int geometry = -1;
+
+	for (const auto& e : it->second)
+	{
+		if ((e.forecastTypeId != 3 && e.forecastTypeId != 4) || e.message.member < 0 ||
+		    static_cast<size_t>(e.message.member) >= members || (geometry != -1 && e.geometry != geometry))
+		{
+			continue;
+		}
+
+		geometry = e.geometry;
+		ret.push_back(e.message);
+	}
+
+	std::sort(ret.begin(), ret.end(),
+	          [](const SourceMessage& a, const SourceMessage& b)
+	          {
+		          if (a.fileLocation != b.fileLocation)
+		          {
+			          return a.fileLocation < b.fileLocation;
+		          }
+
+		          return (a.byteOffset.empty() ? 0 : std::stol(a.byteOffset)) <
+		                 (b.byteOffset.empty() ? 0 : std::stol(b.byteOffset));
+	          });
+
+	return ret;
+}
+
+// Records answers of another catalog with --capture
+
+class CapturingCatalog : public SourceCatalog
+{
+public:
+	explicit CapturingCatalog(std::unique_ptr<SourceCatalog> catalog) : itsCatalog(std::move(catalog)) {}
+
+	bool Find(const SourceParam& src, SourceMessage& message) override
+	{
+		if (!itsCatalog->Find(src, message))
+		{
+			return false;
+		}
+
+		Capture::Instance()->RecordMessages(src, {message}, false);
+		return true;
+	}
+
+	std::vector<SourceMessage> FindMembers(const SourceParam& src, size_t members) override
+	{
+		const auto ret = itsCatalog->FindMembers(src, members);
+
+		Capture::Instance()->RecordMessages(src, ret, true);
+		return ret;
+	}
+
+private:
+	std::unique_ptr<SourceCatalog> itsCatalog;
+};
+}  // namespace
+
+std::unique_ptr<SourceCatalog> SourceCatalog::Create()
+{
+	std::unique_ptr<SourceCatalog> catalog;
+
+	if (opts.sourceCatalog.empty())
+	{
+		catalog = std::unique_ptr<SourceCatalog>(new RadonCatalog());
+	}
+	else
+	{
+		catalog = std::unique_ptr<SourceCatalog>(new LocalCatalog(opts.sourceCatalog));
+	}
+
+	if (Capture::Instance()->Enabled())
+	{
+		return std::unique_ptr<SourceCatalog>(new CapturingCatalog(std::move(catalog)));
+	}
+
+	return catalog;
+}
@@ -0,0 +1,207 @@
+#include "SourceReader.h"
+#include "Logger.h"
+#include "TraceEvents.h"
+#include "NFmiGrib.h"
+#include <algorithm>
+#include <fcntl.h>
+#include <map>
+#include <numeric>
+#include <stdexcept>
+#include <unistd.h>
+
+namespace
+{
+// Byte range of consecutive messages in one file
+
+struct ReadRange
+{
+	std::string fileLocation;
+	size_t begin;
+	size_t end;
+	std::vector<size_t> messages;  // indices
+};
+
+size_t Offset(const SourceMessage& message)
+{
+	return message.byteOffset.empty() ? 0 : std::stoul(message.byteOffset);
+}
+
+size_t Length(const SourceMessage& message)
+{
+	return message.byteLength.empty() ? 0 : std::stoul(message.byteLength);
+}
+
+// Open files, closed at end of read
+
+class FileSet
+{
+public:
+	~FileSet()
+	{
+		for (const auto& it : itsFiles)
+		{
+			close(it.second);
+		}
+	}
+
+	int Get(const std::string& fileName)
+	{
+		auto it = itsFiles.find(fileName);
+
+		if (it == itsFiles.end())
+		{
+			const int fd = open(fileName.c_str(), O_RDONLY);
+
+			if (fd == -1)
+			{
+				throw std::runtime_error("File open failed for " + fileName);
+			}
+
+			it = itsFiles.emplace(fileName, fd).first;
+		}
+
+		return it->second;
+	}
+
+private:
+	std::map<std::string, int> itsFiles;
+};
+
+void ReadFully(int fd, unsigned char* buffer, size_t length, size_t offset, const std::string& fileName)
+{
+	size_t done = 0;
+
+	while (done < length)
+	{
+		const ssize_t ret = pread(fd, buffer + done, length - done, static_cast<off_t>(offset + done));
+
+		if (ret <= 0)
+		{
+			throw std::runtime_error("Read failed for " + fileName + " at offset " + std::to_string(offset + done));
+		}
+
+		done += static_cast<size_t>(ret);
+	}
+}
+}  // namespace
+
+void SourceReader::Read(const std::vector<SourceMessage>& messages, const MessageHandler& handler)
+{
+	if (messages.empty())
+	{
+		return;
+	}
+
+	std::vector<size_t> order(messages.size());
+	std::iota(order.begin(), order.end(), 0);
+
+	std::sort(order.begin(), order.end(),
+	          [&](size_t a, size_t b)
+	          {
+		          if (messages[a].fileLocation != messages[b].fileLocation)
+		          {
+			          return messages[a].fileLocation < messages[b].fileLocation;
+		          }
+
+		          return Offset(messages[a]) < Offset(messages[b]);
+	          });
+
+	// Messages without offset and length are the only message of their
+	// file, and read with grib library as before
+
+	std::vector<ReadRange> ranges;
+	std::vector<size_t> wholeFiles;
+
+	for (size_t i : order)
+	{
+		const SourceMessage& m = messages[i];
+
+		if (m.byteOffset.empty() && m.byteLength.empty())
+		{
+			wholeFiles.push_back(i);
+			continue;
+		}
+
+		const size_t begin = Offset(m);
+		const size_t end = begin + Length(m);
+
+		if (!ranges.empty())
+		{
+			ReadRange& last = ranges.back();
+
+			if (last.fileLocation == m.fileLocation && begin <= last.end + kMaxReadGap &&
+			    std::max(end, last.end) - last.begin <= kMaxReadSize)
+			{
+				last.end = std::max(end, last.end);
+				last.messages.push_back(i);
+				continue;
+			}
+		}
+
+		ranges.push_back(ReadRange{m.fileLocation, begin, end, {i}});
+	}
+
+	FileSet files;
+
+	// Tell the kernel about all ranges first, so that later ones are read
+	// ahead while earlier ones are decoded
+
+	size_t totalBytes = 0;
+
+	for (const auto& r : ranges)
+	{
+		posix_fadvise(files.Get(r.fileLocation), static_cast<off_t>(r.begin), static_cast<off_t>(r.end - r.begin),
+		              POSIX_FADV_WILLNEED);
+		totalBytes += r.end - r.begin;
+	}
+
+	if (!ranges.empty())
+	{
+		Log(kLogInfo) << "Reading " << (messages.size() - wholeFiles.size()) << " grib messages with "
+		              << ranges.size() << " reads (" << totalBytes / 1024 / 1024 << " MB)";
+	}
+
+	NFmiGrib reader;
+	std::vector<unsigned char> buffer;
+
+	for (const auto& r : ranges)
+	{
+		buffer.resize(r.end - r.begin);
+
+		{
+			TraceSpan span("grib read", -1, std::string(), r.fileLocation);
+			ReadFully(files.Get(r.fileLocation), buffer.data(), buffer.size(), r.begin, r.fileLocation);
+		}
+
+		for (size_t i : r.messages)
+		{
+			const SourceMessage& m = messages[i];
+
+			if (!reader.ReadMessage(buffer.data() + (Offset(m) - r.begin), Length(m)))
+			{
+				throw std::runtime_error("Invalid grib message in " + m.fileLocation + " at offset " + m.byteOffset);
+			}
+
+			handler(i, reader);
+		}
+	}
+
+	for (size_t i : wholeFiles)
+	{
+		const SourceMessage& m = messages[i];
+
+		if (!reader.Open(m.fileLocation))
+		{
+			throw std::runtime_error("File open failed for " + m.fileLocation);
+		}
+
+		Log(kLogInfo) << "Reading file '" << m.fileLocation << "'";
+
+		{
+			TraceSpan span("grib read", -1, std::string(), m.fileLocation);
+			reader.NextMessage();
+		}
+
+		handler(i, reader);
+	}
+}
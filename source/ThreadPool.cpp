@@ -0,0 +1,175 @@
+#include "ThreadPool.h"
+#include "TraceEvents.h"
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <memory>
+
+ThreadPool* ThreadPool::itsInstance = NULL;
+
+ThreadPool* ThreadPool::Instance()
+{
+	if (!itsInstance)
+	{
+		itsInstance = new ThreadPool();
+	}
+
+	return itsInstance;
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(itsMutex);
+		itsStopped = true;
+	}
+
+	itsCondition.notify_all();
+
+	for (auto& t : itsThreads)
+	{
+		t.join();
+	}
+}
+
+void ThreadPool::Start(size_t threadCount)
+{
+	for (size_t i = 0; i < threadCount; i++)
+	{
+		itsThreads.push_back(std::thread(&ThreadPool::Run, this));
+	}
+}
+
+size_t ThreadPool::Size() const
+{
+	return itsThreads.size();
+}
+
+void ThreadPool::Run()
+{
+	TraceEvents::Instance()->NameThread("station thread");
+
+	while (true)
+	{
+		std::function<void()> job;
+
+		{
+			std::unique_lock<std::mutex> lock(itsMutex);
+			itsCondition.wait(lock, [this]() { return itsStopped || !itsQueue.empty(); });
+
+			if (itsQueue.empty())
+			{
+				return;
+			}
+
+			job = std::move(itsQueue.front());
+			itsQueue.pop_front();
+		}
+
+		job();
+	}
+}
+
+namespace
+{
+struct ParallelForState
+{
+	size_t count;
+	size_t chunkSize;
+	size_t chunkCount;
+	const std::function<void(size_t, size_t)>* func;
+
+	std::atomic<size_t> next{0};
+	std::atomic<size_t> done{0};
+
+	std::mutex mutex;
+	std::condition_variable finished;
+	std::exception_ptr error;
+
+	// Process chunks until none is left
+	void Work()
+	{
+		size_t chunk;
+
+		while ((chunk = next++) < chunkCount)
+		{
+			const size_t begin = chunk * chunkSize;
+			const size_t end = std::min(count, begin + chunkSize);
+
+			try
+			{
+				TraceSpan span("stations");
+				(*func)(begin, end);
+			}
+			catch (...)
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+
+				if (!error)
+				{
+					error = std::current_exception();
+				}
+			}
+
+			if (++done == chunkCount)
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				finished.notify_all();
+			}
+		}
+	}
+};
+}  // namespace
+
+void ThreadPool::ParallelFor(size_t count, size_t minChunkSize, const std::function<void(size_t, size_t)>& func)
+{
+	if (count == 0)
+	{
+		return;
+	}
+
+	// A few chunks per thread evens out differences in chunk run times
+
+	const size_t maxChunks = std::max<size_t>(1, count / std::max<size_t>(1, minChunkSize));
+	const size_t chunkCount = std::min(maxChunks, 4 * (itsThreads.size() + 1));
+
+	if (itsThreads.empty() || chunkCount == 1)
+	{
+		func(0, count);
+		return;
+	}
+
+	auto state = std::make_shared<ParallelForState>();
+
+	state->count = count;
+	state->chunkCount = chunkCount;
+	state->chunkSize = (count + chunkCount - 1) / chunkCount;
+	state->chunkCount = (count + state->chunkSize - 1) / state->chunkSize;
+	state->func = &func;
+
+	// Helpers that start after all chunks are taken return immediately;
+	// func outlives them since this call waits for all chunks to finish
+
+	{
+		std::lock_guard<std::mutex> lock(itsMutex);
+
+		const size_t helpers = std::min(itsThreads.size(), state->chunkCount - 1);
+
+		for (size_t i = 0; i < helpers; i++)
+		{
+			itsQueue.push_back([state]() { state->Work(); });
+		}
+	}
+
+	itsCondition.notify_all();
+
+	state->Work();
+
+	std::unique_lock<std::mutex> lock(state->mutex);
+	state->finished.wait(lock, [&state]() { return state->done == state->chunkCount; });
+
+	if (state->error)
+	{
+		std::rethrow_exception(state->error);
+	}
+}
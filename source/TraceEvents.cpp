@@ -0,0 +1,261 @@
+#include "TraceEvents.h"
+#include "Logger.h"
+#include <algorithm>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
+
+bool TraceEvents::itsEnabled = false;
+
+namespace
+{
+struct Span
+{
+	const char* name;
+	std::chrono::steady_clock::time_point begin;
+	std::chrono::steady_clock::time_point end;
+	int step;
+	uint32_t param;  // interned strings
+	uint32_t key;
+};
+
+// Written only by owning thread; read by Write() when threads are idle
+
+struct ThreadBuffer
+{
+	static const size_t kCapacity = 1 << 18;
+
+	int id;
+	std::string name;
+	std::vector<Span> spans;  // grows up to kCapacity, then used as a ring
+	size_t next = 0;
+	size_t dropped = 0;
+
+	void Push(Span&& span)
+	{
+		if (spans.size() < kCapacity)
+		{
+			spans.push_back(std::move(span));
+			return;
+		}
+
+		spans[next] = std::move(span);
+		next = (next + 1) % kCapacity;
+		dropped++;
+	}
+};
+
+std::mutex buffersMutex;
+std::vector<std::shared_ptr<ThreadBuffer>> buffers;
+
+// Span arguments are few distinct strings (params, labels, files), so each
+// is stored once; threads look up ids from their own copy of the map and
+// lock only for strings they have not seen
+
+std::mutex stringsMutex;
+std::vector<std::string> strings{std::string()};
+std::unordered_map<std::string, uint32_t> stringIds{{std::string(), 0}};
+
+ThreadBuffer& LocalBuffer()
+{
+	thread_local std::shared_ptr<ThreadBuffer> buffer;
+
+	if (!buffer)
+	{
+		buffer = std::make_shared<ThreadBuffer>();
+
+		std::lock_guard<std::mutex> lock(buffersMutex);
+		buffer->id = static_cast<int>(buffers.size()) + 1;
+		buffers.push_back(buffer);
+	}
+
+	return *buffer;
+}
+
+void AppendEscaped(std::string& out, const std::string& str)
+{
+	out += '"';
+
+	for (char c : str)
+	{
+		if (c == '"' || c == '\\')
+		{
+			out += '\\';
+			out += c;
+		}
+		else if (static_cast<unsigned char>(c) < 0x20)
+		{
+			char buf[8];
+			snprintf(buf, sizeof(buf), "\\u%04x", c);
+			out += buf;
+		}
+		else
+		{
+			out += c;
+		}
+	}
+
+	out += '"';
+}
+
+// Microseconds since start of trace
+double Microseconds(std::chrono::steady_clock::duration d)
+{
+	return std::chrono::duration<double, std::micro>(d).count();
+}
+}  // namespace
+
+TraceEvents* TraceEvents::Instance()
+{
+	static TraceEvents instance;
+	return &instance;
+}
+
+void TraceEvents::Open(const std::string& fileName)
+{
+	itsFileName = fileName;
+	itsStart = std::chrono::steady_clock::now();
+	itsEnabled = true;
+}
+
+void TraceEvents::NameThread(const std::string& name)
+{
+	if (itsEnabled)
+	{
+		LocalBuffer().name = name;
+	}
+}
+
+uint32_t TraceEvents::Intern(const std::string& str)
+{
+	thread_local std::unordered_map<std::string, uint32_t> localIds;
+
+	if (str.empty())
+	{
+		return 0;
+	}
+
+	const auto it = localIds.find(str);
+
+	if (it != localIds.end())
+	{
+		return it->second;
+	}
+
+	std::lock_guard<std::mutex> lock(stringsMutex);
+
+	const auto ins = stringIds.emplace(str, static_cast<uint32_t>(strings.size()));
+
+	if (ins.second)
+	{
+		strings.push_back(str);
+	}
+
+	localIds.emplace(str, ins.first->second);
+
+	return ins.first->second;
+}
+
+void TraceEvents::Record(const char* name, std::chrono::steady_clock::time_point begin,
+                         std::chrono::steady_clock::time_point end, int step, uint32_t param, uint32_t key)
+{
+	LocalBuffer().Push(Span{name, begin, end, step, param, key});
+}
+
+void TraceEvents::Write()
+{
+	if (!itsEnabled)
+	{
+		return;
+	}
+
+	FILE* fp = fopen(itsFileName.c_str(), "w");
+
+	if (!fp)
+	{
+		throw std::runtime_error("Unable to open trace events file '" + itsFileName + "'");
+	}
+
+	std::lock_guard<std::mutex> lock(buffersMutex);
+	std::lock_guard<std::mutex> stringsLock(stringsMutex);
+
+	std::string out = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+	bool first = true;
+	size_t count = 0, dropped = 0;
+
+	for (const auto& buffer : buffers)
+	{
+		if (!buffer->name.empty())
+		{
+			out += first ? "" : ",\n";
+			out += "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" + std::to_string(buffer->id) +
+			       ",\"args\":{\"name\":";
+			AppendEscaped(out, buffer->name);
+			out += "}}";
+			first = false;
+		}
+
+		for (const auto& s : buffer->spans)
+		{
+			char times[64];
+			snprintf(times, sizeof(times), "\"ts\":%.3f,\"dur\":%.3f", Microseconds(s.begin - itsStart),
+			         Microseconds(s.end - s.begin));
+
+			out += first ? "" : ",\n";
+			out += "{\"name\":\"";
+			out += s.name;
+			out += "\",\"ph\":\"X\",\"pid\":1,\"tid\":" + std::to_string(buffer->id) + "," + times + ",\"args\":{";
+
+			bool firstArg = true;
+
+			if (s.step != -1)
+			{
+				out += "\"step\":" + std::to_string(s.step);
+				firstArg = false;
+			}
+
+			if (s.param != 0)
+			{
+				out += firstArg ? "\"param\":" : ",\"param\":";
+				AppendEscaped(out, strings[s.param]);
+				firstArg = false;
+			}
+
+			if (s.key != 0)
+			{
+				out += firstArg ? "\"key\":" : ",\"key\":";
+				AppendEscaped(out, strings[s.key]);
+			}
+
+			out += "}}";
+			first = false;
+
+			if (out.size() > (1 << 20))
+			{
+				fwrite(out.data(), 1, out.size(), fp);
+				out.clear();
+			}
+		}
+
+		count += buffer->spans.size();
+		dropped += buffer->dropped;
+	}
+
+	out += "\n]}\n";
+	fwrite(out.data(), 1, out.size(), fp);
+
+	if (fclose(fp) != 0)
+	{
+		throw std::runtime_error("Writing trace events file '" + itsFileName + "' failed");
+	}
+
+	Log(kLogInfo) << "Wrote " << count << " trace events to '" << itsFileName << "'";
+
+	if (dropped > 0)
+	{
+		Log(kLogWarning) << dropped << " oldest trace events were overwritten";
+	}
+}
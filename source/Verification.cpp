@@ -0,0 +1,296 @@
+#include "Verification.h"
+#include "Logger.h"
+#include <NFmiGlobals.h>
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <limits>
+#include <sstream>
+
+namespace
+{
+const size_t kWorstCount = 20;
+
+double Relative(double absolute, double reference, double candidate)
+{
+	const double scale = std::max(std::fabs(reference), std::fabs(candidate));
+	return scale == 0 ? 0 : absolute / scale;
+}
+}  // namespace
+
+Verification* Verification::itsInstance = NULL;
+
+Verification* Verification::Instance()
+{
+	if (!itsInstance)
+	{
+		itsInstance = new Verification();
+	}
+
+	return itsInstance;
+}
+
+bool Verification::Add(Stats& stats, std::vector<Offender>& worst, double reference, double candidate,
+                       const std::function<std::string()>& what)
+{
+	stats.count++;
+
+	const bool referenceMissing = (reference == kFloatMissing);
+	const bool candidateMissing = (candidate == kFloatMissing);
+
+	if (referenceMissing || candidateMissing)
+	{
+		if (referenceMissing == candidateMissing)
+		{
+			return false;
+		}
+
+		// Missing in only one path is always among the worst
+		stats.missingMismatches++;
+
+		const double inf = std::numeric_limits<double>::infinity();
+		KeepWorst(worst, Offender{inf, inf, reference, candidate, what()});
+
+		return true;
+	}
+
+	const double absolute = std::fabs(reference - candidate);
+
+	if (absolute == 0)
+	{
+		return false;
+	}
+
+	const double relative = Relative(absolute, reference, candidate);
+
+	stats.maxAbsolute = std::max(stats.maxAbsolute, absolute);
+	stats.maxRelative = std::max(stats.maxRelative, relative);
+	stats.sumAbsolute += absolute;
+
+	if (worst.size() < kWorstCount || absolute > worst.back().absolute)
+	{
+		KeepWorst(worst, Offender{absolute, relative, reference, candidate, what()});
+	}
+
+	return true;
+}
+
+void Verification::Compare(const MosInfo& mosInfo, int step, const WeightTable& table, const TaskValues& reference,
+                           const TaskValues& candidate, double referenceSeconds, double candidateSeconds)
+{
+	std::lock_guard<std::mutex> lock(itsMutex);
+
+	itsTasks++;
+	itsReferenceSeconds += referenceSeconds;
+	itsCandidateSeconds += candidateSeconds;
+
+	std::stringstream fileName;
+	fileName << "verify_" << (mosInfo.outputTag.empty() ? "" : mosInfo.outputTag + "_") << mosInfo.paramName << "_"
+	         << std::setw(3) << std::setfill('0') << step << ".csv";
+
+	std::ofstream out(fileName.str());
+	out << std::setprecision(std::numeric_limits<double>::max_digits10);
+	out << "# station_id,wmo_id,predictor,member,reference,candidate,absolute_difference,relative_difference"
+	    << std::endl;
+
+	const bool ensemble = !reference.memberValues.empty();
+	const size_t members = ensemble ? static_cast<size_t>(mosInfo.ensembleSize) : 1;
+
+	size_t differences = 0;
+
+	auto Row = [&](const Station& station, const std::string& what, size_t member, double ref, double cand)
+	{
+		const bool missing = (ref == kFloatMissing) != (cand == kFloatMissing);
+		const double absolute = std::fabs(ref - cand);
+
+		out << station.id << "," << station.wmoId << "," << what << "," << member << "," << ref << "," << cand << ","
+		    << (missing ? "missing" : std::to_string(absolute)) << ","
+		    << (missing ? "missing" : std::to_string(Relative(absolute, ref, cand))) << "\n";
+
+		differences++;
+	};
+
+	// Predictors
+
+	for (size_t s = 0; s < table.Size(); s++)
+	{
+		const Station& station = table.Stations()[s];
+		const auto& params = table.Params(s);
+		const size_t offset = table.Offset(s);
+
+		for (size_t i = 0; i < params.size(); i++)
+		{
+			std::stringstream key;
+			key << params[i];
+
+			auto& stats = itsPredictorStats[key.str()];
+
+			for (size_t m = 0; m < members; m++)
+			{
+				const size_t k = offset + i;
+				const double ref = ensemble ? reference.memberValues[k * members + m] : reference.values[k];
+				const double cand = ensemble ? candidate.memberValues[k * members + m] : candidate.values[k];
+
+				const auto what = [&]()
+				{
+					return "station " + std::to_string(station.id) + " " + station.name + " " + key.str() +
+					       (ensemble ? " member " + std::to_string(m) : "");
+				};
+
+				if (Add(stats, itsWorstPredictors, ref, cand, what))
+				{
+					Row(station, key.str(), m, ref, cand);
+				}
+			}
+		}
+	}
+
+	// Outputs. A station that has results in only one path is always among
+	// the worst, whatever its values.
+
+	auto MissingStation = [&](const Station& station, double ref, double cand, const std::string& path)
+	{
+		itsOutputStats.count++;
+		itsOutputStats.missingMismatches++;
+
+		const double inf = std::numeric_limits<double>::infinity();
+		KeepWorst(itsWorstOutputs, Offender{inf, inf, ref, cand,
+		                                    "station " + std::to_string(station.id) + " " + station.name + " " +
+		                                        mosInfo.paramName + " step " + std::to_string(step) + " not in " +
+		                                        path + " results"});
+
+		out << station.id << "," << station.wmoId << ",output,0," << ref << "," << cand << ",missing,missing\n";
+		differences++;
+	};
+
+	for (const auto& it : candidate.results)
+	{
+		if (reference.results.find(it.first) == reference.results.end())
+		{
+			MissingStation(it.first, kFloatMissing, it.second.value, "reference");
+		}
+	}
+
+	for (const auto& it : reference.results)
+	{
+		const Station& station = it.first;
+		const Result& ref = it.second;
+
+		const auto cit = candidate.results.find(station);
+
+		if (cit == candidate.results.end())
+		{
+			MissingStation(station, ref.value, kFloatMissing, "candidate");
+			continue;
+		}
+
+		const Result& cand = cit->second;
+
+		const std::vector<double> refValues = ensemble ? ref.memberValues : std::vector<double>{ref.value};
+		const std::vector<double> candValues = ensemble ? cand.memberValues : std::vector<double>{cand.value};
+
+		for (size_t m = 0; m < refValues.size() && m < candValues.size(); m++)
+		{
+			const auto what = [&]()
+			{
+				return "station " + std::to_string(station.id) + " " + station.name + " " + mosInfo.paramName +
+				       " step " + std::to_string(step) + (ensemble ? " member " + std::to_string(m) : "");
+			};
+
+			if (Add(itsOutputStats, itsWorstOutputs, refValues[m], candValues[m], what))
+			{
+				Row(station, "output", m, refValues[m], candValues[m]);
+			}
+		}
+	}
+
+	Log(kLogInfo) << "Verification of " << mosInfo.paramName << " step " << step << ": " << differences
+	              << " differing values, reference " << referenceSeconds << " s, candidate " << candidateSeconds
+	              << " s, details in '" << fileName.str() << "'";
+}
+
+bool Verification::Report(const std::string& pathName, double tolerance)
+{
+	std::lock_guard<std::mutex> lock(itsMutex);
+
+	auto Summary = [](const Stats& stats)
+	{
+		std::stringstream ss;
+		ss << stats.count << " values, max absolute difference " << stats.maxAbsolute << ", max relative difference "
+		   << stats.maxRelative << ", mean absolute difference "
+		   << (stats.count ? stats.sumAbsolute / static_cast<double>(stats.count) : 0) << ", missing in one path "
+		   << stats.missingMismatches;
+		return ss.str();
+	};
+
+	Log(kLogInfo) << "Verification of '" << pathName << "' against reference, " << itsTasks << " tasks";
+	Log(kLogInfo) << "Time: reference " << itsReferenceSeconds << " s, " << pathName << " " << itsCandidateSeconds
+	              << " s (speedup " << (itsCandidateSeconds > 0 ? itsReferenceSeconds / itsCandidateSeconds : 0)
+	              << "x)";
+	Log(kLogInfo) << "Outputs: " << Summary(itsOutputStats);
+
+	// Predictors in order of largest difference
+
+	std::vector<std::pair<std::string, Stats>> predictors(itsPredictorStats.begin(), itsPredictorStats.end());
+	std::stable_sort(predictors.begin(), predictors.end(),
+	                 [](const std::pair<std::string, Stats>& a, const std::pair<std::string, Stats>& b)
+	                 {
+		                 if (a.second.missingMismatches != b.second.missingMismatches)
+		                 {
+			                 return a.second.missingMismatches > b.second.missingMismatches;
+		                 }
+		                 return a.second.maxAbsolute > b.second.maxAbsolute;
+	                 });
+
+	for (const auto& it : predictors)
+	{
+		Log(kLogInfo) << "Predictor " << it.first << ": " << Summary(it.second);
+	}
+
+	auto Worst = [](const std::string& title, const std::vector<Offender>& worst)
+	{
+		if (worst.empty())
+		{
+			return;
+		}
+
+		Log(kLogInfo) << "Worst " << title << ":";
+
+		for (const auto& o : worst)
+		{
+			Log(kLogInfo) << "  " << o.what << ": reference " << o.reference << ", candidate " << o.candidate
+			              << ", absolute difference " << o.absolute << ", relative difference " << o.relative;
+		}
+	};
+
+	Worst("outputs", itsWorstOutputs);
+	Worst("predictors", itsWorstPredictors);
+
+	if (tolerance < 0)
+	{
+		return true;
+	}
+
+	const bool ok = (itsOutputStats.missingMismatches == 0 && itsOutputStats.maxAbsolute <= tolerance);
+
+	if (!ok)
+	{
+		Log(kLogError) << "Outputs differ more than tolerance " << tolerance;
+	}
+
+	return ok;
+}
+
+void Verification::KeepWorst(std::vector<Offender>& worst, Offender offender)
+{
+	const auto pos = std::upper_bound(worst.begin(), worst.end(), offender,
+	                                  [](const Offender& a, const Offender& b) { return a.absolute > b.absolute; });
+
+	worst.insert(pos, offender);
+
+	if (worst.size() > kWorstCount)
+	{
+		worst.pop_back();
+	}
+}
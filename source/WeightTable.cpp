@@ -0,0 +1,225 @@
+#include "WeightTable.h"
+#include <algorithm>
+#include <boost/algorithm/string.hpp>
+#include <boost/lexical_cast.hpp>
+#include <cassert>
+#include <deque>
+#include <mutex>
+#include <stdexcept>
+
+namespace
+{
+std::mutex predictorsMutex;
+std::deque<ParamLevel> predictors;  // references stay valid when added to
+std::map<std::string, PredictorId> predictorIds;
+}  // namespace
+
+PredictorId InternPredictor(const std::string& key, const ParamLevel& pl)
+{
+	std::lock_guard<std::mutex> lock(predictorsMutex);
+
+	const auto it = predictorIds.find(key);
+
+	if (it != predictorIds.end())
+	{
+		return it->second;
+	}
+
+	predictors.push_back(pl);
+
+	return predictorIds.emplace(key, static_cast<PredictorId>(predictors.size() - 1)).first->second;
+}
+
+const ParamLevel& Predictor(PredictorId id)
+{
+	std::lock_guard<std::mutex> lock(predictorsMutex);
+	return predictors.at(id);
+}
+
+Weight WeightTable::ToWeight(size_t station, const double* weights, const double* values) const
+{
+	const auto& params = Params(station);
+	const size_t offset = Offset(station);
+
+	const auto& ids = PredictorIds(station);
+
+	Weight w;
+
+	w.params.assign(ids.begin(), ids.end());
+	w.weights.assign(weights + offset, weights + offset + params.size());
+	w.values.assign(values + offset, values + offset + params.size());
+
+	w.periodId = itsPeriodId;
+	w.step = itsStep;
+
+	return w;
+}
+
+std::shared_ptr<const WeightTable> WeightTable::Slice(size_t begin, size_t end) const
+{
+	auto table = std::make_shared<WeightTable>();
+
+	table->itsPeriodId = itsPeriodId;
+	table->itsStep = itsStep;
+
+	std::map<size_t, size_t> sets;  // old index -> new index
+
+	for (size_t i = begin; i < end && i < Size(); i++)
+	{
+		auto it = sets.find(itsStationSets[i]);
+
+		if (it == sets.end())
+		{
+			table->itsPredictorSets.push_back(itsPredictorSets[itsStationSets[i]]);
+			table->itsPredictorIdSets.push_back(itsPredictorIdSets[itsStationSets[i]]);
+			it = sets.emplace(itsStationSets[i], table->itsPredictorSets.size() - 1).first;
+		}
+
+		const size_t count = Params(i).size();
+
+		table->itsStations.push_back(itsStations[i]);
+		table->itsStationSets.push_back(it->second);
+		table->itsOffsets.push_back(table->itsWeights.size());
+		table->itsWeights.insert(table->itsWeights.end(), itsWeights.begin() + static_cast<std::ptrdiff_t>(itsOffsets[i]),
+		                         itsWeights.begin() + static_cast<std::ptrdiff_t>(itsOffsets[i] + count));
+	}
+
+	return table;
+}
+
+void WeightTableBuilder::Add(const Station& station, const std::vector<std::string>& paramKeys,
+                             const std::vector<double>& weights)
+{
+	if (paramKeys.size() != weights.size())
+	{
+		throw std::runtime_error("Number of predictors and weights differ for station " + std::to_string(station.id));
+	}
+
+	auto it = itsSetIndex.find(paramKeys);
+
+	if (it == itsSetIndex.end())
+	{
+		std::vector<ParamLevel> params;
+		std::vector<PredictorId> ids;
+		params.reserve(paramKeys.size());
+
+		for (const auto& key : paramKeys)
+		{
+			params.emplace_back(key);
+			ids.push_back(InternPredictor(key, params.back()));
+		}
+
+		itsPredictorSets.push_back(params);
+		itsPredictorIdSets.push_back(ids);
+		it = itsSetIndex.emplace(paramKeys, itsPredictorSets.size() - 1).first;
+	}
+
+	itsEntries.push_back(Entry{station, it->second, itsWeights.size()});
+	itsWeights.insert(itsWeights.end(), weights.begin(), weights.end());
+}
+
+std::shared_ptr<const WeightTable> WeightTableBuilder::Build(int periodId, int step)
+{
+	// Same order as in std::map<Station, ...>; of duplicates the last one
+	// added is kept
+
+	std::stable_sort(itsEntries.begin(), itsEntries.end(),
+	                 [](const Entry& a, const Entry& b) { return a.station < b.station; });
+
+	auto table = std::make_shared<WeightTable>();
+
+	table->itsPeriodId = periodId;
+	table->itsStep = step;
+	table->itsPredictorSets = itsPredictorSets;
+	table->itsPredictorIdSets = itsPredictorIdSets;
+
+	for (size_t i = 0; i < itsEntries.size(); i++)
+	{
+		if (i + 1 < itsEntries.size() && itsEntries[i].station == itsEntries[i + 1].station)
+		{
+			continue;
+		}
+
+		const Entry& e = itsEntries[i];
+		const size_t count = itsPredictorSets[e.set].size();
+
+		table->itsStations.push_back(e.station);
+		table->itsStationSets.push_back(e.set);
+		table->itsOffsets.push_back(table->itsWeights.size());
+		table->itsWeights.insert(table->itsWeights.end(), itsWeights.begin() + static_cast<std::ptrdiff_t>(e.offset),
+		                         itsWeights.begin() + static_cast<std::ptrdiff_t>(e.offset + count));
+	}
+
+	itsEntries.clear();
+	itsWeights.clear();
+
+	return table;
+}
+
+int PeriodIdFromDate(const AnalysisTime& date)
+{
+	const int month = date.Month();
+	int day = date.Day();
+
+	if (month == 2 && day == 29)
+	{
+		// LOL karkauspäivä
+		day = 28;
+	}
+
+	if (month == 12 || month < 3)
+		return 1;
+	if (month >= 3 && month < 6)
+		return 2;
+	if (month >= 6 && month < 9)
+		return 3;
+	if (month >= 9 && month < 12)
+		return 4;
+
+	return 0;  // for compiler
+}
+
+bool ParseWeightsLine(const std::string& line, WeightsFileLine& out)
+{
+	if (line.empty() || line[0] == '#')
+	{
+		return false;
+	}
+
+	boost::split(out.columns, line, boost::is_any_of(","));
+
+	if (out.columns.size() < 7)
+	{
+		throw std::runtime_error("Invalid line in weights file: " + line);
+	}
+
+	const auto& cols = out.columns;
+
+	out.periodId = std::stoi(cols[0]);
+	out.analysisHour = std::stoi(cols[1]);
+	out.station.id = std::stoi(cols[2]);
+	out.station.wmoId = out.station.id;
+	out.station.longitude = std::stod(cols[3]);
+	out.station.latitude = std::stod(cols[4]);
+	out.step = std::stoi(cols[5]);
+	out.targetParam = cols[6];
+
+	return true;
+}
+
+void ParseWeights(const WeightsFileLine& line, std::vector<std::string>& keys, std::vector<double>& weights)
+{
+	const auto& cols = line.columns;
+
+	keys.clear();
+	weights.clear();
+
+	for (size_t i = 7; i + 1 < cols.size(); i += 2)
+	{
+		double val = boost::lexical_cast<double>(cols[i + 1]);
+		assert(val == val);  // no NaN
+
+		keys.push_back(cols[i]);
+		weights.push_back(val);
+	}
+}
@@ -0,0 +1,493 @@
+// Micro benchmarks of the hot spots of mosse. Each case is run several
+// times and the fastest and median run are reported, one line per case, as
+// csv or json.
+//
+// mosse-microbench --grid 1801x901 --stations 5000 --predictors 30 --format json
+
+#include "Factor.h"
+#include "Logger.h"
+#include "MosInterpolator.h"
+#include "NFmiGrib.h"
+#include "Stencil.h"
+#include "WeightTable.h"
+#include <NFmiLatLonArea.h>
+#include <NFmiMetTime.h>
+#include <NFmiQueryData.h>
+#include <NFmiQueryDataUtil.h>
+#include <NFmiTimeList.h>
+#include <algorithm>
+#include <boost/program_options.hpp>
+#include <chrono>
+#include <iostream>
+#include <numeric>
+#include <random>
+
+#include "Options.h"
+
+// Globals of mosse
+Options opts;
+WeightStore allWeights;
+
+// From other translation units of mosse
+std::string ToHstore(const Weight::Predictors& keys, const Weight::Values& values);
+std::string ToString(boost::posix_time::ptime p, const std::string& timeMask);
+boost::posix_time::ptime ToPtime(const std::string& time, const std::string& timeMask);
+datas ToQueryInfo(const ParamLevel& pl, int step, NFmiGrib& reader, bool regrid);
+datas InterpolateToGrid(NFmiFastQueryInfo& sourceInfo, double distanceBetweenGridPointsInDegrees);
+datas InterpolateToGridWithTable(NFmiFastQueryInfo& sourceInfo, double distanceBetweenGridPointsInDegrees);
+
+namespace
+{
+struct BenchOptions
+{
+	int ni = 501;
+	int nj = 371;
+	size_t stations = 5000;
+	size_t predictors = 30;
+	int repeat = 5;
+	std::string filter;
+	std::string format = "csv";
+	std::string grib;
+};
+
+BenchOptions bopts;
+
+// Keeps results alive so that the compiler does not remove the work
+volatile double sink;
+
+void Report(const std::string& name, size_t operations, std::vector<double> seconds)
+{
+	std::sort(seconds.begin(), seconds.end());
+
+	const double best = seconds.front();
+	const double median = seconds[seconds.size() / 2];
+	const double ops = static_cast<double>(operations);
+
+	if (bopts.format == "json")
+	{
+		std::cout << "{\"case\":\"" << name << "\",\"ni\":" << bopts.ni << ",\"nj\":" << bopts.nj
+		          << ",\"stations\":" << bopts.stations << ",\"predictors\":" << bopts.predictors
+		          << ",\"operations\":" << operations << ",\"best_s\":" << best << ",\"median_s\":" << median
+		          << ",\"best_ns_per_op\":" << best * 1e9 / ops << ",\"median_ns_per_op\":" << median * 1e9 / ops
+		          << "}" << std::endl;
+	}
+	else
+	{
+		std::cout << name << "," << bopts.ni << "," << bopts.nj << "," << bopts.stations << "," << bopts.predictors
+		          << "," << operations << "," << best << "," << median << "," << best * 1e9 / ops << ","
+		          << median * 1e9 / ops << std::endl;
+	}
+}
+
+// Run func (which does 'operations' operations) bopts.repeat times
+
+void Bench(const std::string& name, size_t operations, const std::function<void()>& func)
+{
+	if (!bopts.filter.empty() && name.find(bopts.filter) == std::string::npos)
+	{
+		return;
+	}
+
+	std::vector<double> seconds;
+
+	for (int r = 0; r < bopts.repeat; r++)
+	{
+		const auto start = std::chrono::steady_clock::now();
+		func();
+		const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+		seconds.push_back(elapsed.count());
+	}
+
+	Report(name, operations, seconds);
+}
+
+// Predictor keys like in weights files
+
+std::vector<std::string> PredictorKeys()
+{
+	const std::vector<std::string> params = {"T-K", "TD-K", "RH-PRCNT", "Z-M2S2", "VV-PAS", "U-MS", "V-MS"};
+	const std::vector<int> levels = {1000, 925, 850, 700, 500};
+
+	std::vector<std::string> keys;
+
+	for (size_t i = 0; i < bopts.predictors; i++)
+	{
+		if (i % 4 == 0)
+		{
+			keys.push_back(params[i % params.size()] + "/GROUND/0");
+		}
+		else
+		{
+			keys.push_back(params[i % params.size()] + "/PRESSURE/" + std::to_string(levels[i % levels.size()]) +
+			               (i % 3 == 0 ? "/-1" : ""));
+		}
+	}
+
+	return keys;
+}
+
+// Smooth field on a regular lat-lon grid over Europe
+
+datas SyntheticField(int ni, int nj)
+{
+	NFmiTimeList tlist;
+	tlist.Add(new NFmiMetTime(20240101, 0));
+
+	NFmiTimeDescriptor tdesc(tlist.FirstTime(), tlist);
+
+	NFmiParamBag pbag;
+	NFmiParam p(1, "T-K");
+	p.InterpolationMethod(kLinearly);
+	pbag.Add(NFmiDataIdent(p));
+
+	NFmiParamDescriptor pdesc(pbag);
+	NFmiLevelBag lbag(kFmiAnyLevelType, 0, 0, 0);
+	NFmiVPlaceDescriptor vdesc(lbag);
+
+	NFmiLatLonArea area(NFmiPoint(-10, 35), NFmiPoint(40, 72));
+	NFmiGrid grid(&area, static_cast<unsigned long>(ni), static_cast<unsigned long>(nj), kBottomLeft, kLinearly);
+	NFmiHPlaceDescriptor hdesc(grid);
+
+	NFmiFastQueryInfo qi(pdesc, tdesc, hdesc, vdesc);
+
+	auto data = std::shared_ptr<NFmiQueryData>(NFmiQueryDataUtil::CreateEmptyData(qi));
+
+	NFmiFastQueryInfo info(data.get());
+	info.First();
+
+	for (info.ResetLocation(); info.NextLocation();)
+	{
+		const NFmiPoint latlon = info.LatLon();
+		info.FloatValue(static_cast<float>(273.15 + 10 * std::sin(0.1 * latlon.X()) * std::cos(0.1 * latlon.Y())));
+	}
+
+	return std::make_pair(data, info);
+}
+
+std::vector<NFmiPoint> Stations()
+{
+	std::mt19937 gen(1);
+	std::uniform_real_distribution<double> lon(-9, 39);
+	std::uniform_real_distribution<double> lat(36, 71);
+
+	std::vector<NFmiPoint> ret;
+
+	for (size_t i = 0; i < bopts.stations; i++)
+	{
+		ret.emplace_back(lon(gen), lat(gen));
+	}
+
+	return ret;
+}
+
+void ParseCommandLine(int argc, char** argv)
+{
+	namespace po = boost::program_options;
+
+	std::string gridSize;
+
+	po::options_description desc("Allowed options");
+
+	// clang-format off
+	desc.add_options()
+		("help,h", "print out help message")
+		("grid", po::value(&gridSize), "synthetic grid size, NIxNJ (default 501x371)")
+		("stations", po::value(&bopts.stations), "number of stations (default 5000)")
+		("predictors", po::value(&bopts.predictors), "number of predictors per station (default 30)")
+		("repeat", po::value(&bopts.repeat), "runs of each case; best and median are reported (default 5)")
+		("filter", po::value(&bopts.filter), "run only cases whose name contains this")
+		("format", po::value(&bopts.format), "csv or json (default csv)")
+		("grib", po::value(&bopts.grib), "grib file for the decode case (first message is used)")
+		;
+	// clang-format on
+
+	po::variables_map opt;
+	po::store(po::parse_command_line(argc, argv, desc), opt);
+	po::notify(opt);
+
+	if (opt.count("help"))
+	{
+		std::cout << "usage: mosse-microbench [ options ]" << std::endl;
+		std::cout << desc;
+		exit(0);
+	}
+
+	if (!gridSize.empty() && sscanf(gridSize.c_str(), "%dx%d", &bopts.ni, &bopts.nj) != 2)
+	{
+		std::cerr << "Invalid grid size: " << gridSize << std::endl;
+		exit(1);
+	}
+
+	if (bopts.repeat < 1 || bopts.ni < 2 || bopts.nj < 2 || bopts.predictors == 0)
+	{
+		std::cerr << "Invalid parameters" << std::endl;
+		exit(1);
+	}
+}
+}  // namespace
+
+int main(int argc, char** argv)
+{
+	ParseCommandLine(argc, argv);
+
+	Logger::Instance()->Start(kLogWarning, 0);
+
+	if (bopts.format != "json")
+	{
+		std::cout << "case,ni,nj,stations,predictors,operations,best_s,median_s,best_ns_per_op,median_ns_per_op"
+		          << std::endl;
+	}
+
+	const auto keys = PredictorKeys();
+	const size_t n = bopts.stations * bopts.predictors;
+
+	std::vector<ParamLevel> params;
+
+	for (const auto& key : keys)
+	{
+		params.emplace_back(key);
+	}
+
+	const AnalysisTime originTime = AnalysisTime::Parse("2024-01-01 00:00:00");
+
+	// String handling
+
+	Bench("param_level_parse", n,
+	      [&]()
+	      {
+		      double sum = 0;
+
+		      for (size_t s = 0; s < bopts.stations; s++)
+		      {
+			      for (const auto& key : keys)
+			      {
+				      sum += ParamLevel(key).levelValue;
+			      }
+		      }
+
+		      sink = sum;
+	      });
+
+	Bench("key", n,
+	      [&]()
+	      {
+		      size_t sum = 0;
+
+		      for (size_t s = 0; s < bopts.stations; s++)
+		      {
+			      for (const auto& pl : params)
+			      {
+				      sum += Key(pl, 24, originTime).size();
+			      }
+		      }
+
+		      sink = static_cast<double>(sum);
+	      });
+
+	Bench("to_ptime_to_string", bopts.stations,
+	      [&]()
+	      {
+		      size_t sum = 0;
+
+		      for (size_t s = 0; s < bopts.stations; s++)
+		      {
+			      sum += ToString(ToPtime("2024-01-01 12:00:00", "%Y-%m-%d %H:%M:%S"), "%Y-%m-%d %H:%M:%S").size();
+		      }
+
+		      sink = static_cast<double>(sum);
+	      });
+
+	Bench("analysis_time_shift", bopts.stations,
+	      [&]()
+	      {
+		      size_t sum = 0;
+
+		      for (size_t s = 0; s < bopts.stations; s++)
+		      {
+			      const AnalysisTime t = originTime.Shifted(static_cast<int>(s % 240));
+			      sum += t.ToString().size() + static_cast<size_t>(t.DayOfYear());
+		      }
+
+		      sink = static_cast<double>(sum);
+	      });
+
+	Bench("to_hstore", bopts.stations,
+	      [&]()
+	      {
+		      Weight::Predictors ids;
+		      Weight::Values values(params.size());
+		      std::iota(values.begin(), values.end(), 0.5);
+
+		      for (size_t i = 0; i < params.size(); i++)
+		      {
+			      ids.push_back(InternPredictor(keys[i], params[i]));
+		      }
+
+		      size_t sum = 0;
+
+		      for (size_t s = 0; s < bopts.stations; s++)
+		      {
+			      sum += ToHstore(ids, values).size();
+		      }
+
+		      sink = static_cast<double>(sum);
+	      });
+
+	std::string weightsLine = "1,0,2974,24.96,60.32,24,T-K";
+
+	for (const auto& key : keys)
+	{
+		weightsLine += "," + key + ",0.123456789";
+	}
+
+	Bench("weights_line_parse", bopts.stations,
+	      [&]()
+	      {
+		      WeightsFileLine parsed;
+		      std::vector<std::string> lineKeys;
+		      std::vector<double> weights;
+
+		      for (size_t s = 0; s < bopts.stations; s++)
+		      {
+			      ParseWeightsLine(weightsLine, parsed);
+			      ParseWeights(parsed, lineKeys, weights);
+		      }
+
+		      sink = weights[0];
+	      });
+
+	// Grids
+
+	if (!bopts.grib.empty())
+	{
+		NFmiGrib reader;
+
+		Bench("grib_decode", 1,
+		      [&]()
+		      {
+			      if (!reader.Open(bopts.grib) || !reader.NextMessage())
+			      {
+				      throw std::runtime_error("Unable to read grib from " + bopts.grib);
+			      }
+
+			      auto d = ToQueryInfo(params[0], 0, reader, false);
+			      sink = d.second.FloatValue();
+		      });
+	}
+
+	auto field = SyntheticField(bopts.ni, bopts.nj);
+	const size_t gridPoints = static_cast<size_t>(bopts.ni) * static_cast<size_t>(bopts.nj);
+
+	Bench("interpolate_to_grid", gridPoints,
+	      [&]()
+	      {
+		      auto d = InterpolateToGrid(field.second, 0.125);
+		      sink = d.second.FloatValue();
+	      });
+
+	Bench("interpolate_to_grid_table", gridPoints,
+	      [&]()
+	      {
+		      auto d = InterpolateToGridWithTable(field.second, 0.125);
+		      sink = d.second.FloatValue();
+	      });
+
+	// Regrid table must give the reference result within float rounding
+
+	int ret = 0;
+
+	if (bopts.filter.empty() || std::string("interpolate_to_grid_table").find(bopts.filter) != std::string::npos)
+	{
+		const auto reference = InterpolateToGrid(field.second, 0.125).second.Values();
+		const auto table = InterpolateToGridWithTable(field.second, 0.125).second.Values();
+
+		size_t differences = 0;
+		double maxDifference = 0;
+
+		for (size_t i = 0; i < reference.size() && i < table.size(); i++)
+		{
+			if ((reference[i] == kFloatMissing) != (table[i] == kFloatMissing))
+			{
+				differences++;
+				continue;
+			}
+
+			const double diff = std::fabs(static_cast<double>(reference[i]) - table[i]);
+			maxDifference = std::max(maxDifference, diff);
+
+			if (diff > 1e-5 * std::max(1.0, std::fabs(static_cast<double>(reference[i]))))
+			{
+				differences++;
+			}
+		}
+
+		if (reference.size() != table.size() || differences > 0)
+		{
+			std::cerr << "interpolate_to_grid_table differs from reference: " << table.size() << " vs "
+			          << reference.size() << " points, " << differences << " differ, largest difference "
+			          << maxDifference << std::endl;
+			ret = 1;
+		}
+	}
+
+	const auto stations = Stations();
+
+	Bench("interpolated_value", bopts.stations,
+	      [&]()
+	      {
+		      double sum = 0;
+
+		      for (const auto& latlon : stations)
+		      {
+			      sum += field.second.InterpolatedValue(latlon);
+		      }
+
+		      sink = sum;
+	      });
+
+	std::vector<Stencil> stencils;
+
+	Bench("make_stencil", bopts.stations,
+	      [&]()
+	      {
+		      stencils.clear();
+
+		      for (const auto& latlon : stations)
+		      {
+			      stencils.push_back(MakeStencil(field.second, latlon));
+		      }
+	      });
+
+	Bench("apply_stencil", bopts.stations,
+	      [&]()
+	      {
+		      double sum = 0;
+
+		      for (const auto& stencil : stencils)
+		      {
+			      sum += ApplyStencil(field.second, stencil);
+		      }
+
+		      sink = sum;
+	      });
+
+	// Applying weights, with the layout of MosWorker
+
+	std::vector<double> weights(n, 0.01), values(n, 273.15);
+
+	Bench("apply_weights", n,
+	      [&]()
+	      {
+		      double sum = 0;
+
+		      for (size_t s = 0; s < bopts.stations; s++)
+		      {
+			      const size_t offset = s * bopts.predictors;
+			      sum += ApplyWeights(values.data() + offset, weights.data() + offset, bopts.predictors);
+		      }
+
+		      sink = sum;
+	      });
+
+	return ret;
+}
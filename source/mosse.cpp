@@ -1,11 +1,22 @@
+#include "AllocationStats.h"
+#include "Capture.h"
+#include "CompactGrid.h"
 #include "MosDB.h"
 #include "MosWorker.h"
 #include "NFmiRadonDB.h"
+#include "Logger.h"
 #include "Options.h"
+#include "Plan.h"
+#include "SampleCache.h"
+#include "ThreadPool.h"
+#include "TraceEvents.h"
+#include "Verification.h"
 #include <boost/iostreams/filter/gzip.hpp>
 #include <boost/iostreams/filtering_stream.hpp>
 #include <boost/program_options.hpp>
+#include <boost/regex.hpp>
 #include <boost/filesystem.hpp>
+#include <fstream>
 #include <iostream>
 #include <mutex>
 #include <string>
@@ -14,12 +25,17 @@
 
 std::mutex mut;
 static std::vector<std::string> params;
-std::map<int, std::map<std::string, Weights>> allWeights;
+// label -> step -> target param -> weights
+WeightStore allWeights;
 
-static int step;
+static std::vector<Task> tasks;
+static size_t nextTask = 0;
+static int stationGroups = 1;
 
 Options opts;
 
+bool MergeShards();
+
 void ParseCommandLine(int argc, char** argv)
 {
 	namespace po = boost::program_options;
@@ -29,8 +45,9 @@ void ParseCommandLine(int argc, char** argv)
 	// clang-format off
 	desc.add_options()
 		("help,h", "print out help message")
-		("mos-label,m", po::value<std::string>(&opts.mosLabel), "mos label (required)")
+		("mos-label,m", po::value<std::string>(&opts.mosLabel), "mos label, comma separated list (required)")
 		("threads,j", po::value(&opts.threadCount), "number of started threads")
+		("station-threads", po::value(&opts.stationThreads), "number of threads sharing the stations of one param and step")
 		("start-step,s", po::value(&opts.startStep), "start step")
 		("end-step,e", po::value(&opts.endStep), "end step")
 		("step-length,l", po::value(&opts.stepLength), "step length")
@@ -40,9 +57,27 @@ void ParseCommandLine(int argc, char** argv)
 		("trace", "write trace information to log and database (default false)")
 		("analysis_time,a", po::value(&opts.analysisTime), "specify analysis time (SQL full timestamp, default=latest from database)")
 		("disable0125", "disable interpolation to 0.125 degree grid")
-		("weights-file", po::value(&opts.weightsFile), "read weights from file")
+		("weights-file", po::value(&opts.weightsFile), "read weights from file, comma separated list with one file per mos label")
 		("ecmwf-geometry", po::value(&opts.sourceGeom), "source data geometry (default ECGLO0100)")
 		("producer-id", po::value(&opts.producerId), "producer id, only when --weights-file is used (default 131)")
+		("ensemble-size", po::value(&opts.ensembleSize), "apply weights to each member of an ensemble of given size (default 0 = deterministic)")
+		("ensemble-producer-id", po::value(&opts.ensembleProducerId), "producer id of ensemble source data (default 242)")
+		("log-level", po::value(&opts.logLevel), "debug, info, warning or error (default info)")
+		("log-rate-limit", po::value(&opts.logRateLimit), "max messages per second of one kind, like missing values of one predictor (default 20, 0 = no limit)")
+		("param-config", po::value(&opts.paramConfig), "read additional parameter definitions from file")
+		("quantiles", po::value(&opts.quantiles), "quantiles calculated from ensemble members, comma separated list (for example 0.1,0.5,0.9)")
+		("fast-path", po::value(&opts.fastPath), "faster interpolation, comma separated list: stencil, native-grid, compact (default reference)")
+		("compact-max-error", po::value(&opts.compactMaxError), "with --fast-path compact, fields that would have larger absolute error (in units of source data) are cached as float (default 0.1, negative = no limit)")
+		("verify-against-reference", "run each task with both --fast-path and reference path and report differences; reference results are written")
+		("verify-tolerance", po::value(&opts.verifyTolerance), "with --verify-against-reference exit with error if outputs differ more than this")
+		("source-catalog", po::value(&opts.sourceCatalog), "read source data locations from csv file instead of radon, requires -a")
+		("shard", po::value<std::string>(), "process only part i/N of the work, for example 2/4; outputs are joined with --merge-shards")
+		("merge-shards", "join outputs of all shards in current directory to normal output files, and exit")
+		("sample-cache", po::value(&opts.sampleCache), "directory for cached station values of predictors, one file per analysis time")
+		("trace-events", po::value(&opts.traceEvents), "write timeline of each thread to file as Chrome trace-event json (open with Perfetto)")
+		("plan", "resolve weights, predictors and source data locations of all tasks, print grid loads and size estimates, and exit without computing anything")
+		("capture", po::value(&opts.capture), "copy source data messages, weights and options of the run to directory, for repeating the run with --replay")
+		("replay", po::value(&opts.replay), "repeat a run captured to directory without radon or mos database; other options given override captured ones")
 		;
 	// clang-format on
 
@@ -52,6 +87,23 @@ void ParseCommandLine(int argc, char** argv)
 	po::variables_map opt;
 	po::store(po::command_line_parser(argc, argv).options(desc).positional(p).run(), opt);
 
+	// Values given on command line are stored first, so they take precedence
+	// over captured ones
+
+	if (opt.count("replay"))
+	{
+		try
+		{
+			const auto args = Capture::ReplayArguments(opt["replay"].as<std::string>());
+			po::store(po::command_line_parser(args).options(desc).run(), opt);
+		}
+		catch (const std::exception& e)
+		{
+			std::cerr << e.what() << std::endl;
+			exit(1);
+		}
+	}
+
 	po::notify(opt);
 
 	if (opt.count("help"))
@@ -61,14 +113,49 @@ void ParseCommandLine(int argc, char** argv)
 		std::cout << std::endl << "Examples:" << std::endl;
 		std::cout << "  mosse -s 3 -e 6 -l 3 -m MOS_ECMWF_r144 --trace -p T-K" << std::endl;
 		std::cout << "  mosse -s 3 -e 6 -l 3 --weights-file weights.csv -m MOS_ECMWF_040422 -p T-K" << std::endl;
+		std::cout << "  mosse -s 3 -e 6 -l 3 -m MOS_ECMWF_r144,MOS_ECMWF_040422 -p T-K" << std::endl;
+		std::cout << "  mosse -s 3 -e 6 -l 3 -m MOS_ECMWF_r144 -p T-K --ensemble-size 51 --quantiles 0.1,0.5,0.9" << std::endl;
+		std::cout << "  mosse -s 0 -e 240 -l 3 -m MOS_ECMWF_r144 -p T-K --shard 1/8 (and 2/8 ... 8/8), then mosse --merge-shards" << std::endl;
+		std::cout << "  mosse -s 3 -e 6 -l 3 -m MOS_ECMWF_r144 -p T-K --fast-path stencil,native-grid --verify-against-reference" << std::endl;
+		std::cout << "  mosse -s 0 -e 240 -l 3 -m MOS_ECMWF_r144 -p T-K -j 4 --plan" << std::endl;
+		std::cout << "  mosse -s 3 -e 6 -l 3 -m MOS_ECMWF_r144 -p T-K --capture run1, then elsewhere mosse --replay run1" << std::endl;
 		exit(0);
 	}
 
+	if (opt.count("merge-shards"))
+	{
+		exit(MergeShards() ? 0 : 1);
+	}
+
+	if (opt.count("shard"))
+	{
+		const std::string shard = opt["shard"].as<std::string>();
+
+		if (sscanf(shard.c_str(), "%d/%d", &opts.shardIndex, &opts.shardCount) != 2 || opts.shardCount < 1 ||
+		    opts.shardIndex < 1 || opts.shardIndex > opts.shardCount)
+		{
+			std::cerr << "Shard should be given as i/N, where 1 <= i <= N: " << shard << std::endl;
+			exit(1);
+		}
+	}
+
 	if (opt.count("trace"))
 	{
 		opts.trace = true;
 	}
 
+	if (opts.replay.empty() == false)
+	{
+		Capture::SetReplayOptions(opts.replay);
+	}
+
+	if (opts.capture.empty() == false && opts.sampleCache.empty() == false)
+	{
+		// Fields found in sample cache are never looked up from catalog
+		std::cerr << "Capture cannot be used with sample cache" << std::endl;
+		exit(1);
+	}
+
 	if (opts.weightsFile.empty() == false && opts.trace)
 	{
 		std::cerr << "Trace option cannot be used with weights file" << std::endl;
@@ -100,54 +187,202 @@ void ParseCommandLine(int argc, char** argv)
 		std::cerr << desc;
 		exit(1);
 	}
+
+	if (opts.ensembleSize < 0)
+	{
+		std::cerr << "Ensemble size must not be negative" << std::endl;
+		exit(1);
+	}
+
+	if (opts.quantiles.empty() == false && opts.ensembleSize == 0)
+	{
+		std::cerr << "Quantiles can only be calculated with --ensemble-size" << std::endl;
+		exit(1);
+	}
+
+	if (opt.count("verify-against-reference"))
+	{
+		opts.verify = true;
+	}
+
+	if (opt.count("plan"))
+	{
+		opts.plan = true;
+	}
+
+	try
+	{
+		if (opts.verify && ExecutionPath::Parse(opts.fastPath).IsReference())
+		{
+			std::cerr << "Verification needs a path other than reference with --fast-path" << std::endl;
+			exit(1);
+		}
+	}
+	catch (const std::exception& e)
+	{
+		std::cerr << e.what() << std::endl;
+		exit(1);
+	}
+
+	if (opts.sourceCatalog.empty() == false && opts.analysisTime.empty())
+	{
+		std::cerr << "Analysis time must be specified with --source-catalog" << std::endl;
+		exit(1);
+	}
 }
 
-bool DistributeWork(int& curstep)
+bool DistributeWork(Task& task)
 {
+	TraceSpan span("distribute work");
 	std::lock_guard<std::mutex> lock(mut);
 
-	if (step <= opts.endStep)
+	if (nextTask < tasks.size())
 	{
-		curstep = step;
-		step += opts.stepLength;
+		task = tasks[nextTask++];
 		return true;
 	}
 
 	return false;
 }
 
-void ReadWeights(const MosInfo& mosInfo, std::istream& in)
+// Work is split to units of one step (all params and labels, since they
+// share source data) and station group. Stations are split to groups only
+// if there are fewer steps than shards, since every group reads all source
+// data of its step. Units cost about the same, so each shard gets an equal
+// number of consecutive units; consecutive steps share some source fields
+// (previous steps of accumulations).
+
+void PlanWork()
 {
-	auto PeriodIdFromDate = [](const std::string& date)
+	std::vector<int> steps;
+
+	for (int s = opts.startStep; s <= opts.endStep; s += opts.stepLength)
 	{
-		std::string atime = date.substr(0, 10);
+		steps.push_back(s);
+	}
+
+	if (opts.shardCount == 0)
+	{
+		for (int s : steps)
+		{
+			tasks.push_back(Task{s, 0});
+		}
+
+		return;
+	}
 
-		int month = std::stoi(date.substr(5, 2));
-		int day = std::stoi(date.substr(8, 2));
+	const size_t shards = static_cast<size_t>(opts.shardCount);
+	const size_t shard = static_cast<size_t>(opts.shardIndex - 1);
 
-		if (month == 2 && day == 29)
+	const size_t groups = steps.empty() ? 1 : std::max<size_t>(1, (shards + steps.size() - 1) / steps.size());
+	const size_t units = steps.size() * groups;
+
+	stationGroups = static_cast<int>(groups);
+
+	for (size_t u = shard * units / shards; u < (shard + 1) * units / shards; u++)
+	{
+		tasks.push_back(Task{steps[u / groups], static_cast<int>(u % groups)});
+	}
+
+	Log(kLogInfo) << "Shard " << opts.shardIndex << "/" << opts.shardCount << " has " << tasks.size() << " of "
+	              << units << " tasks (" << stationGroups << " station groups per step)";
+}
+
+// Outputs of shards are named like mos_T-K_003.part1of2.txt. Parts of an
+// output are station groups in station order, so they are joined in order.
+
+bool MergeShards()
+{
+	const boost::regex partName("(.*)\\.part([0-9]+)of([0-9]+)\\.txt");
+
+	// output -> part number -> file
+	std::map<std::string, std::map<int, std::string>> outputs;
+	std::map<std::string, int> partCounts;
+
+	for (const auto& entry : boost::filesystem::directory_iterator("."))
+	{
+		const std::string name = entry.path().filename().string();
+		boost::smatch m;
+
+		if (boost::regex_match(name, m, partName))
+		{
+			outputs[m[1].str() + ".txt"][std::stoi(m[2].str())] = name;
+			partCounts[m[1].str() + ".txt"] = std::stoi(m[3].str());
+		}
+	}
+
+	bool ok = true;
+
+	for (const auto& output : outputs)
+	{
+		const std::string& fileName = output.first;
+		const int count = partCounts[fileName];
+
+		if (static_cast<int>(output.second.size()) != count)
+		{
+			std::cerr << "Output '" << fileName << "' has " << output.second.size() << " parts of " << count
+			          << ", not merged" << std::endl;
+			ok = false;
+			continue;
+		}
+
+		const std::string tmpName = fileName + ".tmp";
+		std::ofstream out(tmpName);
+		bool header = false;
+
+		for (const auto& part : output.second)
+		{
+			std::ifstream in(part.second);
+			std::string line;
+
+			while (std::getline(in, line))
+			{
+				if (!line.empty() && line[0] == '#')
+				{
+					if (header)
+					{
+						continue;
+					}
+
+					header = true;
+				}
+
+				out << line << "\n";
+			}
+		}
+
+		out.close();
+
+		if (!out)
+		{
+			std::cerr << "Writing '" << fileName << "' failed" << std::endl;
+			ok = false;
+			continue;
+		}
+
+		boost::filesystem::rename(tmpName, fileName);
+
+		for (const auto& part : output.second)
 		{
-			// LOL karkauspäivä
-			day = 28;
+			boost::filesystem::remove(part.second);
 		}
 
-		if (month == 12 || month < 3)
-			return 1;
-		if (month >= 3 && month < 6)
-			return 2;
-		if (month >= 6 && month < 9)
-			return 3;
-		if (month >= 9 && month < 12)
-			return 4;
+		std::cout << "Merged " << count << " parts to '" << fileName << "'" << std::endl;
+	}
 
-		return 0;  // for compiler
-	};
+	return ok;
+}
 
+void ReadWeights(const MosInfo& mosInfo, const std::string& fileName, std::istream& in)
+{
 	std::string line, col;
 
-	// yyyy-mm-dd hh:mm:ss
-	int atime = std::stoi(mosInfo.originTime.substr(11, 2));
-	const int periodId = PeriodIdFromDate(mosInfo.originTime);
+	const int atime = mosInfo.originTime.Hour();
+	int periodId = PeriodIdFromDate(mosInfo.originTime);
+
+	// Weights of a replay bundle are only those the captured run used, under
+	// the period they came with
+	const bool anyPeriod = !opts.replay.empty();
 
 	std::vector<int> steps;
 	for (int i = opts.startStep; i <= opts.endStep; i += opts.stepLength)
@@ -155,7 +390,14 @@ void ReadWeights(const MosInfo& mosInfo, std::istream& in)
 		steps.push_back(i);
 	}
 
-	std::cout << std::unitbuf << "Reading weights from file '" << opts.weightsFile << "' ";
+	Log(kLogInfo) << "Reading weights from file '" << fileName << "'";
+
+	// step -> target parameter
+	std::map<int, std::map<std::string, WeightTableBuilder>> builders;
+
+	WeightsFileLine parsed;
+	std::vector<std::string> keys;
+	std::vector<double> weights;
 
 	int numlines = 0;
 	int numweights = 0;
@@ -164,64 +406,40 @@ void ReadWeights(const MosInfo& mosInfo, std::istream& in)
 		numlines++;
 		if (numlines % 100000 == 0)
 		{
-			std::cout << ".";
+			Log(kLogDebug) << "Read " << numlines << " lines from '" << fileName << "'";
 		}
-		if (line.empty() || line[0] == '#')
+		if (!ParseWeightsLine(line, parsed))
 		{
 			continue;
 		}
-		std::vector<std::string> cols;
-		boost::split(cols, line, boost::is_any_of(","));
-
-		int nperiodId = std::stoi(cols[0]);
-		int natime = std::stoi(cols[1]);
-		int stationId = std::stoi(cols[2]);
-		double lon = std::stod(cols[3]);
-		double lat = std::stod(cols[4]);
-		int nstep = std::stoi(cols[5]);
-		std::string targetParamName = cols[6];
-
-		if (atime != natime || periodId != nperiodId || (opts.stationId != -1 && opts.stationId != stationId) ||
-		    (std::find(steps.begin(), steps.end(), nstep) == steps.end()))
+
+		if (atime != parsed.analysisHour || (!anyPeriod && periodId != parsed.periodId) ||
+		    (opts.stationId != -1 && opts.stationId != parsed.station.id) ||
+		    (std::find(steps.begin(), steps.end(), parsed.step) == steps.end()))
 		{
 			continue;
 		}
 
 		numweights++;
+		periodId = parsed.periodId;
 
-		Weight w;
-		Station s;
-		s.id = stationId;
-		s.longitude = lon;
-		s.latitude = lat;
-
-		w.weights.resize((cols.size() - 7) / 2, 0);
-		w.params.resize(w.weights.size());
+		ParseWeights(parsed, keys, weights);
 
-		for (size_t i = 7, j = 0; i < cols.size(); i += 2, j++)
+		if (!keys.empty())
 		{
-			std::string key = cols[i];
-			double val = boost::lexical_cast<double>(cols[i + 1]);
-			assert(val == val);  // no NaN
-
-			w.weights[j] = val;
-
-			ParamLevel pl(key);
-			w.params[j] = pl;
+			builders[parsed.step][parsed.targetParam].Add(parsed.station, keys, weights);
 		}
+	}
 
-		w.step = nstep;
-		w.periodId = periodId;
-
-		assert(w.params.size() == w.weights.size());
-
-		if (!w.params.empty())
+	for (auto& byStep : builders)
+	{
+		for (auto& param : byStep.second)
 		{
-			allWeights[nstep][targetParamName][s] = w;
+			allWeights[mosInfo.label][byStep.first][param.first] = param.second.Build(periodId, byStep.first);
 		}
 	}
 
-	std::cout << " done. Read " << numlines << " lines and got " << numweights << " weights\n";
+	Log(kLogInfo) << "Read " << numlines << " lines and got " << numweights << " weights from '" << fileName << "'";
 
 	if (numweights == 0)
 	{
@@ -229,80 +447,155 @@ void ReadWeights(const MosInfo& mosInfo, std::istream& in)
 	}
 }
 
-void ReadWeightsFromFile(const MosInfo& mosInfo)
+void ReadWeightsFromFile(const MosInfo& mosInfo, const std::string& fileName)
 {
-	if (!boost::filesystem::exists(opts.weightsFile))
+	if (!boost::filesystem::exists(fileName))
 	{
-		std::cerr << "File '" << opts.weightsFile << "' does not exist\n";
+		Log(kLogError) << "File '" << fileName << "' does not exist";
 		exit(1);
 	}
 
-	const auto ext = boost::filesystem::path(opts.weightsFile).extension().string();
+	const auto ext = boost::filesystem::path(fileName).extension().string();
 
 	if (ext == ".csv")
 	{
-		std::ifstream in(opts.weightsFile);
-		return ReadWeights(mosInfo, in);
+		std::ifstream in(fileName);
+		return ReadWeights(mosInfo, fileName, in);
 	}
 	else if (ext == ".gz")
 	{
 		try
 		{
-			std::ifstream file(opts.weightsFile, std::ios_base::in | std::ios_base::binary);
+			std::ifstream file(fileName, std::ios_base::in | std::ios_base::binary);
 			boost::iostreams::filtering_istream in;
 			in.push(boost::iostreams::gzip_decompressor());
 			in.push(file);
 
-			return ReadWeights(mosInfo, in);
+			return ReadWeights(mosInfo, fileName, in);
 		}
 		catch (const boost::iostreams::gzip_error& e)
 		{
-			std::cout << e.what() << '\n';
+			Log(kLogError) << e.what();
 		}
 	}
 	else
 	{
-		std::cout << "Unrecognized file extension " << ext << ", should be either .csv or .csv.gz\n";
+		Log(kLogError) << "Unrecognized file extension " << ext << ", should be either .csv or .csv.gz";
 		exit(1);
 	}
 }
 
-void Run(MosInfo mosInfo, int threadId)
+void Run(std::vector<MosInfo> mosInfos, int threadId)
 {
-	printf("Thread %d started\n", threadId);
+	TraceEvents::Instance()->NameThread("worker " + std::to_string(threadId));
+	Log(kLogInfo) << "Thread " << threadId << " started";
 
 	MosWorker mosher;
 
-	int curstep = -1;  // Will change at DistributeWork
+	Task task;
 
-	while (DistributeWork(curstep))
+	while (DistributeWork(task))
 	{
+		const int curstep = task.step;
+
 		for (const auto& p : params)
 		{
-			mosInfo.paramName = p;
-			printf("Thread %d processing param %s step %d\n", threadId, mosInfo.paramName.c_str(), curstep);
-			mosher.Mosh(mosInfo, curstep);
+			// All mos versions of one param and step are processed by the same
+			// worker, so that source data is read only once
+
+			for (auto& mosInfo : mosInfos)
+			{
+				mosInfo.paramName = p;
+				mosInfo.stationGroup = task.stationGroup;
+				mosInfo.stationGroups = stationGroups;
+				Log(kLogInfo) << "Thread " << threadId << " processing param " << mosInfo.paramName << " step " << curstep
+				              << " label " << mosInfo.label;
+				mosher.Mosh(mosInfo, curstep);
+			}
 		}
 	}
 
-	printf("Thread %d stopped\n", threadId);
+	Log(kLogInfo) << "Thread " << threadId << " stopped";
 }
 
-int main(int argc, char** argv)
+int Mosse(int argc, char** argv)
 {
 	ParseCommandLine(argc, argv);
 
+	Logger::Instance()->Start(Logger::ParseLevel(opts.logLevel), opts.logRateLimit);
+
+	if (opts.traceEvents.empty() == false)
+	{
+		TraceEvents::Instance()->Open(opts.traceEvents);
+		TraceEvents::Instance()->NameThread("main");
+	}
+
+	if (opts.paramConfig.empty() == false)
+	{
+		ParamRegistry::Load(opts.paramConfig);
+	}
+
+	if (opts.sampleCache.empty() == false)
+	{
+		if (!boost::filesystem::is_directory(opts.sampleCache))
+		{
+			throw std::runtime_error("Sample cache directory '" + opts.sampleCache + "' does not exist");
+		}
+
+		SampleCache::Instance()->Open(opts.sampleCache);
+	}
+
 	std::unique_ptr<MosDB> m;
 
-	MosInfo mosInfo;
-	mosInfo.producerId = opts.producerId;
+	std::vector<std::string> labels, weightsFiles;
 
-	if (opts.weightsFile.empty())
+	if (opts.mosLabel.empty() == false)
+	{
+		boost::split(labels, opts.mosLabel, boost::is_any_of(","));
+	}
+
+	if (opts.weightsFile.empty() == false)
+	{
+		boost::split(weightsFiles, opts.weightsFile, boost::is_any_of(","));
+
+		if (labels.empty() && weightsFiles.size() == 1)
+		{
+			labels.push_back("");
+		}
+		else if (labels.size() != weightsFiles.size())
+		{
+			throw std::runtime_error("Each mos label needs its own weights file");
+		}
+	}
+	else
 	{
 		m = std::unique_ptr<MosDB>(MosDBPool::Instance()->GetConnection());
-		mosInfo = m->GetMosInfo(opts.mosLabel);
 	}
 
+	std::vector<MosInfo> mosInfos;
+
+	for (const auto& label : labels)
+	{
+		MosInfo mosInfo;
+		mosInfo.producerId = opts.producerId;
+		mosInfo.label = label;
+
+		if (opts.weightsFile.empty())
+		{
+			mosInfo = m->GetMosInfo(label);
+		}
+
+		// Source data is shared between mos versions
+		if (mosInfos.empty() == false && mosInfos[0].producerId != mosInfo.producerId)
+		{
+			throw std::runtime_error("All mos versions should have the same producer");
+		}
+
+		mosInfos.push_back(mosInfo);
+	}
+
+	MosInfo mosInfo = mosInfos[0];
+
 	if (opts.analysisTime.empty())
 	{
 		NFmiRadonDB::Instance().Connect();
@@ -323,44 +616,99 @@ int main(int argc, char** argv)
 			throw std::runtime_error("Data not found from radon for ref_prod " + ref_prod);
 		}
 
-		mosInfo.originTime = latest;
+		mosInfo.originTime = AnalysisTime::Parse(latest);
 	}
 	else
 	{
-		mosInfo.originTime = opts.analysisTime;
-	}
-
-	if (opts.weightsFile.empty() == false)
-	{
-		ReadWeightsFromFile(mosInfo);
+		mosInfo.originTime = AnalysisTime::Parse(opts.analysisTime);
 	}
 
-	const std::string ahour = mosInfo.originTime.substr(11, 2);
-
-	if (ahour != "00" && ahour != "12")
+	if (mosInfo.originTime.Hour() != 0 && mosInfo.originTime.Hour() != 12)
 	{
-		throw std::runtime_error("analysis hour is neither 00 nor 12 (" + mosInfo.originTime + ")");
+		throw std::runtime_error("analysis hour is neither 00 nor 12 (" + mosInfo.originTime.ToString() + ")");
 	}
 
 	mosInfo.traceOutput = opts.trace;
 	mosInfo.networkId = opts.networkId;
 	mosInfo.stationId = opts.stationId;
+	mosInfo.ensembleSize = opts.ensembleSize;
+	mosInfo.ensembleProducerId = opts.ensembleProducerId;
+
+	if (opts.quantiles.empty() == false)
+	{
+		std::vector<std::string> qs;
+		boost::split(qs, opts.quantiles, boost::is_any_of(","));
+
+		for (const auto& q : qs)
+		{
+			const double quantile = std::stod(q);
+
+			if (quantile < 0 || quantile > 1)
+			{
+				throw std::runtime_error("Quantile should be between 0 and 1: " + q);
+			}
+
+			mosInfo.quantiles.push_back(quantile);
+		}
+	}
 
 #ifdef DEBUG
-	std::cout << "Analysis time: " << mosInfo.originTime << std::endl;
+	Log(kLogDebug) << "Analysis time: " << mosInfo.originTime;
 #endif
 
+	// Settings of the run are the same for all mos versions; the rest comes
+	// from mos database or weights file of each
+
+	for (size_t i = 0; i < mosInfos.size(); i++)
+	{
+		mosInfos[i].originTime = mosInfo.originTime;
+		mosInfos[i].traceOutput = mosInfo.traceOutput;
+		mosInfos[i].networkId = mosInfo.networkId;
+		mosInfos[i].stationId = mosInfo.stationId;
+		mosInfos[i].ensembleSize = mosInfo.ensembleSize;
+		mosInfos[i].ensembleProducerId = mosInfo.ensembleProducerId;
+		mosInfos[i].quantiles = mosInfo.quantiles;
+
+		// Outputs are tagged with label only when several mos versions are run
+		mosInfos[i].outputTag = (mosInfos.size() > 1) ? mosInfos[i].label : "";
+
+		if (weightsFiles.empty() == false)
+		{
+			ReadWeightsFromFile(mosInfos[i], weightsFiles[i]);
+		}
+	}
+
 	NFmiRadonDBPool::Instance()->MaxWorkers(opts.threadCount + 1);
 
+	// Worker thread itself processes stations too
+	ThreadPool::Instance()->Start(static_cast<size_t>(std::max(0, opts.stationThreads - 1)));
+
 	boost::split(params, opts.paramName, boost::is_any_of(","));
 
-	step = opts.startStep;
+	PlanWork();
+
+	if (opts.plan)
+	{
+		const bool complete = Plan::Build(mosInfos, params, tasks, stationGroups).Report(std::cout, opts.threadCount);
+
+		if (m)
+		{
+			MosDBPool::Instance()->Release(m.release());
+		}
+
+		return complete ? 0 : 1;
+	}
+
+	if (opts.capture.empty() == false)
+	{
+		Capture::Instance()->Open(opts.capture, mosInfos);
+	}
 
 	std::vector<std::thread> threadGroup;
 
 	for (int i = 0; i < opts.threadCount; i++)
 	{
-		threadGroup.push_back(std::thread(Run, mosInfo, i));
+		threadGroup.push_back(std::thread(Run, mosInfos, i));
 	}
 
 	for (auto& t : threadGroup)
@@ -368,9 +716,39 @@ int main(int argc, char** argv)
 		t.join();
 	}
 
+	TraceEvents::Instance()->Write();
+	Capture::Instance()->Finish();
+	CompactGrid::Report();
+	ReportAllocations();
+
 	if (opts.weightsFile.empty())
 	{
 		MosDBPool::Instance()->Release(m.get());
 		m.release();
 	}
+
+	if (opts.verify)
+	{
+		return Verification::Instance()->Report(ExecutionPath::Parse(opts.fastPath).Name(), opts.verifyTolerance) ? 0 : 1;
+	}
+
+	return 0;
+}
+
+int main(int argc, char** argv)
+{
+	// Messages still in thread buffers are written out also when the run
+	// ends with an exception
+	LogScope logScope;
+
+	try
+	{
+		return Mosse(argc, argv);
+	}
+	catch (const std::exception& e)
+	{
+		Log(kLogError) << e.what();
+	}
+
+	return 1;
 }